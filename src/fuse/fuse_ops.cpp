@@ -12,9 +12,19 @@
 #include <iostream>
 #include <stmpfs.h>
 #include <fuse_ops.h>
+#include <compressor.h>
+#include <dedup.h>
+#include <quota.h>
+#include <spill.h>
+#include <image.h>
+#include <journal.h>
+#include <backing.h>
+#include <dentry_cache.h>
 #include <execinfo.h>
 #include <sys/xattr.h>
 #include <sys/sysinfo.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
 
@@ -57,15 +67,65 @@
 /// filesystem root
 inode_t filesystem_root;
 
-int do_getattr (const char *path, struct stat *stbuf)
+int error_number(const stmpfs_error_t & error)
+{
+    if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
+    {
+        return ENOENT; // No such file or directory (POSIX.1-2001)
+    }
+
+    if (error.my_errcode() == STMPFS_ERROR_NO_SPACE_LEFT)
+    {
+        return ENOSPC; // No space left on device (POSIX.1-2001)
+    }
+
+    return error.my_errno() != 0 ? error.my_errno() : EIO;
+}
+
+/// split a path into parent directory and last name, both pointing into path
+/** @param path absolute path
+ *  @param name set to last name, empty for root
+ *  @return parent directory path **/
+static std::string_view split_parent(std::string_view path, std::string_view & name)
+{
+    auto slash = path.rfind('/');
+    if (slash == std::string_view::npos)
+    {
+        name = path;
+        return "/";
+    }
+
+    name = path.substr(slash + 1);
+    return path.substr(0, slash == 0 ? 1 : slash);
+}
+
+/// find an entry of a directory, loading it from backing directory if needed
+/** @param path entry path, nullptr if backing directory is not enabled
+ *  @return inode, nullptr if not found **/
+static inode_t * lookup_child(const char * path, inode_t & parent, std::string_view name)
+{
+    if (path != nullptr && backing.enabled())
+    {
+        return lookup_inode(path, filesystem_root);
+    }
+
+    return parent.lookup_dentry(name);
+}
+
+int do_getattr (const char *path, struct stat *stbuf, struct fuse_file_info *)
 {
     try
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-        *stbuf = inode.fs_stat;
+        // missing paths are probed a lot, so they are not reported as errors
+        auto * inode = lookup_inode(path, filesystem_root);
+        if (inode == nullptr)
+        {
+            return -ENOENT; // No such file or directory (POSIX.1-2001)
+        }
+
+        *stbuf = inode->fs_stat;
 
         return 0;
     }
@@ -73,11 +133,7 @@ int do_getattr (const char *path, struct stat *stbuf)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -90,37 +146,47 @@ int do_getattr (const char *path, struct stat *stbuf)
 int do_readdir (const char *path,
                 void *buffer,
                 fuse_fill_dir_t filler,
-                off_t,
-                struct fuse_file_info *)
+                off_t offset,
+                struct fuse_file_info *,
+                enum fuse_readdir_flags)
 {
     try
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
+        auto &inode = pathname_to_inode(path, filesystem_root);
+        inode.fs_stat.st_atim = current_time();
+        inode.changed();
+        backing.list(path, inode);
 
-        filler(buffer, ".", nullptr, 0);  // Current Directory
-        filler(buffer, "..", nullptr, 0); // Parent Directory
+        // every entry carries its cookie as offset, so a full buffer is resumed after it,
+        // and its attributes, so listing with types needs no getattr per entry
+        if (offset < 1 && filler(buffer, ".", &inode.fs_stat, 1, FUSE_FILL_DIR_PLUS) != 0)  // Current Directory
+        {
+            return 0;
+        }
 
-        // normal read
-        auto &inode = pathname_to_inode(vpath, filesystem_root);
-        inode.fs_stat.st_atim = current_time();
+        if (offset < 2 && filler(buffer, "..", nullptr, 2, (enum fuse_fill_dir_flags)0) != 0) // Parent Directory
+        {
+            return 0;
+        }
 
-        for (auto & i: inode.my_dentry())
+        const auto & entries = inode.my_dentry();
+        for (auto it = entries.after(offset); it != entries.end(); ++it)
         {
-            filler(buffer, i.first.c_str(), nullptr, 0);
+            if (filler(buffer, it->name.c_str(), &it->dentry.inode->fs_stat, (off_t)it->cookie, FUSE_FILL_DIR_PLUS) != 0)
+            {
+                break;
+            }
         }
+
         return 0;
     }
     catch (stmpfs_error_t & error)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -130,26 +196,41 @@ int do_readdir (const char *path,
     }
 }
 
+inode_t & inode_mkdir(const char * path, inode_t & parent, std::string_view name, mode_t mode)
+{
+    if (path != nullptr)
+    {
+        backing.mkdir(path, mode);
+        dentry_cache.invalidate(path, false);
+    }
+
+    inode_t new_inode;
+    auto cur_time = current_time();
+    new_inode.fs_stat.st_mode = mode | S_IFDIR;
+    new_inode.fs_stat.st_atim = cur_time;
+    new_inode.fs_stat.st_ctim = cur_time;
+    new_inode.fs_stat.st_mtim = cur_time;
+    auto & inode = parent.emplace_new_dentry(name, new_inode);
+
+    if (path != nullptr)
+    {
+        parent.journal_lsn = journal.append(JOURNAL_MKDIR, std::string_view(path), (uint64_t)mode);
+        inode.journal_lsn = parent.journal_lsn;
+    }
+
+    return inode;
+}
+
 int do_mkdir (const char * path, mode_t mode)
 {
     try
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
-
         // get target name
-        std::string tag_name = vpath.get_direct_pathname().back();
-        vpath.get_direct_pathname().pop_back();
-
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-        inode_t new_inode;
-        auto cur_time = current_time();
-        new_inode.fs_stat.st_mode = mode | S_IFDIR;
-        new_inode.fs_stat.st_atim = cur_time;
-        new_inode.fs_stat.st_ctim = cur_time;
-        new_inode.fs_stat.st_mtim = cur_time;
-        inode.emplace_new_dentry(tag_name, new_inode);
+        std::string_view tag_name;
+        auto & inode = pathname_to_inode(split_parent(path, tag_name), filesystem_root);
+        inode_mkdir(path, inode, tag_name, mode);
 
         return 0;
     }
@@ -157,11 +238,7 @@ int do_mkdir (const char * path, mode_t mode)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -171,16 +248,29 @@ int do_mkdir (const char * path, mode_t mode)
     }
 }
 
-int do_chmod (const char * path, mode_t mode)
+void inode_chmod(const char * path, inode_t & inode, mode_t mode)
+{
+    if (path != nullptr)
+    {
+        backing.chmod(path, mode);
+    }
+
+    inode.fs_stat.st_mode = mode;
+    inode.changed();
+
+    if (path != nullptr)
+    {
+        inode.journal_lsn = journal.append(JOURNAL_CHMOD, std::string_view(path), (uint64_t)mode);
+    }
+}
+
+int do_chmod (const char * path, mode_t mode, struct fuse_file_info *)
 {
     try
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
-
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-        inode.fs_stat.st_mode = mode;
+        inode_chmod(path, pathname_to_inode(path, filesystem_root), mode);
 
         return 0;
     }
@@ -188,11 +278,7 @@ int do_chmod (const char * path, mode_t mode)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -202,17 +288,30 @@ int do_chmod (const char * path, mode_t mode)
     }
 }
 
-int do_chown (const char * path, uid_t uid, gid_t gid)
+void inode_chown(const char * path, inode_t & inode, uid_t uid, gid_t gid)
+{
+    if (path != nullptr)
+    {
+        backing.chown(path, uid, gid);
+    }
+
+    inode.fs_stat.st_uid = uid;
+    inode.fs_stat.st_gid = gid;
+    inode.changed();
+
+    if (path != nullptr)
+    {
+        inode.journal_lsn = journal.append(JOURNAL_CHOWN, std::string_view(path), (uint64_t)uid, (uint64_t)gid);
+    }
+}
+
+int do_chown (const char * path, uid_t uid, gid_t gid, struct fuse_file_info *)
 {
     try
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
-
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-        inode.fs_stat.st_uid = uid;
-        inode.fs_stat.st_gid = gid;
+        inode_chown(path, pathname_to_inode(path, filesystem_root), uid, gid);
 
         return 0;
     }
@@ -220,11 +319,7 @@ int do_chown (const char * path, uid_t uid, gid_t gid)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -234,31 +329,44 @@ int do_chown (const char * path, uid_t uid, gid_t gid)
     }
 }
 
-int do_create (const char * path, mode_t mode, struct fuse_file_info *)
+inode_t & inode_create(const char * path, inode_t & parent, std::string_view name, mode_t mode)
 {
-    try
+    if (path != nullptr)
     {
-        FUNCTION_INFO;
+        backing.create(path, mode);
+        dentry_cache.invalidate(path, false);
+    }
 
-        stmpfs_pathname_t vpath(path);
+    inode_t new_inode;
 
-        // get target name
-        std::string tag_name = vpath.get_direct_pathname().back();
-        vpath.get_direct_pathname().pop_back();
+    // fill up info
+    auto cur_time = current_time();
+    new_inode.fs_stat.st_mode = mode;
+    new_inode.fs_stat.st_nlink = 1;
+    new_inode.fs_stat.st_atim = cur_time;
+    new_inode.fs_stat.st_ctim = cur_time;
+    new_inode.fs_stat.st_mtim = cur_time;
+    auto & inode = parent.emplace_new_dentry(name, new_inode);
 
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
+    if (path != nullptr)
+    {
+        parent.journal_lsn = journal.append(JOURNAL_CREATE, std::string_view(path), (uint64_t)mode);
+        inode.journal_lsn = parent.journal_lsn;
+    }
 
-        inode_t new_inode;
+    return inode;
+}
 
-        // fill up info
-        auto cur_time = current_time();
-        new_inode.fs_stat.st_mode = mode;
-        new_inode.fs_stat.st_nlink = 1;
-        new_inode.fs_stat.st_atim = cur_time;
-        new_inode.fs_stat.st_ctim = cur_time;
-        new_inode.fs_stat.st_mtim = cur_time;
+int do_create (const char * path, mode_t mode, struct fuse_file_info *)
+{
+    try
+    {
+        FUNCTION_INFO;
 
-        inode.emplace_new_dentry(tag_name, new_inode);
+        // get target name
+        std::string_view tag_name;
+        auto & inode = pathname_to_inode(split_parent(path, tag_name), filesystem_root);
+        inode_create(path, inode, tag_name, mode);
 
         return 0;
     }
@@ -266,11 +374,7 @@ int do_create (const char * path, mode_t mode, struct fuse_file_info *)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -286,10 +390,41 @@ int do_flush (const char * path, struct fuse_file_info *)
     return 0;
 }
 
+void inode_release(const char * path, inode_t & inode)
+{
+    if (path != nullptr)
+    {
+        backing.flush(path, inode, false);
+    }
+
+    // file is closed, its full extents can be merged with identical ones
+    // and its partial tail packed until it is written again
+    inode.deduplicate();
+    inode.pack_tail();
+}
+
 int do_release (const char * path, struct fuse_file_info *)
 {
-    FUNCTION_INFO;
-    return 0;
+    try
+    {
+        FUNCTION_INFO;
+
+        inode_release(path, pathname_to_inode(path, filesystem_root));
+
+        return 0;
+    }
+    catch (stmpfs_error_t & error)
+    {
+        OBTAIN_STACK_FRAME;
+        std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
+        return -error_number(error);
+    }
+    catch (std::exception & error)
+    {
+        OBTAIN_STACK_FRAME;
+        std::cerr << error.what() << " (errno=" << strerror(errno) << ")" << std::endl;
+        return -errno;
+    }
 }
 
 int do_open (const char * path, struct fuse_file_info *)
@@ -298,10 +433,14 @@ int do_open (const char * path, struct fuse_file_info *)
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
+        auto * inode = lookup_inode(path, filesystem_root);
+        if (inode == nullptr)
+        {
+            return -ENOENT; // No such file or directory (POSIX.1-2001)
+        }
 
-        inode_t & inode = pathname_to_inode(vpath, filesystem_root);
-        inode.fs_stat.st_atim = current_time();
+        inode->fs_stat.st_atim = current_time();
+        inode->changed();
 
         return 0;
     }
@@ -309,11 +448,7 @@ int do_open (const char * path, struct fuse_file_info *)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -333,21 +468,17 @@ int do_read (const char *path,
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
-
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
+        auto & inode = pathname_to_inode(path, filesystem_root);
         inode.fs_stat.st_atim = current_time();
+        inode.changed();
+        backing.read(path, inode, offset, size);
         return (int)inode.read(buffer, size, offset);
     }
     catch (stmpfs_error_t & error)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -357,6 +488,27 @@ int do_read (const char *path,
     }
 }
 
+size_t inode_write(const char * path, inode_t & inode, const char * buffer, size_t size, off_t offset)
+{
+    inode.fs_stat.st_ctim = current_time();
+
+    if (path != nullptr)
+    {
+        backing.prepare_write(path, inode, buffer, size, offset);
+    }
+
+    auto written = inode.write(buffer, size, offset);
+    backing.commit_write(inode, offset, written);
+
+    if (path != nullptr)
+    {
+        inode.journal_lsn = journal.append(JOURNAL_WRITE, std::string_view(path), (uint64_t)offset,
+                                           std::string_view(buffer, written));
+    }
+
+    return written;
+}
+
 int do_write (const char * path, const char * buffer, size_t size, off_t offset,
              struct fuse_file_info *)
 {
@@ -364,21 +516,13 @@ int do_write (const char * path, const char * buffer, size_t size, off_t offset,
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
-
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-        inode.fs_stat.st_ctim = current_time();
-        return (int)inode.write(buffer, size, offset);
+        return (int)inode_write(path, pathname_to_inode(path, filesystem_root), buffer, size, offset);
     }
     catch (stmpfs_error_t & error)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -388,17 +532,32 @@ int do_write (const char * path, const char * buffer, size_t size, off_t offset,
     }
 }
 
-int do_utimens (const char * path, const struct timespec tv[2])
+void inode_utimens(const char * path, inode_t & inode, const struct timespec tv[2])
+{
+    if (path != nullptr)
+    {
+        backing.utimens(path, tv);
+    }
+
+    inode.fs_stat.st_atim = tv[0];
+    inode.fs_stat.st_mtim = tv[1];
+    inode.changed();
+
+    if (path != nullptr)
+    {
+        inode.journal_lsn = journal.append(JOURNAL_UTIMENS, std::string_view(path),
+                                           (uint64_t)tv[0].tv_sec, (uint64_t)tv[0].tv_nsec,
+                                           (uint64_t)tv[1].tv_sec, (uint64_t)tv[1].tv_nsec);
+    }
+}
+
+int do_utimens (const char * path, const struct timespec tv[2], struct fuse_file_info *)
 {
     try
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
-
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-        inode.fs_stat.st_atim = tv[0];
-        inode.fs_stat.st_mtim = tv[1];
+        inode_utimens(path, pathname_to_inode(path, filesystem_root), tv);
 
         return 0;
     }
@@ -406,11 +565,7 @@ int do_utimens (const char * path, const struct timespec tv[2])
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -420,35 +575,44 @@ int do_utimens (const char * path, const struct timespec tv[2])
     }
 }
 
+void inode_unlink(const char * path, inode_t & parent, std::string_view name)
+{
+    if (path != nullptr)
+    {
+        // target may only be in backing directory so far, load it to remove it from both
+        if (backing.enabled())
+        {
+            pathname_to_inode(path, filesystem_root);
+        }
+
+        backing.unlink(path);
+        dentry_cache.invalidate(path, false);
+    }
+
+    parent.del_dentry(name);
+
+    if (path != nullptr)
+    {
+        parent.journal_lsn = journal.append(JOURNAL_UNLINK, std::string_view(path));
+    }
+}
+
 int do_unlink (const char * path)
 {
     try
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
+        std::string_view tag_name;
+        auto parent = split_parent(path, tag_name);
 
         // attempt to delete root
-        if (vpath.get_direct_pathname().empty())
+        if (tag_name.empty())
         {
             return -EISDIR; // Is a directory (POSIX.1-2001).
         }
 
-        std::string tag_name = vpath.get_direct_pathname().back();
-        vpath.get_direct_pathname().pop_back();
-
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-//        auto * target_inode = inode.find_in_dentry(tag_name);
-
-        inode.del_dentry(tag_name);
-//        if (target_inode->fs_stat.st_nlink == 1)
-//        {
-//            inode.del_dentry(tag_name);
-//        }
-//        else
-//        {
-//            target_inode->fs_stat.st_nlink -= 1;
-//        }
+        inode_unlink(path, pathname_to_inode(parent, filesystem_root), tag_name);
 
         return 0;
     }
@@ -456,11 +620,7 @@ int do_unlink (const char * path)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -470,49 +630,62 @@ int do_unlink (const char * path)
     }
 }
 
-int do_rmdir (const char * path)
+int inode_rmdir(const char * path, inode_t & parent, std::string_view name)
 {
-    try
+    auto * target_inode = lookup_child(path, parent, name);
+    if (target_inode == nullptr)
     {
-        FUNCTION_INFO;
+        throw stmpfs_error_t(STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY);
+    }
+
+    if (!(target_inode->fs_stat.st_mode & S_IFDIR))
+    {
+        return -ENOTDIR; // Not a directory (POSIX.1-2001).
+    }
 
-        stmpfs_pathname_t vpath(path);
+    if (!target_inode->my_dentry().empty())
+    {
+        return -ENOTEMPTY; // Directory not empty (POSIX.1-2001).
+    }
 
-        if (vpath.get_direct_pathname().empty())
-        {
-            return -EBUSY;  // Device or resource busy (POSIX.1-2001).
-        }
+    // remove directory, backing one may still have entries not loaded
+    if (path != nullptr)
+    {
+        backing.rmdir(path);
+        dentry_cache.invalidate(path, false);
+    }
 
-        std::string tag_name = vpath.get_direct_pathname().back();
-        vpath.get_direct_pathname().pop_back();
+    parent.del_dentry(name);
 
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-        auto * target_inode = inode.find_in_dentry(tag_name);
+    if (path != nullptr)
+    {
+        parent.journal_lsn = journal.append(JOURNAL_RMDIR, std::string_view(path));
+    }
 
-        if (!(target_inode->fs_stat.st_mode & S_IFDIR))
-        {
-            return -ENOTDIR; // Not a directory (POSIX.1-2001).
-        }
+    return 0;
+}
+
+int do_rmdir (const char * path)
+{
+    try
+    {
+        FUNCTION_INFO;
+
+        std::string_view tag_name;
+        auto parent = split_parent(path, tag_name);
 
-        if (!target_inode->my_dentry().empty())
+        if (tag_name.empty())
         {
-            return -ENOTEMPTY; // Directory not empty (POSIX.1-2001).
+            return -EBUSY;  // Device or resource busy (POSIX.1-2001).
         }
 
-        // remove directory
-        inode.del_dentry(tag_name);
-
-        return 0;
+        return inode_rmdir(path, pathname_to_inode(parent, filesystem_root), tag_name);
     }
     catch (stmpfs_error_t & error)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -522,31 +695,44 @@ int do_rmdir (const char * path)
     }
 }
 
-int do_mknod (const char * path, mode_t mode, dev_t device)
+inode_t & inode_mknod(const char * path, inode_t & parent, std::string_view name, mode_t mode, dev_t device)
 {
-    try
+    if (path != nullptr)
     {
-        FUNCTION_INFO;
+        backing.mknod(path, mode, device);
+        dentry_cache.invalidate(path, false);
+    }
 
-        stmpfs_pathname_t vpath(path);
+    inode_t new_inode;
 
-        std::string tag_name = vpath.get_direct_pathname().back();
-        vpath.get_direct_pathname().pop_back();
+    // fill up info
+    auto cur_time = current_time();
+    new_inode.fs_stat.st_mode = mode;
+    new_inode.fs_stat.st_nlink = 1;
+    new_inode.fs_stat.st_atim = cur_time;
+    new_inode.fs_stat.st_ctim = cur_time;
+    new_inode.fs_stat.st_mtim = cur_time;
+    new_inode.fs_stat.st_dev = device;
+    auto & inode = parent.emplace_new_dentry(name, new_inode);
 
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
+    if (path != nullptr)
+    {
+        parent.journal_lsn = journal.append(JOURNAL_MKNOD, std::string_view(path), (uint64_t)mode, (uint64_t)device);
+        inode.journal_lsn = parent.journal_lsn;
+    }
 
-        inode_t new_inode;
+    return inode;
+}
 
-        // fill up info
-        auto cur_time = current_time();
-        new_inode.fs_stat.st_mode = mode;
-        new_inode.fs_stat.st_nlink = 1;
-        new_inode.fs_stat.st_atim = cur_time;
-        new_inode.fs_stat.st_ctim = cur_time;
-        new_inode.fs_stat.st_mtim = cur_time;
-        new_inode.fs_stat.st_dev = device;
+int do_mknod (const char * path, mode_t mode, dev_t device)
+{
+    try
+    {
+        FUNCTION_INFO;
 
-        inode.emplace_new_dentry(tag_name, new_inode);
+        std::string_view tag_name;
+        auto & inode = pathname_to_inode(split_parent(path, tag_name), filesystem_root);
+        inode_mknod(path, inode, tag_name, mode, device);
 
         return 0;
     }
@@ -554,11 +740,7 @@ int do_mknod (const char * path, mode_t mode, dev_t device)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -568,48 +750,74 @@ int do_mknod (const char * path, mode_t mode, dev_t device)
     }
 }
 
-int do_rename (const char * path, const char * name)
+int inode_rename(const char * path, inode_t & parent, std::string_view name,
+                 const char * new_path, inode_t & new_parent, std::string_view new_name, unsigned int flags)
 {
-    try
+    // entries are not swapped
+    if (flags & ~RENAME_NOREPLACE)
     {
-        FUNCTION_INFO;
+        return -EINVAL; // Invalid argument (POSIX.1-2001).
+    }
 
-        stmpfs_pathname_t src_vpath(path);
-        stmpfs_pathname_t dest_vpath(name);
+    if ((flags & RENAME_NOREPLACE) && lookup_child(new_path, new_parent, new_name) != nullptr)
+    {
+        return -EEXIST; // File exists (POSIX.1-2001).
+    }
 
-        // get src name, pop back
-        std::string src_name = src_vpath.get_direct_pathname().back();
-        src_vpath.get_direct_pathname().pop_back();
+    // find inode, loading it from backing directory if needed
+    inode_t * inode = lookup_child(path, parent, name);
+    if (inode == nullptr)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY);
+    }
 
-        // get dest name, pop back
-        std::string dest_name = dest_vpath.get_direct_pathname().back();
-        dest_vpath.get_direct_pathname().pop_back();
+    if (path != nullptr)
+    {
+        backing.rename(path, new_path);
 
-        auto & src_parent_inode = pathname_to_inode(src_vpath, filesystem_root);
-        auto & dest_parent_inode = pathname_to_inode(dest_vpath, filesystem_root);
+        // cached paths of whatever is moved or replaced are stale, and so are
+        // paths not found below destination if a directory is moved there
+        dentry_cache.invalidate(path, S_ISDIR(inode->fs_stat.st_mode));
+        dentry_cache.invalidate(new_path, S_ISDIR(inode->fs_stat.st_mode));
+    }
 
-        // find inode
-        inode_t * inode = src_parent_inode.find_in_dentry(src_name);
+    // remove from source parent
+    parent.del_dentry(name, true);
 
-        // remove from source parent
-        src_parent_inode.del_dentry(src_name, true);
+    // add to destination parent
+    new_parent.add_dentry(new_name, *inode, 1);
 
-        // add to destination parent
-        dest_parent_inode.add_dentry(dest_name, *inode, 1);
+    inode->fs_stat.st_ctim = current_time();
+    inode->changed();
 
-        inode->fs_stat.st_ctim = current_time();
+    if (path != nullptr)
+    {
+        inode->journal_lsn = journal.append(JOURNAL_RENAME, std::string_view(path), std::string_view(new_path));
+        parent.journal_lsn = inode->journal_lsn;
+        new_parent.journal_lsn = inode->journal_lsn;
+    }
 
-        return 0;
+    return 0;
+}
+
+int do_rename (const char * path, const char * name, unsigned int flags)
+{
+    try
+    {
+        FUNCTION_INFO;
+
+        std::string_view src_name;
+        std::string_view dest_name;
+        auto & src_parent_inode = pathname_to_inode(split_parent(path, src_name), filesystem_root);
+        auto & dest_parent_inode = pathname_to_inode(split_parent(name, dest_name), filesystem_root);
+
+        return inode_rename(path, src_parent_inode, src_name, name, dest_parent_inode, dest_name, flags);
     }
     catch (stmpfs_error_t & error)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -619,32 +827,45 @@ int do_rename (const char * path, const char * name)
     }
 }
 
-int do_symlink (const char * path, const char * linkname)
+inode_t & inode_symlink(const char * path, inode_t & parent, std::string_view name, const char * linkname)
 {
-    try
+    if (path != nullptr)
     {
-        FUNCTION_INFO;
+        backing.symlink(path, linkname);
+        dentry_cache.invalidate(path, false);
+    }
 
-        stmpfs_pathname_t vpath(path);
+    inode_t new_inode;
 
-        // get target name
-        std::string tag_name = vpath.get_direct_pathname().back();
-        vpath.get_direct_pathname().pop_back();
+    // fill up info
+    auto cur_time = current_time();
+    new_inode.fs_stat.st_mode = S_IFLNK | 0755;
+    new_inode.fs_stat.st_nlink = 1;
+    new_inode.fs_stat.st_atim = cur_time;
+    new_inode.fs_stat.st_ctim = cur_time;
+    new_inode.fs_stat.st_mtim = cur_time;
+    new_inode.write(linkname, strlen(linkname), 0);
+    auto & inode = parent.emplace_new_dentry(name, new_inode);
 
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
+    if (path != nullptr)
+    {
+        parent.journal_lsn = journal.append(JOURNAL_SYMLINK, std::string_view(path), std::string_view(linkname));
+        inode.journal_lsn = parent.journal_lsn;
+    }
 
-        inode_t new_inode;
+    return inode;
+}
 
-        // fill up info
-        auto cur_time = current_time();
-        new_inode.fs_stat.st_mode = S_IFLNK | 0755;
-        new_inode.fs_stat.st_nlink = 1;
-        new_inode.fs_stat.st_atim = cur_time;
-        new_inode.fs_stat.st_ctim = cur_time;
-        new_inode.fs_stat.st_mtim = cur_time;
-        new_inode.write(linkname, strlen(linkname), 0);
+int do_symlink (const char * path, const char * linkname)
+{
+    try
+    {
+        FUNCTION_INFO;
 
-        inode.emplace_new_dentry(tag_name, new_inode);
+        // get target name
+        std::string_view tag_name;
+        auto & inode = pathname_to_inode(split_parent(path, tag_name), filesystem_root);
+        inode_symlink(path, inode, tag_name, linkname);
 
         return 0;
     }
@@ -652,11 +873,7 @@ int do_symlink (const char * path, const char * linkname)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -666,16 +883,23 @@ int do_symlink (const char * path, const char * linkname)
     }
 }
 
+void inode_readlink(inode_t & inode, char * buffer, size_t size)
+{
+    inode.fs_stat.st_atim = current_time();
+    inode.changed();
+
+    // link target is not null-terminated in inode
+    auto length = inode.read(buffer, size - 1, 0);
+    buffer[length] = 0;
+}
+
 int do_readlink (const char * path, char * buffer, size_t size)
 {
     try
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-        inode.fs_stat.st_atim = current_time();
-        inode.read(buffer, size, 0);
+        inode_readlink(pathname_to_inode(path, filesystem_root), buffer, size);
 
         return 0;
     }
@@ -683,12 +907,83 @@ int do_readlink (const char * path, char * buffer, size_t size)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
+        return -error_number(error);
+    }
+    catch (std::exception & error)
+    {
+        OBTAIN_STACK_FRAME;
+        std::cerr << error.what() << " (errno=" << strerror(errno) << ")" << std::endl;
         return -errno;
     }
+}
+
+ssize_t inode_copy_file_range(const char * path, inode_t & source, off_t offset,
+                              const char * destination, inode_t & inode, off_t destination_offset,
+                              size_t size, int flags)
+{
+    // copies would have to be made in backing directory as well, kernel falls back to read and write
+    if (backing.enabled() || flags != 0)
+    {
+        return -EOPNOTSUPP; // Operation not supported on socket (POSIX.1-2001).
+    }
+
+    // a clone into a file in the tree is journaled, which needs its source there too
+    if (journal.enabled() && destination != nullptr && path == nullptr)
+    {
+        return -EOPNOTSUPP; // Operation not supported on socket (POSIX.1-2001).
+    }
+
+    if (!S_ISREG(source.fs_stat.st_mode) || !S_ISREG(inode.fs_stat.st_mode))
+    {
+        return -EINVAL; // Invalid argument (POSIX.1-2001).
+    }
+
+    // nothing is copied past end of source
+    if ((uint64_t)offset >= source.size())
+    {
+        return 0;
+    }
+
+    uint64_t length = MIN(size, source.size() - offset);
+    if (&source == &inode && offset < destination_offset + (off_t)length && destination_offset < offset + (off_t)length)
+    {
+        return -EINVAL; // Invalid argument (POSIX.1-2001).
+    }
+
+    // extents lining up in both files are shared, only the rest is copied, less if space ran out
+    length = inode.clone_range(source, offset, destination_offset, length);
+
+    if (path != nullptr && destination != nullptr)
+    {
+        inode.journal_lsn = journal.append(JOURNAL_CLONE, std::string_view(destination), std::string_view(path),
+                                           (uint64_t)offset, (uint64_t)destination_offset, length);
+    }
+
+    auto cur_time = current_time();
+    inode.fs_stat.st_ctim = cur_time;
+    inode.fs_stat.st_mtim = cur_time;
+
+    return (ssize_t)length;
+}
+
+ssize_t do_copy_file_range (const char * path, struct fuse_file_info *, off_t offset,
+                            const char * destination, struct fuse_file_info *, off_t destination_offset,
+                            size_t size, int flags)
+{
+    try
+    {
+        FUNCTION_INFO;
+
+        return inode_copy_file_range(path, pathname_to_inode(path, filesystem_root), offset,
+                                     destination, pathname_to_inode(destination, filesystem_root), destination_offset,
+                                     size, flags);
+    }
+    catch (stmpfs_error_t & error)
+    {
+        OBTAIN_STACK_FRAME;
+        std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
+        return -error_number(error);
+    }
     catch (std::exception & error)
     {
         OBTAIN_STACK_FRAME;
@@ -697,22 +992,79 @@ int do_readlink (const char * path, char * buffer, size_t size)
     }
 }
 
-//int do_ioctl (const char * path, int cmd, void *arg, struct fuse_file_info *, unsigned int flags, void *data)
-//{
-//    return 0;
-//}
+off_t inode_lseek(inode_t & inode, off_t offset, int whence)
+{
+    // other whence values are handled by kernel
+    if (whence != SEEK_DATA && whence != SEEK_HOLE)
+    {
+        return -EINVAL; // Invalid argument (POSIX.1-2001).
+    }
+
+    // extents not read from backing directory yet are holes in memory only, report all as data
+    if (backing.enabled())
+    {
+        if ((uint64_t)offset >= inode.size())
+        {
+            return -ENXIO;  // No such device or address (POSIX.1-2001).
+        }
+
+        return whence == SEEK_DATA ? offset : (off_t)inode.size();
+    }
 
-int do_truncate (const char * path, off_t size)
+    auto position = inode.seek(offset, whence);
+    if (position < 0)
+    {
+        return -ENXIO;  // No such device or address (POSIX.1-2001).
+    }
+
+    return position;
+}
+
+off_t do_lseek (const char * path, off_t offset, int whence, struct fuse_file_info *)
 {
     try
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
+        return inode_lseek(pathname_to_inode(path, filesystem_root), offset, whence);
+    }
+    catch (stmpfs_error_t & error)
+    {
+        OBTAIN_STACK_FRAME;
+        std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
+        return -error_number(error);
+    }
+    catch (std::exception & error)
+    {
+        OBTAIN_STACK_FRAME;
+        std::cerr << error.what() << " (errno=" << strerror(errno) << ")" << std::endl;
+        return -errno;
+    }
+}
+
+void inode_truncate(const char * path, inode_t & inode, off_t size)
+{
+    if (path != nullptr)
+    {
+        backing.truncate(path, inode, size);
+    }
+
+    inode.fs_stat.st_size = size;
+    inode.truncate(size);
+
+    if (path != nullptr)
+    {
+        inode.journal_lsn = journal.append(JOURNAL_TRUNCATE, std::string_view(path), (uint64_t)size);
+    }
+}
+
+int do_truncate (const char * path, off_t size, struct fuse_file_info *)
+{
+    try
+    {
+        FUNCTION_INFO;
 
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-        inode.fs_stat.st_size = size;
-        inode.truncate(size);
+        inode_truncate(path, pathname_to_inode(path, filesystem_root), size);
 
         return 0;
     }
@@ -720,11 +1072,7 @@ int do_truncate (const char * path, off_t size)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -734,35 +1082,107 @@ int do_truncate (const char * path, off_t size)
     }
 }
 
+int inode_fallocate(const char * path, inode_t & inode, int mode, off_t offset, off_t length)
+{
+    if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE))
+    {
+        return -EOPNOTSUPP; // Operation not supported on socket (POSIX.1-2001).
+    }
+
+    if (path != nullptr)
+    {
+        backing.fallocate(path, inode, mode, offset, length);
+    }
+
+    // punched or zeroed range reads as 0s and takes no memory
+    if (mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE))
+    {
+        inode.punch_hole(offset, length);
+    }
+
+    auto size = inode.fs_stat.st_size;
+    if (!(mode & (FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) && size < offset + length)
+    {
+        inode.truncate(offset + length);
+    }
+
+    // preallocated range is allocated and charged now, so writes into it do not run out of space,
+    // except past end of file where extents are not kept
+    if (!(mode & (FALLOC_FL_PUNCH_HOLE | FALLOC_FL_ZERO_RANGE)))
+    {
+        try
+        {
+            inode.allocate(offset, length);
+        }
+        catch (stmpfs_error_t &)
+        {
+            // out of space, size is left as it was
+            if (inode.fs_stat.st_size != size)
+            {
+                inode.truncate(size);
+            }
+
+            throw;
+        }
+    }
+
+    inode.fs_stat.st_ctim = current_time();
+    inode.changed();
+
+    if (path != nullptr)
+    {
+        inode.journal_lsn = journal.append(JOURNAL_FALLOCATE, std::string_view(path),
+                                           (uint64_t)mode, (uint64_t)offset, (uint64_t)length);
+    }
+
+    return 0;
+}
+
 int do_fallocate(const char * path, int mode, off_t offset, off_t length, struct fuse_file_info *)
 {
     try
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
+        return inode_fallocate(path, pathname_to_inode(path, filesystem_root), mode, offset, length);
+    }
+    catch (stmpfs_error_t & error)
+    {
+        OBTAIN_STACK_FRAME;
+        std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
+        return -error_number(error);
+    }
+    catch (std::exception & error)
+    {
+        OBTAIN_STACK_FRAME;
+        std::cerr << error.what() << " (errno=" << strerror(errno) << ")" << std::endl;
+        return -errno;
+    }
+}
 
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
+int do_fsync (const char * path, int, struct fuse_file_info *)
+{
+    try
+    {
+        FUNCTION_INFO;
 
-        // fill up info
-        auto cur_time = current_time();
-        inode.fs_stat.st_mode = mode | S_IFREG;
-        inode.fs_stat.st_nlink = 1;
-        inode.fs_stat.st_ctim = cur_time;
-        inode.fs_stat.st_size = offset + length;
-        inode.truncate(offset + length);
+        // lock is only taken to look up the record to wait for, others go on meanwhile
+        uint64_t lsn;
+        {
+            std::lock_guard < std::mutex > guard(filesystem_lock);
+            auto & inode = pathname_to_inode(path, filesystem_root);
+            backing.flush(path, inode, true);
+            lsn = inode.journal_lsn;
+        }
 
+        journal.wait(lsn);
         return 0;
     }
     catch (stmpfs_error_t & error)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -772,25 +1192,26 @@ int do_fallocate(const char * path, int mode, off_t offset, off_t length, struct
     }
 }
 
-int do_fsync (const char * path, int, struct fuse_file_info *)
+int do_releasedir (const char * path, struct fuse_file_info *)
 {
     FUNCTION_INFO;
     return 0;
 }
 
-int do_releasedir (const char * path, struct fuse_file_info *)
+int do_fsyncdir (const char * path, int datasync, struct fuse_file_info * fi)
 {
-    FUNCTION_INFO;
-    return 0;
+    // directory records are waited for like file records
+    return do_fsync(path, datasync, fi);
 }
 
-int do_fsyncdir (const char * path, int, struct fuse_file_info *)
+/// if xattr name is reserved for statistics reports
+bool is_statistics_xattr(const char * name)
 {
-    FUNCTION_INFO;
-    return 0;
+    return strncmp(name, STATISTICS_XATTR_PREFIX, strlen(STATISTICS_XATTR_PREFIX)) == 0;
 }
 
-void inode_setxattr(inode_t & inode, const std::string& name, const char * value, size_t size)
+/// set an xattr value, journaled if path is given
+static void set_xattr(const char * path, inode_t & inode, const std::string& name, const char * value, size_t size)
 {
     std::string buff;
     for (uint64_t i = 0; i < size; i++)
@@ -799,53 +1220,63 @@ void inode_setxattr(inode_t & inode, const std::string& name, const char * value
     }
 
     inode.xattr[name] = buff;
+    inode.changed();
+
+    if (path != nullptr)
+    {
+        inode.journal_lsn = journal.append(JOURNAL_SETXATTR, std::string_view(path), std::string_view(name),
+                                           std::string_view(buff));
+    }
 }
 
-int do_setxattr (const char * path, const char * name, const char * value, size_t size, int flag)
+int inode_setxattr(const char * path, inode_t & inode, const char * name, const char * value, size_t size, int flag)
 {
-    try
+    if (&inode == &filesystem_root && is_statistics_xattr(name))
     {
-        FUNCTION_INFO;
-
-        stmpfs_pathname_t vpath(path);
+        return -EPERM;  // Operation not permitted (POSIX.1-2001).
+    }
 
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-        if (flag == XATTR_CREATE)
+    if (flag == XATTR_CREATE)
+    {
+        if (inode.xattr.find(name) != inode.xattr.end())
         {
-            if (inode.xattr.find(name) != inode.xattr.end())
-            {
-                return -EEXIST;
-            }
-
-            inode_setxattr(inode, name, value, size);
-            return 0;
+            return -EEXIST;
         }
-        else if (flag == XATTR_REPLACE)
-        {
-            if (inode.xattr.find(name) == inode.xattr.end())
-            {
-                return -ENODATA;
-            }
 
-            inode_setxattr(inode, name, value, size);
-            return 0;
-        }
-        else
+        set_xattr(path, inode, name, value, size);
+        return 0;
+    }
+    else if (flag == XATTR_REPLACE)
+    {
+        if (inode.xattr.find(name) == inode.xattr.end())
         {
-            inode_setxattr(inode, name, value, size);
+            return -ENODATA;
         }
 
+        set_xattr(path, inode, name, value, size);
         return 0;
     }
+    else
+    {
+        set_xattr(path, inode, name, value, size);
+    }
+
+    return 0;
+}
+
+int do_setxattr (const char * path, const char * name, const char * value, size_t size, int flag)
+{
+    try
+    {
+        FUNCTION_INFO;
+
+        return inode_setxattr(path, pathname_to_inode(path, filesystem_root), name, value, size, flag);
+    }
     catch (stmpfs_error_t & error)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -855,47 +1286,63 @@ int do_setxattr (const char * path, const char * name, const char * value, size_
     }
 }
 
-int do_getxattr (const char * path, const char * name, char * value, size_t size)
+int inode_getxattr(inode_t & inode, const char * name, char * value, size_t size)
 {
-    try
-    {
-        FUNCTION_INFO;
+    std::string xattr_value;
 
-        stmpfs_pathname_t vpath(path);
+    if (&inode == &filesystem_root && is_statistics_xattr(name))
+    {
+        auto statistics = filesystem_statistics();
+        auto it = statistics.find(name + strlen(STATISTICS_XATTR_PREFIX));
+        if (it == statistics.end())
+        {
+            return -ENODATA;
+        }
 
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
+        xattr_value = it->second;
+    }
+    else
+    {
         auto it = inode.xattr.find(name);
         if (it == inode.xattr.end())
         {
             return -ENODATA;
         }
 
-        if (size == 0 && value == nullptr)
-        {
-            return (int)it->second.size();
-        }
+        xattr_value = it->second;
+    }
 
-        if (size < it->second.size())
-        {
-            return -ERANGE;
-        }
+    if (size == 0 && value == nullptr)
+    {
+        return (int)xattr_value.size();
+    }
 
-        for (uint64_t i = 0; i < it->second.size(); i++)
-        {
-            value[i] = it->second.at(i);
-        }
+    if (size < xattr_value.size())
+    {
+        return -ERANGE;
+    }
+
+    for (uint64_t i = 0; i < xattr_value.size(); i++)
+    {
+        value[i] = xattr_value.at(i);
+    }
+
+    return (int)xattr_value.size();
+}
 
-        return (int)it->second.size();
+int do_getxattr (const char * path, const char * name, char * value, size_t size)
+{
+    try
+    {
+        FUNCTION_INFO;
+
+        return inode_getxattr(pathname_to_inode(path, filesystem_root), name, value, size);
     }
     catch (stmpfs_error_t & error)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -918,51 +1365,63 @@ uint64_t copy_to_list(char * list, uint64_t copy_len, const std::string& str)
     return actual_len + 1;
 }
 
-int do_listxattr (const char * path, char * list, size_t list_size)
+int inode_listxattr(inode_t & inode, char * list, size_t list_size)
 {
-    try
+    uint64_t list_actual_size = 0, write_off = 0;
+    std::vector < std::string > names;
+    for (auto & i : inode.xattr)
     {
-        FUNCTION_INFO;
-
-        stmpfs_pathname_t vpath(path);
+        names.emplace_back(i.first);
+    }
 
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-        uint64_t list_actual_size = 0, write_off = 0;
-        auto xattr_itr = inode.xattr.begin();
-        for (auto & i : inode.xattr)
+    if (&inode == &filesystem_root)
+    {
+        for (auto & i : filesystem_statistics())
         {
-            list_actual_size += i.first.size() + 1;
+            names.emplace_back(STATISTICS_XATTR_PREFIX + i.first);
         }
+    }
 
-        if (list_size == 0 && list == nullptr)
-        {
-            return (int)list_actual_size;
-        }
+    auto xattr_itr = names.begin();
+    for (auto & i : names)
+    {
+        list_actual_size += i.size() + 1;
+    }
 
-        if (list_size < list_actual_size)
-        {
-            return -ERANGE;
-        }
+    if (list_size == 0 && list == nullptr)
+    {
+        return (int)list_actual_size;
+    }
 
-        while (write_off < list_actual_size)
-        {
-            write_off += copy_to_list(list + write_off,
-                                      list_actual_size - write_off,
-                                      xattr_itr->first);
-            xattr_itr++;
-        }
+    if (list_size < list_actual_size)
+    {
+        return -ERANGE;
+    }
 
-        return (int)list_actual_size;
+    while (write_off < list_actual_size)
+    {
+        write_off += copy_to_list(list + write_off,
+                                  list_actual_size - write_off,
+                                  *xattr_itr);
+        xattr_itr++;
+    }
+
+    return (int)list_actual_size;
+}
+
+int do_listxattr (const char * path, char * list, size_t list_size)
+{
+    try
+    {
+        FUNCTION_INFO;
+
+        return inode_listxattr(pathname_to_inode(path, filesystem_root), list, list_size);
     }
     catch (stmpfs_error_t & error)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -972,33 +1431,38 @@ int do_listxattr (const char * path, char * list, size_t list_size)
     }
 }
 
+int inode_removexattr(const char * path, inode_t & inode, const char * name)
+{
+    auto it = inode.xattr.find(name);
+    if (it == inode.xattr.end())
+    {
+        return -ENODATA;
+    }
+
+    inode.xattr.erase(it);
+    inode.changed();
+
+    if (path != nullptr)
+    {
+        inode.journal_lsn = journal.append(JOURNAL_REMOVEXATTR, std::string_view(path), std::string_view(name));
+    }
+
+    return 0;
+}
+
 int do_removexattr (const char * path, const char * name)
 {
     try
     {
         FUNCTION_INFO;
 
-        stmpfs_pathname_t vpath(path);
-
-        auto & inode = pathname_to_inode(vpath, filesystem_root);
-        auto it = inode.xattr.find(name);
-        if (it == inode.xattr.end())
-        {
-            return -ENODATA;
-        }
-
-        inode.xattr.erase(it);
-        return 0;
+        return inode_removexattr(path, pathname_to_inode(path, filesystem_root), name);
     }
     catch (stmpfs_error_t & error)
     {
         OBTAIN_STACK_FRAME;
         std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
-        if (error.my_errcode() == STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
-        {
-            errno = ENOENT; // No such file or directory (POSIX.1-2001)
-        }
-        return -errno;
+        return -error_number(error);
     }
     catch (std::exception & error)
     {
@@ -1010,19 +1474,35 @@ int do_removexattr (const char * path, const char * name)
 
 int do_statfs (const char * path, struct statvfs * statvfs)
 {
-    struct sysinfo _sysinfo{};
-    sysinfo(&_sysinfo);
+    FUNCTION_INFO;
+
+    // counters are kept by block and inode operations, nothing is walked here
+    uint64_t total_bytes = quota.max_bytes;
+    if (total_bytes == 0)
+    {
+        struct sysinfo _sysinfo{};
+        sysinfo(&_sysinfo);
+        total_bytes = (uint64_t)_sysinfo.totalram * _sysinfo.mem_unit;
+    }
+
+    uint64_t used_bytes = quota.bytes();
+    uint64_t free_blocks = (total_bytes > used_bytes ? total_bytes - used_bytes : 0) / 4096;
+
+    // without inode limit, every free block could take one more inode
+    uint64_t used_inodes = quota.inodes();
+    uint64_t free_inodes = quota.max_inodes == 0 ? free_blocks
+                         : quota.max_inodes > used_inodes ? quota.max_inodes - used_inodes : 0;
 
     struct statvfs _statvfs
             {
             .f_bsize = 4096,
             .f_frsize = 4096,
-            .f_blocks = _sysinfo.totalram / 4096,
-            // I don't really fucking know what is what, for some reason this works
-            .f_bfree = (_sysinfo.totalram - _sysinfo.freeram) / 4096,
-            .f_bavail = (_sysinfo.totalram - _sysinfo.freeram) / 4096,
-            .f_files = filesystem_root.count_inode(),
-            .f_ffree = 4096,
+            .f_blocks = total_bytes / 4096,
+            .f_bfree = free_blocks,
+            .f_bavail = free_blocks,
+            .f_files = used_inodes + free_inodes,
+            .f_ffree = free_inodes,
+            .f_favail = free_inodes,
             .f_fsid = 1,
             .f_namemax = 128,
             };
@@ -1032,3 +1512,151 @@ int do_statfs (const char * path, struct statvfs * statvfs)
     return 0;
 }
 
+void replay_journal(uint64_t after)
+{
+    journal.replay(after, [](journal_op_t op, journal_reader_t & record)
+    {
+        std::string path = record.c_string();
+        int ret = 0;
+
+        // same operations as when records were appended, failures are reported and skipped
+        switch (op)
+        {
+            case JOURNAL_MKDIR:
+                ret = do_mkdir(path.c_str(), (mode_t)record.number());
+                break;
+
+            case JOURNAL_MKNOD:
+            {
+                auto mode = (mode_t)record.number();
+                ret = do_mknod(path.c_str(), mode, (dev_t)record.number());
+                break;
+            }
+
+            case JOURNAL_CREATE:
+                ret = do_create(path.c_str(), (mode_t)record.number(), nullptr);
+                break;
+
+            case JOURNAL_SYMLINK:
+                ret = do_symlink(path.c_str(), record.c_string().c_str());
+                break;
+
+            case JOURNAL_UNLINK:
+                ret = do_unlink(path.c_str());
+                break;
+
+            case JOURNAL_RMDIR:
+                ret = do_rmdir(path.c_str());
+                break;
+
+            case JOURNAL_RENAME:
+                ret = do_rename(path.c_str(), record.c_string().c_str(), 0);
+                break;
+
+            case JOURNAL_CHMOD:
+                ret = do_chmod(path.c_str(), (mode_t)record.number(), nullptr);
+                break;
+
+            case JOURNAL_CHOWN:
+            {
+                auto uid = (uid_t)record.number();
+                ret = do_chown(path.c_str(), uid, (gid_t)record.number(), nullptr);
+                break;
+            }
+
+            case JOURNAL_UTIMENS:
+            {
+                struct timespec tv[2] { };
+                tv[0].tv_sec = (time_t)record.number();
+                tv[0].tv_nsec = (long)record.number();
+                tv[1].tv_sec = (time_t)record.number();
+                tv[1].tv_nsec = (long)record.number();
+                ret = do_utimens(path.c_str(), tv, nullptr);
+                break;
+            }
+
+            case JOURNAL_TRUNCATE:
+                ret = do_truncate(path.c_str(), (off_t)record.number(), nullptr);
+                break;
+
+            case JOURNAL_WRITE:
+            {
+                auto offset = (off_t)record.number();
+                auto data = record.string();
+                ret = do_write(path.c_str(), data.data(), data.size(), offset, nullptr);
+                ret = ret == (int)data.size() ? 0 : (ret < 0 ? ret : -ENOSPC);
+                break;
+            }
+
+            case JOURNAL_FALLOCATE:
+            {
+                auto mode = (int)record.number();
+                auto offset = (off_t)record.number();
+                ret = do_fallocate(path.c_str(), mode, offset, (off_t)record.number(), nullptr);
+                break;
+            }
+
+            case JOURNAL_CLONE:
+            {
+                auto source_path = record.c_string();
+                auto & source = pathname_to_inode(source_path, filesystem_root);
+                auto & inode = pathname_to_inode(path, filesystem_root);
+                auto source_offset = (off_t)record.number();
+                auto offset = (off_t)record.number();
+                auto length = record.number();
+                inode.clone_range(source, source_offset, offset, length);
+                auto cur_time = current_time();
+                inode.fs_stat.st_ctim = cur_time;
+                inode.fs_stat.st_mtim = cur_time;
+                break;
+            }
+
+            case JOURNAL_SETXATTR:
+            {
+                auto name = record.c_string();
+                auto value = record.string();
+                ret = do_setxattr(path.c_str(), name.c_str(), value.data(), value.size(), 0);
+                break;
+            }
+
+            case JOURNAL_REMOVEXATTR:
+                ret = do_removexattr(path.c_str(), record.c_string().c_str());
+                break;
+
+            default:
+                throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_JOURNAL);
+        }
+
+        if (ret < 0)
+        {
+            std::cerr << "Replaying journal record on " << path << " failed (errno=" << strerror(-ret) << ")" << std::endl;
+        }
+    });
+}
+
+void * do_init (struct fuse_conn_info *, struct fuse_config * config)
+{
+    // report inode numbers of inode table, low-level API always does
+    if (config != nullptr)
+    {
+        config->use_ino = 1;
+    }
+
+    // fuse_main has daemonized by now, so background threads survive
+    journal.start();
+    compressor.start();
+    dedup.start();
+    spill.start();
+    image.start(filesystem_root);
+    return nullptr;
+}
+
+void do_destroy (void *)
+{
+    backing.stop(filesystem_root);
+    image.stop();
+    spill.stop();
+    dedup.stop();
+    compressor.stop();
+    journal.stop();
+}
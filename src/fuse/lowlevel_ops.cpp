@@ -0,0 +1,864 @@
+/** @file
+ *
+ * This file implements the FUSE low-level frontend, keyed by inode number
+ */
+
+#define FUSE_USE_VERSION 31
+#include <fuse.h>
+#include <fuse_lowlevel.h>
+#include <lowlevel_ops.h>
+#include <fuse_ops.h>
+#include <inode.h>
+#include <inode_table.h>
+#include <stmpfs.h>
+#include <stmpfs_error.h>
+#include <backing.h>
+#include <journal.h>
+#include <iostream>
+#include <climits>
+#include <cstring>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// where the kernel found an inode number, to rebuild its path
+struct node_t
+{
+    uint64_t    parent;                 // 0 if kernel does not hold the number
+    std::string name;
+};
+
+/// indexed by inode number, like inode_table
+static std::vector < node_t > nodes;
+
+/// read and readdir replies are built here and sent from here, for every request
+static std::vector < char > reply_buffer;
+
+/// run a request under filesystem lock, replying the error if it throws
+/** @param req request
+ *  @param function request body, replies itself if it returns **/
+template < typename function_t >
+static void serve(fuse_req_t req, function_t function)
+{
+    std::lock_guard < std::mutex > guard(filesystem_lock);
+
+    try
+    {
+        function();
+    }
+    catch (stmpfs_error_t & error)
+    {
+        if (error.my_errcode() != STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY)
+        {
+            std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
+        }
+
+        fuse_reply_err(req, error_number(error));
+    }
+    catch (std::exception & error)
+    {
+        std::cerr << error.what() << " (errno=" << strerror(errno) << ")" << std::endl;
+        fuse_reply_err(req, errno != 0 ? errno : EIO);
+    }
+}
+
+/// find inode by number, throw error if it is gone
+static inode_t & inode_of(fuse_ino_t number)
+{
+    auto * inode = inode_table.find(number);
+    if (inode == nullptr)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY);
+    }
+
+    return *inode;
+}
+
+/// path of an inode number, throw error if it no longer leads to the inode
+static std::string path_of(fuse_ino_t number)
+{
+    auto & inode = inode_of(number);
+
+    std::vector < const std::string * > names;
+    for (auto cur = number; cur != INODE_TABLE_ROOT; cur = nodes[cur].parent)
+    {
+        if (cur >= nodes.size() || nodes[cur].parent == 0)
+        {
+            throw stmpfs_error_t(STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY);
+        }
+
+        names.push_back(&nodes[cur].name);
+    }
+
+    std::string path;
+    for (auto it = names.rbegin(); it != names.rend(); ++it)
+    {
+        path += '/';
+        path += **it;
+    }
+
+    if (path.empty())
+    {
+        path = "/";
+    }
+
+    // a removed or replaced inode may still be held by the kernel under its old name
+    if (lookup_inode(path, filesystem_root) != &inode)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY);
+    }
+
+    return path;
+}
+
+/// path of a name in a directory given by number
+static std::string path_of(fuse_ino_t parent, const char * name)
+{
+    std::string path = path_of(parent);
+    if (path.size() > 1)
+    {
+        path += '/';
+    }
+
+    return path + name;
+}
+
+/// path of an inode number for a change to it, which only backing directory and journal take
+/// an orphan has none, it is neither replayed from journal nor in backing directory, where
+/// content not fetched yet is gone with it, so it cannot be changed with backing enabled
+/** @param path set to path if needed
+ *  @return path, nullptr if not needed or an orphan **/
+static const char * path_to_change(fuse_ino_t number, std::string & path)
+{
+    if (!backing.enabled() && (!journal.enabled() || inode_table.orphan(number)))
+    {
+        return nullptr;
+    }
+
+    path = path_of(number);
+    return path.c_str();
+}
+
+/// path of a name in a directory given by number for a change to it, see above
+/** @param path set to path if needed
+ *  @return path, nullptr if not needed **/
+static const char * path_to_change(fuse_ino_t parent, const char * name, std::string & path)
+{
+    if (!backing.enabled() && !journal.enabled())
+    {
+        return nullptr;
+    }
+
+    path = path_of(parent, name);
+    return path.c_str();
+}
+
+/// directory given by number to change entries of, throw error if it is removed
+static inode_t & directory_of(fuse_ino_t number)
+{
+    // entries created in a removed directory would never be freed
+    if (inode_table.orphan(number))
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY);
+    }
+
+    return inode_of(number);
+}
+
+/// find a name in a directory given by number
+/** @return inode, nullptr if not found **/
+static inode_t * lookup_child(fuse_ino_t parent, const char * name)
+{
+    // entries missing in memory may still be in backing directory, which is walked by path
+    if (backing.enabled())
+    {
+        return lookup_inode(path_of(parent, name), filesystem_root);
+    }
+
+    return inode_of(parent).lookup_dentry(name);
+}
+
+/// kernel forgot lookups of a number
+static void forget_number(uint64_t number, uint64_t count)
+{
+    if (inode_table.release(number, count) == 0 && number < nodes.size())
+    {
+        nodes[number] = node_t { };
+    }
+}
+
+/// entry of an inode as replied to the kernel
+static struct fuse_entry_param entry_of(const inode_t & inode)
+{
+    struct fuse_entry_param entry { };
+    entry.ino = inode.fs_stat.st_ino;
+    entry.generation = inode_table.generation(entry.ino);
+    entry.attr = inode.fs_stat;
+    entry.attr_timeout = LOWLEVEL_TIMEOUT;
+    entry.entry_timeout = LOWLEVEL_TIMEOUT;
+    return entry;
+}
+
+/// kernel got a number under a name, it holds the number until it forgets it
+static void hold_number(uint64_t number, fuse_ino_t parent, const char * name)
+{
+    if (number >= nodes.size())
+    {
+        nodes.resize(number + 1);
+    }
+
+    nodes[number].parent = parent;
+    nodes[number].name = name;
+    inode_table.hold(number);
+}
+
+/// reply an entry found or created, kernel holds its number until it forgets it
+/** @param inode inode, nullptr to reply the name as missing
+ *  @param fi file info to reply a create, nullptr to reply a lookup **/
+static void reply_entry(fuse_req_t req, fuse_ino_t parent, const char * name, inode_t * inode,
+                        struct fuse_file_info * fi = nullptr)
+{
+    // number 0 lets the kernel keep the name as missing, without asking again
+    if (inode == nullptr)
+    {
+        struct fuse_entry_param entry { };
+        entry.entry_timeout = LOWLEVEL_TIMEOUT;
+        fuse_reply_entry(req, &entry);
+        return;
+    }
+
+    auto entry = entry_of(*inode);
+    uint64_t number = entry.ino;
+    hold_number(number, parent, name);
+
+    // an interrupted request never reaches the kernel, which will not forget it either
+    if ((fi == nullptr ? fuse_reply_entry(req, &entry) : fuse_reply_create(req, &entry, fi)) != 0)
+    {
+        forget_number(number, 1);
+    }
+}
+
+/// reply a path operation, which returns 0 or -errno
+static void reply_status(fuse_req_t req, int status)
+{
+    fuse_reply_err(req, -status);
+}
+
+static void ll_init(void *, struct fuse_conn_info * conn)
+{
+    do_init(conn, nullptr);
+}
+
+static void ll_destroy(void *)
+{
+    do_destroy(nullptr);
+}
+
+static void ll_lookup(fuse_req_t req, fuse_ino_t parent, const char * name)
+{
+    serve(req, [&]
+    {
+        reply_entry(req, parent, name, lookup_child(parent, name));
+    });
+}
+
+static void ll_forget(fuse_req_t req, fuse_ino_t ino, uint64_t nlookup)
+{
+    {
+        std::lock_guard < std::mutex > guard(filesystem_lock);
+        forget_number(ino, nlookup);
+    }
+
+    fuse_reply_none(req);
+}
+
+static void ll_forget_multi(fuse_req_t req, size_t count, struct fuse_forget_data * forgets)
+{
+    {
+        std::lock_guard < std::mutex > guard(filesystem_lock);
+        for (size_t i = 0; i < count; i++)
+        {
+            forget_number(forgets[i].ino, forgets[i].nlookup);
+        }
+    }
+
+    fuse_reply_none(req);
+}
+
+static void ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *)
+{
+    serve(req, [&]
+    {
+        fuse_reply_attr(req, &inode_of(ino).fs_stat, LOWLEVEL_TIMEOUT);
+    });
+}
+
+static void ll_setattr(fuse_req_t req, fuse_ino_t ino, struct stat * attr, int to_set, struct fuse_file_info *)
+{
+    serve(req, [&]
+    {
+        auto & inode = inode_of(ino);
+        std::string buffer;
+        auto * path = path_to_change(ino, buffer);
+
+        if (to_set & FUSE_SET_ATTR_MODE)
+        {
+            inode_chmod(path, inode, attr->st_mode);
+        }
+
+        // owner not given is kept
+        if (to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID))
+        {
+            inode_chown(path, inode,
+                        (to_set & FUSE_SET_ATTR_UID) ? attr->st_uid : inode.fs_stat.st_uid,
+                        (to_set & FUSE_SET_ATTR_GID) ? attr->st_gid : inode.fs_stat.st_gid);
+        }
+
+        if (to_set & FUSE_SET_ATTR_SIZE)
+        {
+            inode_truncate(path, inode, attr->st_size);
+        }
+
+        // time not given is kept
+        if (to_set & (FUSE_SET_ATTR_ATIME | FUSE_SET_ATTR_MTIME | FUSE_SET_ATTR_ATIME_NOW | FUSE_SET_ATTR_MTIME_NOW))
+        {
+            auto cur_time = current_time();
+            struct timespec tv[2] = { inode.fs_stat.st_atim, inode.fs_stat.st_mtim };
+
+            if (to_set & FUSE_SET_ATTR_ATIME_NOW)
+            {
+                tv[0] = cur_time;
+            }
+            else if (to_set & FUSE_SET_ATTR_ATIME)
+            {
+                tv[0] = attr->st_atim;
+            }
+
+            if (to_set & FUSE_SET_ATTR_MTIME_NOW)
+            {
+                tv[1] = cur_time;
+            }
+            else if (to_set & FUSE_SET_ATTR_MTIME)
+            {
+                tv[1] = attr->st_mtim;
+            }
+
+            inode_utimens(path, inode, tv);
+        }
+
+        fuse_reply_attr(req, &inode.fs_stat, LOWLEVEL_TIMEOUT);
+    });
+}
+
+static void ll_readlink(fuse_req_t req, fuse_ino_t ino)
+{
+    serve(req, [&]
+    {
+        char link[PATH_MAX];
+        inode_readlink(inode_of(ino), link, sizeof(link));
+        fuse_reply_readlink(req, link);
+    });
+}
+
+static void ll_mknod(fuse_req_t req, fuse_ino_t parent, const char * name, mode_t mode, dev_t rdev)
+{
+    serve(req, [&]
+    {
+        auto & directory = directory_of(parent);
+        std::string buffer;
+        auto & inode = inode_mknod(path_to_change(parent, name, buffer), directory, name, mode, rdev);
+        reply_entry(req, parent, name, &inode);
+    });
+}
+
+static void ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char * name, mode_t mode)
+{
+    serve(req, [&]
+    {
+        auto & directory = directory_of(parent);
+        std::string buffer;
+        auto & inode = inode_mkdir(path_to_change(parent, name, buffer), directory, name, mode);
+        reply_entry(req, parent, name, &inode);
+    });
+}
+
+static void ll_unlink(fuse_req_t req, fuse_ino_t parent, const char * name)
+{
+    serve(req, [&]
+    {
+        auto & directory = directory_of(parent);
+        std::string buffer;
+        inode_unlink(path_to_change(parent, name, buffer), directory, name);
+        reply_status(req, 0);
+    });
+}
+
+static void ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char * name)
+{
+    serve(req, [&]
+    {
+        auto & directory = directory_of(parent);
+        std::string buffer;
+        reply_status(req, inode_rmdir(path_to_change(parent, name, buffer), directory, name));
+    });
+}
+
+static void ll_symlink(fuse_req_t req, const char * link, fuse_ino_t parent, const char * name)
+{
+    serve(req, [&]
+    {
+        auto & directory = directory_of(parent);
+        std::string buffer;
+        auto & inode = inode_symlink(path_to_change(parent, name, buffer), directory, name, link);
+        reply_entry(req, parent, name, &inode);
+    });
+}
+
+static void ll_rename(fuse_req_t req, fuse_ino_t parent, const char * name, fuse_ino_t newparent, const char * newname,
+                      unsigned int flags)
+{
+    serve(req, [&]
+    {
+        std::string buffer, new_buffer;
+        auto & directory = directory_of(parent);
+        auto & new_directory = directory_of(newparent);
+        int status = inode_rename(path_to_change(parent, name, buffer), directory, name,
+                                  path_to_change(newparent, newname, new_buffer), new_directory, newname, flags);
+
+        // inode keeps its number, a held one is found under the new name from now on
+        auto * inode = status == 0 ? new_directory.lookup_dentry(newname) : nullptr;
+        uint64_t number = inode == nullptr ? 0 : inode->fs_stat.st_ino;
+        if (number != 0 && number < nodes.size() && nodes[number].parent != 0)
+        {
+            nodes[number].parent = newparent;
+            nodes[number].name = newname;
+        }
+
+        reply_status(req, status);
+    });
+}
+
+static void ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info * fi)
+{
+    serve(req, [&]
+    {
+        auto & inode = inode_of(ino);
+        inode.fs_stat.st_atim = current_time();
+        inode.changed();
+        fuse_reply_open(req, fi);
+    });
+}
+
+static void ll_read(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *)
+{
+    serve(req, [&]
+    {
+        auto & inode = inode_of(ino);
+        inode.fs_stat.st_atim = current_time();
+        inode.changed();
+        if (backing.enabled())
+        {
+            backing.read(path_of(ino).c_str(), inode, off, size);
+        }
+
+        if (reply_buffer.size() < size)
+        {
+            reply_buffer.resize(size);
+        }
+
+        auto length = inode.read(reply_buffer.data(), size, off);
+        fuse_reply_buf(req, reply_buffer.data(), length);
+    });
+}
+
+static void ll_write(fuse_req_t req, fuse_ino_t ino, const char * buf, size_t size, off_t off,
+                     struct fuse_file_info *)
+{
+    serve(req, [&]
+    {
+        auto & inode = inode_of(ino);
+        std::string buffer;
+        fuse_reply_write(req, inode_write(path_to_change(ino, buffer), inode, buf, size, off));
+    });
+}
+
+static void ll_flush(fuse_req_t req, fuse_ino_t, struct fuse_file_info *)
+{
+    fuse_reply_err(req, 0);
+}
+
+static void ll_release(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *)
+{
+    serve(req, [&]
+    {
+        // nothing is left to flush or share of a removed file
+        auto * inode = inode_table.find(ino);
+        if (inode == nullptr || inode_table.orphan(ino))
+        {
+            fuse_reply_err(req, 0);
+            return;
+        }
+
+        // only write-back of backing directory needs a path
+        std::string path;
+        if (backing.enabled())
+        {
+            path = path_of(ino);
+        }
+
+        inode_release(path.empty() ? nullptr : path.c_str(), *inode);
+        fuse_reply_err(req, 0);
+    });
+}
+
+static void ll_fsync(fuse_req_t req, fuse_ino_t ino, int, struct fuse_file_info *)
+{
+    // lock is only taken to look up the record to wait for, see do_fsync
+    uint64_t lsn = 0;
+    bool found = false;
+    serve(req, [&]
+    {
+        auto & inode = inode_of(ino);
+        if (backing.enabled() && !inode_table.orphan(ino))
+        {
+            backing.flush(path_of(ino).c_str(), inode, true);
+        }
+
+        lsn = inode.journal_lsn;
+        found = true;
+    });
+
+    if (!found)
+    {
+        return;
+    }
+
+    try
+    {
+        journal.wait(lsn);
+        fuse_reply_err(req, 0);
+    }
+    catch (stmpfs_error_t & error)
+    {
+        std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
+        fuse_reply_err(req, error_number(error));
+    }
+}
+
+/// reply a page of directory entries, with their attributes and entries for readdirplus
+/** @param plus if entries are replied as looked up, which the kernel holds until it forgets them **/
+static void reply_directory(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, bool plus)
+{
+    auto & inode = inode_of(ino);
+    inode.fs_stat.st_atim = current_time();
+    inode.changed();
+    if (backing.enabled())
+    {
+        backing.list(path_of(ino).c_str(), inode);
+    }
+
+    if (reply_buffer.size() < size)
+    {
+        reply_buffer.resize(size);
+    }
+
+    // numbers given out in this reply, taken back if it does not reach the kernel
+    std::vector < uint64_t > held;
+
+    // every entry carries its cookie as offset, see do_readdir
+    size_t used = 0;
+    auto add = [&](const char * name, const struct stat & stat, off_t cookie, const inode_t * child)
+    {
+        size_t length;
+        struct fuse_entry_param entry { };
+        if (plus)
+        {
+            // kernel does not look up "." and "..", so only their attributes go along
+            entry.attr = stat;
+            if (child != nullptr)
+            {
+                entry = entry_of(*child);
+            }
+
+            length = fuse_add_direntry_plus(req, reply_buffer.data() + used, size - used, name, &entry, cookie);
+        }
+        else
+        {
+            length = fuse_add_direntry(req, reply_buffer.data() + used, size - used, name, &stat, cookie);
+        }
+
+        if (length > size - used)
+        {
+            return false;
+        }
+
+        if (plus && child != nullptr)
+        {
+            hold_number(entry.ino, ino, name);
+            held.push_back(entry.ino);
+        }
+
+        used += length;
+        return true;
+    };
+
+    struct stat parent_stat { };
+    parent_stat.st_ino = ino < nodes.size() && nodes[ino].parent != 0 ? nodes[ino].parent : INODE_TABLE_ROOT;
+    parent_stat.st_mode = S_IFDIR;
+
+    bool full = (off < 1 && !add(".", inode.fs_stat, 1, nullptr)) || (off < 2 && !add("..", parent_stat, 2, nullptr));
+
+    const auto & entries = inode.my_dentry();
+    for (auto it = entries.after(off); !full && it != entries.end(); ++it)
+    {
+        auto * child = it->dentry.inode;
+        full = !add(it->name.c_str(), child->fs_stat, (off_t)it->cookie, child);
+    }
+
+    // an interrupted request never reaches the kernel, which will not forget it either
+    if (fuse_reply_buf(req, reply_buffer.data(), used) != 0)
+    {
+        for (auto number : held)
+        {
+            forget_number(number, 1);
+        }
+    }
+}
+
+static void ll_readdir(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *)
+{
+    serve(req, [&]
+    {
+        reply_directory(req, ino, size, off, false);
+    });
+}
+
+static void ll_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off, struct fuse_file_info *)
+{
+    serve(req, [&]
+    {
+        reply_directory(req, ino, size, off, true);
+    });
+}
+
+static void ll_releasedir(fuse_req_t req, fuse_ino_t, struct fuse_file_info *)
+{
+    fuse_reply_err(req, 0);
+}
+
+static void ll_fsyncdir(fuse_req_t req, fuse_ino_t ino, int datasync, struct fuse_file_info * fi)
+{
+    ll_fsync(req, ino, datasync, fi);
+}
+
+static void ll_statfs(fuse_req_t req, fuse_ino_t)
+{
+    serve(req, [&]
+    {
+        struct statvfs statvfs { };
+        int status = do_statfs("/", &statvfs);
+        if (status != 0)
+        {
+            reply_status(req, status);
+            return;
+        }
+
+        fuse_reply_statfs(req, &statvfs);
+    });
+}
+
+static void ll_setxattr(fuse_req_t req, fuse_ino_t ino, const char * name, const char * value, size_t size, int flags)
+{
+    serve(req, [&]
+    {
+        auto & inode = inode_of(ino);
+        std::string buffer;
+        reply_status(req, inode_setxattr(path_to_change(ino, buffer), inode, name, value, size, flags));
+    });
+}
+
+/// reply size of an xattr value or list if size is 0, the value or list otherwise
+static void reply_xattr(fuse_req_t req, size_t size, int length)
+{
+    if (length < 0)
+    {
+        reply_status(req, length);
+    }
+    else if (size == 0)
+    {
+        fuse_reply_xattr(req, length);
+    }
+    else
+    {
+        fuse_reply_buf(req, reply_buffer.data(), length);
+    }
+}
+
+static void ll_getxattr(fuse_req_t req, fuse_ino_t ino, const char * name, size_t size)
+{
+    serve(req, [&]
+    {
+        if (reply_buffer.size() < size)
+        {
+            reply_buffer.resize(size);
+        }
+
+        reply_xattr(req, size, inode_getxattr(inode_of(ino), name, size == 0 ? nullptr : reply_buffer.data(), size));
+    });
+}
+
+static void ll_listxattr(fuse_req_t req, fuse_ino_t ino, size_t size)
+{
+    serve(req, [&]
+    {
+        if (reply_buffer.size() < size)
+        {
+            reply_buffer.resize(size);
+        }
+
+        reply_xattr(req, size, inode_listxattr(inode_of(ino), size == 0 ? nullptr : reply_buffer.data(), size));
+    });
+}
+
+static void ll_removexattr(fuse_req_t req, fuse_ino_t ino, const char * name)
+{
+    serve(req, [&]
+    {
+        auto & inode = inode_of(ino);
+        std::string buffer;
+        reply_status(req, inode_removexattr(path_to_change(ino, buffer), inode, name));
+    });
+}
+
+static void ll_create(fuse_req_t req, fuse_ino_t parent, const char * name, mode_t mode, struct fuse_file_info * fi)
+{
+    serve(req, [&]
+    {
+        auto & directory = directory_of(parent);
+        std::string buffer;
+        auto & inode = inode_create(path_to_change(parent, name, buffer), directory, name, mode);
+        reply_entry(req, parent, name, &inode, fi);
+    });
+}
+
+static void ll_fallocate(fuse_req_t req, fuse_ino_t ino, int mode, off_t offset, off_t length,
+                         struct fuse_file_info *)
+{
+    serve(req, [&]
+    {
+        auto & inode = inode_of(ino);
+        std::string buffer;
+        reply_status(req, inode_fallocate(path_to_change(ino, buffer), inode, mode, offset, length));
+    });
+}
+
+static void ll_copy_file_range(fuse_req_t req, fuse_ino_t ino_in, off_t off_in, struct fuse_file_info *,
+                               fuse_ino_t ino_out, off_t off_out, struct fuse_file_info *,
+                               size_t len, int flags)
+{
+    serve(req, [&]
+    {
+        auto & source = inode_of(ino_in);
+        auto & inode = inode_of(ino_out);
+        std::string source_buffer, buffer;
+        auto copied = inode_copy_file_range(path_to_change(ino_in, source_buffer), source, off_in,
+                                            path_to_change(ino_out, buffer), inode, off_out, len, flags);
+        if (copied < 0)
+        {
+            reply_status(req, (int)copied);
+            return;
+        }
+
+        fuse_reply_write(req, copied);
+    });
+}
+
+static void ll_lseek(fuse_req_t req, fuse_ino_t ino, off_t off, int whence, struct fuse_file_info *)
+{
+    serve(req, [&]
+    {
+        auto position = inode_lseek(inode_of(ino), off, whence);
+        if (position < 0)
+        {
+            reply_status(req, (int)position);
+            return;
+        }
+
+        fuse_reply_lseek(req, position);
+    });
+}
+
+static struct fuse_lowlevel_ops lowlevel_ops =
+        {
+                .init           = ll_init,
+                .destroy        = ll_destroy,
+                .lookup         = ll_lookup,
+                .forget         = ll_forget,
+                .getattr        = ll_getattr,
+                .setattr        = ll_setattr,
+                .readlink       = ll_readlink,
+                .mknod          = ll_mknod,
+                .mkdir          = ll_mkdir,
+                .unlink         = ll_unlink,
+                .rmdir          = ll_rmdir,
+                .symlink        = ll_symlink,
+                .rename         = ll_rename,
+                .open           = ll_open,
+                .read           = ll_read,
+                .write          = ll_write,
+                .flush          = ll_flush,
+                .release        = ll_release,
+                .fsync          = ll_fsync,
+                .opendir        = ll_open,
+                .readdir        = ll_readdir,
+                .releasedir     = ll_releasedir,
+                .fsyncdir       = ll_fsyncdir,
+                .statfs         = ll_statfs,
+                .setxattr       = ll_setxattr,
+                .getxattr       = ll_getxattr,
+                .listxattr      = ll_listxattr,
+                .removexattr    = ll_removexattr,
+                .create         = ll_create,
+                .forget_multi   = ll_forget_multi,
+                .fallocate      = ll_fallocate,
+                .readdirplus    = ll_readdirplus,
+                .copy_file_range = ll_copy_file_range,
+                .lseek          = ll_lseek,
+        };
+
+int lowlevel_main(struct fuse_args * args)
+{
+    struct fuse_cmdline_opts options { };
+    if (fuse_parse_cmdline(args, &options) != 0 || options.mountpoint == nullptr)
+    {
+        free(options.mountpoint);
+        throw stmpfs_error_t(STMPFS_ERROR_CANNOT_PARSE_ARGUMENT);
+    }
+
+    int ret = 1;
+    struct fuse_session * session = fuse_session_new(args, &lowlevel_ops, sizeof(lowlevel_ops), nullptr);
+    if (session != nullptr)
+    {
+        if (fuse_set_signal_handlers(session) == 0)
+        {
+            if (fuse_session_mount(session, options.mountpoint) == 0)
+            {
+                if (fuse_daemonize(options.foreground) == 0)
+                {
+                    // every request takes filesystem lock, see serve
+                    ret = options.singlethread ? fuse_session_loop(session)
+                                               : fuse_session_loop_mt(session, options.clone_fd);
+                }
+
+                fuse_session_unmount(session);
+            }
+
+            fuse_remove_signal_handlers(session);
+        }
+
+        fuse_session_destroy(session);
+    }
+
+    free(options.mountpoint);
+    return ret;
+}
@@ -6,42 +6,72 @@
 #define FUSE_USE_VERSION 31
 #include <fuse.h>
 #include <iostream>
+#include <cerrno>
+#include <cstdint>
 #include <fuse_ops.h>
 #include <stmpfs_error.h>
 #include <stmpfs.h>
+#include <extent.h>
+#include <tail_pack.h>
+#include <block_pool.h>
+#include <compressor.h>
+#include <dedup.h>
+#include <quota.h>
+#include <spill.h>
+#include <image.h>
+#include <journal.h>
+#include <backing.h>
+#include <inode_table.h>
+#include <lowlevel_ops.h>
+
+/// wrap a fuse operation so it runs under filesystem lock
+template < auto op > struct locked;
+
+template < typename Ret, typename ... Args, Ret (* op)(Args ...) >
+struct locked < op >
+{
+    static Ret call(Args ... args)
+    {
+        std::lock_guard < std::mutex > guard(filesystem_lock);
+        return op(args ...);
+    }
+};
 
 static struct fuse_operations fuse_ops =
         {
-                .getattr    = do_getattr,
-                .readlink   = do_readlink,
-                .mknod      = do_mknod,
-                .mkdir      = do_mkdir,
-                .unlink     = do_unlink,
-                .rmdir      = do_rmdir,
-                .symlink    = do_symlink,
-                .rename     = do_rename,
-                .chmod      = do_chmod,
-                .chown      = do_chown,
-                .truncate   = do_truncate,
-                .open       = do_open,
-                .read       = do_read,
-                .write      = do_write,
-                .statfs     = do_statfs,
-                .flush      = do_flush,
-                .release    = do_release,
-                .fsync      = do_fsync,
-                .setxattr   = do_setxattr,
-                .getxattr   = do_getxattr,
-                .listxattr  = do_listxattr,
-                .removexattr = do_removexattr,
-                .opendir    = do_open,
-                .readdir    = do_readdir,
-                .releasedir = do_releasedir,
+                .getattr    = locked < do_getattr >::call,
+                .readlink   = locked < do_readlink >::call,
+                .mknod      = locked < do_mknod >::call,
+                .mkdir      = locked < do_mkdir >::call,
+                .unlink     = locked < do_unlink >::call,
+                .rmdir      = locked < do_rmdir >::call,
+                .symlink    = locked < do_symlink >::call,
+                .rename     = locked < do_rename >::call,
+                .chmod      = locked < do_chmod >::call,
+                .chown      = locked < do_chown >::call,
+                .truncate   = locked < do_truncate >::call,
+                .open       = locked < do_open >::call,
+                .read       = locked < do_read >::call,
+                .write      = locked < do_write >::call,
+                .statfs     = locked < do_statfs >::call,
+                .flush      = locked < do_flush >::call,
+                .release    = locked < do_release >::call,
+                .fsync      = do_fsync,     // takes lock itself, not while waiting for journal
+                .setxattr   = locked < do_setxattr >::call,
+                .getxattr   = locked < do_getxattr >::call,
+                .listxattr  = locked < do_listxattr >::call,
+                .removexattr = locked < do_removexattr >::call,
+                .opendir    = locked < do_open >::call,
+                .readdir    = locked < do_readdir >::call,
+                .releasedir = locked < do_releasedir >::call,
                 .fsyncdir   = do_fsyncdir,
-                .create     = do_create,
-                .utimens    = do_utimens,
-//                .ioctl      = do_ioctl,
-                .fallocate  = do_fallocate,
+                .init       = do_init,
+                .destroy    = do_destroy,
+                .create     = locked < do_create >::call,
+                .utimens    = locked < do_utimens >::call,
+                .fallocate  = locked < do_fallocate >::call,
+                .copy_file_range = locked < do_copy_file_range >::call,
+                .lseek      = locked < do_lseek >::call,
         };
 
 static void usage(const char *progname)
@@ -53,15 +83,80 @@ static void usage(const char *progname)
             "    -o opt,[opt...]        Mount options.\n"
             "    -h, --help             Print help.\n"
             "    -V, --version          Print version.\n"
+            "\n"
+            "stmpfs options:\n"
+            "    -o restore=FILE        Load a snapshot before serving requests.\n"
+            "    -o base=FILE           Map a snapshot read-only instead of loading it, its data is\n"
+            "                           shared through the page cache by every mount of it and\n"
+            "                           copied into memory only where written. The snapshot must\n"
+            "                           not change while mounted.\n"
+            "    -o image=PATH          Write snapshots in the background on SIGUSR1, to PATH.GENERATION,\n"
+            "                           linked from PATH. Snapshots after a full one only write\n"
+            "                           changed data and inodes, every %d-th snapshot is full again.\n"
+            "    -o image_interval=SECS Also write a snapshot every SECS seconds (default: 0, off).\n"
+            "    -o journal=FILE        Log every change to FILE and replay it at mount, on top of\n"
+            "                           restore= or base= if given. Snapshots drop records they include.\n"
+            "    -o durability=MODE     When journal records reach the disk: none (never synced, survives\n"
+            "                           a daemon crash only), async (synced every commit_interval) or\n"
+            "                           sync (fsync waits for records of its file, default). Requests\n"
+            "                           are then served by several threads, so concurrent fsyncs share\n"
+            "                           one commit.\n"
+            "    -o commit_interval=MS  Time between journal syncs with durability=async (default: 1000).\n"
+            "    -o size=SIZE           Limit of data size, ENOSPC past it (default: unlimited).\n"
+            "    -o nr_inodes=COUNT     Limit of inode count, including root (default: unlimited).\n"
+            "    -o min_extent=SIZE     Size of the first extent of a file (default: 4k).\n"
+            "    -o max_extent=SIZE     Size limit of file extents (default: 2m).\n"
+            "                           Use the same size for both to get fixed size blocks.\n"
+            "    -o hugepages=MODE      Back file data with mmap arenas of huge pages, MODE is\n"
+            "                           madvise (transparent huge pages) or explicit (MAP_HUGETLB\n"
+            "                           2 MiB pages, falling back to madvise once they run out).\n"
+            "    -o tail_packing        Pack partial last extents of closed files into shared slabs.\n"
+            "    -o compress_age=SECS   Compress data left untouched for SECS seconds (default: 0, off).\n"
+            "    -o spill=DIR           Write cold data out to an unnamed file in DIR under memory pressure.\n"
+            "    -o spill_watermark=SIZE  Data size in memory that starts spilling (default: 3/4 of RAM).\n"
+            "    -o spill_psi           Also start spilling on PSI memory pressure notifications.\n"
+            "    -o dedup               Share full extents of identical content when files are closed.\n"
+            "    -o dedup_scan=SECS     Also scan existing data for duplicates every SECS seconds.\n"
+            "    -o backing=DIR         Serve as a cache of DIR: entries are loaded on lookup, data on\n"
+            "                           read, and every change is applied to DIR as well. Cannot be\n"
+            "                           used with restore=, base=, image= or journal=.\n"
+            "    -o backing_cache=SIZE  Data size in memory that starts dropping cached data of the\n"
+            "                           least recently read files (default: 1/2 of RAM).\n"
+            "    -o write_back          Write file data to DIR on fsync and close, not on every write.\n"
+            "    -o lowlevel            Serve requests by inode number through the FUSE low-level API,\n"
+            "                           instead of by path.\n"
 #ifdef CMAKE_BUILD_DEBUG
             "    -k, --hash_check       Enable hash check on every R/W.\n"
 #endif // CMAKE_BUILD_DEBUG
-            "\n", progname);
+            "\n", progname, IMAGE_CHAIN_LENGTH);
 }
 
 enum {
     KEY_VERSION,
     KEY_HELP,
+    KEY_RESTORE,
+    KEY_BASE,
+    KEY_IMAGE,
+    KEY_IMAGE_INTERVAL,
+    KEY_JOURNAL,
+    KEY_DURABILITY,
+    KEY_COMMIT_INTERVAL,
+    KEY_SIZE,
+    KEY_NR_INODES,
+    KEY_MIN_EXTENT,
+    KEY_MAX_EXTENT,
+    KEY_HUGEPAGES,
+    KEY_TAIL_PACKING,
+    KEY_COMPRESS_AGE,
+    KEY_SPILL,
+    KEY_SPILL_WATERMARK,
+    KEY_SPILL_PSI,
+    KEY_DEDUP,
+    KEY_DEDUP_SCAN,
+    KEY_BACKING,
+    KEY_BACKING_CACHE,
+    KEY_WRITE_BACK,
+    KEY_LOWLEVEL,
 #ifdef CMAKE_BUILD_DEBUG
     KET_HASH_CHECK,
 #endif // CMAKE_BUILD_DEBUG
@@ -72,6 +167,29 @@ static struct fuse_opt fs_opts[] = {
         FUSE_OPT_KEY("--version",       KEY_VERSION),
         FUSE_OPT_KEY("-h",              KEY_HELP),
         FUSE_OPT_KEY("--help",          KEY_HELP),
+        FUSE_OPT_KEY("restore=",        KEY_RESTORE),
+        FUSE_OPT_KEY("base=",           KEY_BASE),
+        FUSE_OPT_KEY("image=",          KEY_IMAGE),
+        FUSE_OPT_KEY("image_interval=", KEY_IMAGE_INTERVAL),
+        FUSE_OPT_KEY("journal=",        KEY_JOURNAL),
+        FUSE_OPT_KEY("durability=",     KEY_DURABILITY),
+        FUSE_OPT_KEY("commit_interval=", KEY_COMMIT_INTERVAL),
+        FUSE_OPT_KEY("size=",           KEY_SIZE),
+        FUSE_OPT_KEY("nr_inodes=",      KEY_NR_INODES),
+        FUSE_OPT_KEY("min_extent=",     KEY_MIN_EXTENT),
+        FUSE_OPT_KEY("max_extent=",     KEY_MAX_EXTENT),
+        FUSE_OPT_KEY("hugepages=",      KEY_HUGEPAGES),
+        FUSE_OPT_KEY("tail_packing",    KEY_TAIL_PACKING),
+        FUSE_OPT_KEY("compress_age=",   KEY_COMPRESS_AGE),
+        FUSE_OPT_KEY("spill=",          KEY_SPILL),
+        FUSE_OPT_KEY("spill_watermark=", KEY_SPILL_WATERMARK),
+        FUSE_OPT_KEY("spill_psi",       KEY_SPILL_PSI),
+        FUSE_OPT_KEY("dedup",           KEY_DEDUP),
+        FUSE_OPT_KEY("dedup_scan=",     KEY_DEDUP_SCAN),
+        FUSE_OPT_KEY("backing=",        KEY_BACKING),
+        FUSE_OPT_KEY("backing_cache=",  KEY_BACKING_CACHE),
+        FUSE_OPT_KEY("write_back",      KEY_WRITE_BACK),
+        FUSE_OPT_KEY("lowlevel",        KEY_LOWLEVEL),
 #ifdef CMAKE_BUILD_DEBUG
         FUSE_OPT_KEY("-k",              KET_HASH_CHECK),
         FUSE_OPT_KEY("--hash_check",    KET_HASH_CHECK),
@@ -79,7 +197,70 @@ static struct fuse_opt fs_opts[] = {
         FUSE_OPT_END,
 };
 
-static int opt_proc(void *, const char *, int key, struct fuse_args *outargs)
+static uint64_t min_extent_size = DEFAULT_MIN_EXTENT_SIZE;
+static uint64_t max_extent_size = DEFAULT_MAX_EXTENT_SIZE;
+static std::string restore_path;
+static std::string base_path;
+static bool lowlevel = false;
+
+/// parse option value as a number followed by an optional suffix, throw error if failed
+/** @param arg option, "name=value" or "value"
+ *  @param end set to the suffix **/
+static uint64_t parse_value(const char * arg, char * & end)
+{
+    const char * value = strchr(arg, '=');
+    value = value == nullptr ? arg : value + 1;
+
+    // strtoull takes a sign and saturates on overflow, neither is a valid size
+    errno = 0;
+    uint64_t number = strtoull(value, &end, 10);
+    if (end == value || *value == '-' || errno == ERANGE)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_CANNOT_PARSE_ARGUMENT);
+    }
+
+    return number;
+}
+
+/// parse plain number, throw error if failed
+static uint64_t parse_number(const char * arg)
+{
+    char * end = nullptr;
+    uint64_t number = parse_value(arg, end);
+    if (*end != 0)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_CANNOT_PARSE_ARGUMENT);
+    }
+
+    return number;
+}
+
+/// parse size with optional k, m or g suffix, throw error if failed
+static uint64_t parse_size(const char * arg)
+{
+    char * end = nullptr;
+    uint64_t size = parse_value(arg, end);
+    unsigned shift = 0;
+
+    switch (*end)
+    {
+        case 'g': case 'G': shift = 30; end++; break;
+        case 'm': case 'M': shift = 20; end++; break;
+        case 'k': case 'K': shift = 10; end++; break;
+        default: break;
+    }
+
+    // a size that does not fit would wrap around to a small one
+    if (*end != 0 || size > (UINT64_MAX >> shift))
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_CANNOT_PARSE_ARGUMENT);
+    }
+
+    return size << shift;
+}
+
+/// handle one option, throw error if its value cannot be parsed
+static int parse_option(const char * arg, int key, struct fuse_args *outargs)
 {
     static struct fuse_operations ss_nullptr { };
 
@@ -94,11 +275,131 @@ static int opt_proc(void *, const char *, int key, struct fuse_args *outargs)
 
         case KEY_HELP:
             usage(outargs->argv[0]);
-            fuse_opt_add_arg(outargs, "-ho");
+            fuse_opt_add_arg(outargs, "--help");
+            outargs->argv[0][0] = '\0';    // usage line is printed above
             fuse_main(outargs->argc, outargs->argv, &ss_nullptr, nullptr);
             fuse_opt_free_args(outargs);
             exit(EXIT_SUCCESS);
 
+        case KEY_RESTORE:
+            restore_path = strchr(arg, '=') + 1;
+            break;
+
+        case KEY_BASE:
+            base_path = strchr(arg, '=') + 1;
+            break;
+
+        case KEY_IMAGE:
+            image.path = strchr(arg, '=') + 1;
+            break;
+
+        case KEY_IMAGE_INTERVAL:
+            image.interval = std::chrono::seconds(parse_number(arg));
+            break;
+
+        case KEY_JOURNAL:
+            journal.path = strchr(arg, '=') + 1;
+            break;
+
+        case KEY_DURABILITY:
+            if (strcmp(arg, "durability=none") == 0)
+            {
+                journal.durability = JOURNAL_DURABILITY_NONE;
+            }
+            else if (strcmp(arg, "durability=async") == 0)
+            {
+                journal.durability = JOURNAL_DURABILITY_ASYNC;
+            }
+            else if (strcmp(arg, "durability=sync") == 0)
+            {
+                journal.durability = JOURNAL_DURABILITY_SYNC;
+            }
+            else
+            {
+                throw stmpfs_error_t(STMPFS_ERROR_CANNOT_PARSE_ARGUMENT);
+            }
+            break;
+
+        case KEY_COMMIT_INTERVAL:
+            journal.interval = std::chrono::milliseconds(parse_number(arg));
+            break;
+
+        case KEY_SIZE:
+            quota.max_bytes = parse_size(arg);
+            break;
+
+        case KEY_NR_INODES:
+            quota.max_inodes = parse_size(arg);
+            break;
+
+        case KEY_MIN_EXTENT:
+            min_extent_size = parse_size(arg);
+            break;
+
+        case KEY_MAX_EXTENT:
+            max_extent_size = parse_size(arg);
+            break;
+
+        case KEY_HUGEPAGES:
+            if (strcmp(arg, "hugepages=madvise") == 0)
+            {
+                block_pool.backing = POOL_BACKING_MADVISE;
+            }
+            else if (strcmp(arg, "hugepages=explicit") == 0)
+            {
+                block_pool.backing = POOL_BACKING_EXPLICIT;
+            }
+            else
+            {
+                throw stmpfs_error_t(STMPFS_ERROR_CANNOT_PARSE_ARGUMENT);
+            }
+            break;
+
+        case KEY_TAIL_PACKING:
+            tail_pack.enabled = true;
+            break;
+
+        case KEY_COMPRESS_AGE:
+            compressor.cold_age = std::chrono::seconds(parse_number(arg));
+            break;
+
+        case KEY_SPILL:
+            spill.directory = strchr(arg, '=') + 1;
+            break;
+
+        case KEY_SPILL_WATERMARK:
+            spill.high_watermark = parse_size(arg);
+            break;
+
+        case KEY_SPILL_PSI:
+            spill.psi = true;
+            break;
+
+        case KEY_DEDUP:
+            dedup.enabled = true;
+            break;
+
+        case KEY_DEDUP_SCAN:
+            dedup.enabled = true;
+            dedup.scan_interval = std::chrono::seconds(parse_number(arg));
+            break;
+
+        case KEY_BACKING:
+            backing.directory = strchr(arg, '=') + 1;
+            break;
+
+        case KEY_BACKING_CACHE:
+            backing.budget = parse_size(arg);
+            break;
+
+        case KEY_WRITE_BACK:
+            backing.write_back = true;
+            break;
+
+        case KEY_LOWLEVEL:
+            lowlevel = true;
+            break;
+
 #ifdef CMAKE_BUILD_DEBUG
         case KET_HASH_CHECK:
             if_enable_hash_check = true;
@@ -112,6 +413,20 @@ static int opt_proc(void *, const char *, int key, struct fuse_args *outargs)
     return 0;
 }
 
+static int opt_proc(void *, const char * arg, int key, struct fuse_args *outargs)
+{
+    // fuse_opt_parse is C, nothing may be thrown through it
+    try
+    {
+        return parse_option(arg, key, outargs);
+    }
+    catch (stmpfs_error_t & error)
+    {
+        std::cerr << "Invalid option " << arg << ": " << error.what() << std::endl;
+        return -1;
+    }
+}
+
 int main(int argc, char ** argv)
 {
     try
@@ -123,26 +438,67 @@ int main(int argc, char ** argv)
             throw stmpfs_error_t(STMPFS_ERROR_CANNOT_PARSE_ARGUMENT);
         }
 
+        extent_policy = extent_policy_t(min_extent_size, max_extent_size);
+
         auto cur_time = current_time();
 
         filesystem_root.fs_stat.st_mode = S_IFDIR | 0755;
         filesystem_root.fs_stat.st_atim = cur_time;
         filesystem_root.fs_stat.st_ctim = cur_time;
         filesystem_root.fs_stat.st_mtim = cur_time;
+        inode_table.attach_root(filesystem_root);
+
+        // image replaces root as well, with its own extent policy
+        if (!restore_path.empty() && !base_path.empty())
+        {
+            throw stmpfs_error_t(STMPFS_ERROR_CANNOT_PARSE_ARGUMENT);
+        }
+
+        if (!restore_path.empty())
+        {
+            image.restore(filesystem_root, restore_path);
+        }
+        else if (!base_path.empty())
+        {
+            image.map_base(filesystem_root, base_path);
+        }
+
+        // a cache only ever holds part of the tree, so it is neither saved nor logged
+        if (!backing.directory.empty()
+            && (!restore_path.empty() || !base_path.empty() || !image.path.empty() || !journal.path.empty()))
+        {
+            throw stmpfs_error_t(STMPFS_ERROR_CANNOT_PARSE_ARGUMENT);
+        }
+
+        backing.start(filesystem_root);
+
+        // journal holds what happened since the image
+        if (!journal.path.empty())
+        {
+            replay_journal(image.journal_lsn());
+        }
+
+        // SIGUSR1 is only taken by snapshot thread
+        image_t::block_signal();
 
         /*
          * s: run single threaded
          * d: enable debugging
          * f: stay in foreground
          */
-        fuse_opt_add_arg(&args, "-s");
+        // every operation takes filesystem lock, so more threads only help while a fsync
+        // waits for journal without it, letting other fsyncs join the same commit
+        if (journal.path.empty() || journal.durability != JOURNAL_DURABILITY_SYNC)
+        {
+            fuse_opt_add_arg(&args, "-s");
+        }
 
 #ifdef CMAKE_BUILD_DEBUG
         fuse_opt_add_arg(&args, "-d");
         fuse_opt_add_arg(&args, "-f");
 #endif // CMAKE_BUILD_DEBUG
 
-        int ret = fuse_main(args.argc, args.argv, &fuse_ops, nullptr);
+        int ret = lowlevel ? lowlevel_main(&args) : fuse_main(args.argc, args.argv, &fuse_ops, nullptr);
 
         if (ret != 0)
         {
@@ -0,0 +1,174 @@
+#ifndef STMPFS_BACKING_H
+#define STMPFS_BACKING_H
+
+/** @file
+ *
+ * This file defines the read-through cache mode in front of a backing directory
+ */
+
+#include <inode.h>
+#include <atomic>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#define BACKING_READAHEAD_MIN   (128 * 1024)        /* readahead of the second sequential read */
+#define BACKING_READAHEAD_MAX   (4 * 1024 * 1024)   /* readahead doubles up to this */
+
+/// Serves the filesystem as a memory cache of a backing directory
+/// An entry missing in a directory not listed yet is looked up in the backing
+/// directory and loaded on the spot, a directory is listed in full on readdir.
+/// File content is not read at load: an extent that is not in memory (a
+/// nullptr one) is fetched from the backing file on first read, with a
+/// readahead window that doubles on sequential reads. Clean extents of the
+/// least recently read files are dropped again once data in memory passes
+/// the budget.
+/// Every change is applied to the backing directory before it is applied in
+/// memory. File writes are written through at once, or with write-back only
+/// marked dirty and written out on fsync, on close, before any other change
+/// of the file and at unmount.
+/// Everything except start() and stop() requires filesystem lock.
+class backing_t
+{
+private:
+    /// cache state of a regular file
+    struct file_t
+    {
+        uint64_t sequence = 0;          // position in lru, 0 if not in it
+        uint64_t next_offset = 0;       // where a sequential read goes on
+        uint64_t window = 0;            // readahead
+        std::vector < bool > dirty;     // per extent, written but not written back
+    };
+
+    int root_fd = -1;
+    uint64_t next_sequence = 1;
+    std::unordered_map < const inode_t *, file_t > files;
+    std::map < uint64_t, inode_t * > lru;       // sequence -> file, least recently used first
+
+    std::atomic < uint64_t > loaded_entries = 0;
+    std::atomic < uint64_t > fetches = 0;
+    std::atomic < uint64_t > fetched_bytes = 0;
+    std::atomic < uint64_t > readahead_bytes = 0;
+    std::atomic < uint64_t > evicted_bytes = 0;
+    std::atomic < uint64_t > written_bytes = 0;
+    std::atomic < uint64_t > write_backs = 0;
+
+    /// path of a fuse path in backing directory
+    /** @param path fuse path, starting with / **/
+    static std::string relative(const char * path);
+
+    /// open a file in backing directory, throw error if failed
+    int open_file(const std::string & path, int flags, mode_t mode = 0) const;
+
+    /// create an inode for a backing entry, throw error if failed
+    /** @param parent directory to add it to
+     *  @param name entry name
+     *  @param path entry path in backing directory
+     *  @param st stat of backing entry **/
+    inode_t * load(inode_t & parent, const std::string & name, const std::string & path, const struct stat & st);
+
+    /// move a file to the recently used end of lru
+    file_t & touch(inode_t & inode);
+
+    /// read extents that are not in memory from backing file
+    /** @param path file path in backing directory
+     *  @param first first extent
+     *  @param last extent past the range **/
+    void fetch_extents(const std::string & path, inode_t & inode, uint64_t first, uint64_t last);
+
+    /// drop clean extents of least recently used files until the budget has room
+    /** @param needed bytes about to be fetched
+     *  @param keep file being accessed, its extents in the accessed range stay
+     *  @param keep_first first extent of the range
+     *  @param keep_last extent past the range **/
+    void evict(uint64_t needed, const inode_t * keep, uint64_t keep_first, uint64_t keep_last);
+
+    /// write dirty extents of a file back
+    /** @param path file path in backing directory **/
+    void write_back_file(const std::string & path, inode_t & inode, bool sync);
+
+    /// write back every dirty file below an inode
+    /** @param path inode path in backing directory **/
+    void write_back_tree(const std::string & path, inode_t & inode);
+
+public:
+    /// backing directory, empty disables backing mode
+    std::string directory;
+
+    /// if file writes are kept dirty in memory instead of written through
+    bool write_back = false;
+
+    /// data size in memory that starts eviction, 0 is 1/2 of RAM
+    uint64_t budget = 0;
+
+    /// open backing directory if set, root becomes its cache
+    /** @param root filesystem root **/
+    void start(inode_t & root);
+
+    /// write back everything and close backing directory
+    /** @param root filesystem root **/
+    void stop(inode_t & root);
+
+    /// if backing mode is on
+    [[nodiscard]] bool enabled() const { return root_fd != -1; }
+
+    /// find an entry, loading it from backing directory if parent is not listed yet
+    /** @param parent directory
+     *  @param name entry name
+     *  @param path entry path in backing directory
+     *  @return inode, nullptr if not found **/
+    inode_t * lookup(inode_t & parent, const std::string & name, const std::string & path);
+
+    /// load every entry of a directory not listed yet
+    /** @param path fuse path of directory **/
+    void list(const char * path, inode_t & inode);
+
+    /// bring a range of a file into memory before it is read, with readahead
+    /** @param path fuse path of file
+     *  @param offset read offset
+     *  @param length read length **/
+    void read(const char * path, inode_t & inode, uint64_t offset, uint64_t length);
+
+    /// fetch extents a write only covers in part, and write it through if not write-back
+    /** @param path fuse path of file
+     *  @param buffer data to write
+     *  @param length write length
+     *  @param offset write offset **/
+    void prepare_write(const char * path, inode_t & inode, const char * buffer, uint64_t length, uint64_t offset);
+
+    /// mark a range written in memory dirty if write-back, keep usage within budget
+    /** @param offset write offset
+     *  @param length bytes written **/
+    void commit_write(inode_t & inode, uint64_t offset, uint64_t length);
+
+    /// write dirty extents of a file back
+    /** @param path fuse path of file
+     *  @param sync also sync backing file **/
+    void flush(const char * path, inode_t & inode, bool sync);
+
+    /// drop cache state of an inode being destroyed
+    void forget(const inode_t * inode);
+
+    // changes applied to backing directory, throw error if failed
+    void mkdir(const char * path, mode_t mode);
+    void mknod(const char * path, mode_t mode, dev_t device);
+    void create(const char * path, mode_t mode);
+    void symlink(const char * path, const char * link);
+    void unlink(const char * path);
+    void rmdir(const char * path);
+    void rename(const char * path, const char * new_path);
+    void chmod(const char * path, mode_t mode);
+    void chown(const char * path, uid_t uid, gid_t gid);
+    void utimens(const char * path, const struct timespec time[2]);
+    void truncate(const char * path, inode_t & inode, off_t size);
+    void fallocate(const char * path, inode_t & inode, int mode, off_t offset, off_t length);
+
+    /// loads, fetches, eviction and write-back activity
+    [[nodiscard]] std::string statistics();
+};
+
+/// backing directory cache
+extern backing_t & backing;
+
+#endif //STMPFS_BACKING_H
@@ -0,0 +1,160 @@
+#ifndef STMPFS_BLOCK_H
+#define STMPFS_BLOCK_H
+
+/** @file
+ *
+ * This file defines reference counted, copy-on-write data blocks
+ */
+
+#include <cstdint>
+#include <atomic>
+#include <vector>
+#include <chrono>
+
+class block_t;
+
+/// intrusive list of blocks, ordered from most to least recently used
+struct block_list_t
+{
+    block_t * head = nullptr;
+    block_t * tail = nullptr;
+};
+
+/// Data block holding one extent
+/// Blocks are shared between inodes by reference counting,
+/// a shared block is copied before it is written (copy-on-write).
+/// A packed block holds only the partial tail of an extent in a shared
+/// tail slab (see tail_pack.h), it is promoted to a full block on write.
+/// Full blocks are kept in a least recently used list, cold blocks may be
+/// compressed (see compressor.h) or written out to a spill file (see spill.h),
+/// and are brought back on next access.
+/// Full blocks of identical content may be merged (see dedup.h).
+/// A mapped block serves its content straight from a read-only base image
+/// mapped into memory (see image.h), it is neither charged nor ever evicted,
+/// and is copied up into a private block on write.
+/// Blocks remember the snapshot they were last written to, so unchanged
+/// blocks are not written again by incremental snapshots (see image.h).
+class block_t
+{
+private:
+    std::atomic < uint64_t > refcount = 1;
+    uint64_t block_size;
+    uint64_t packed_length = 0;         // valid length if packed, 0 if not packed
+    char * block_data;                  // nullptr if compressed or spilled
+    bool mapped = false;                // block_data points into a base image
+    char * compressed_data = nullptr;
+    uint64_t compressed_length = 0;
+    uint64_t spill_offset = UINT64_MAX; // offset in spill file, UINT64_MAX if not spilled
+
+    std::chrono::steady_clock::time_point last_access;
+    block_list_t * list = nullptr;      // list block is in
+    block_t * list_prev = nullptr;      // warmer block
+    block_t * list_next = nullptr;      // colder block
+    bool busy = false;                  // held by a background worker
+
+    uint64_t fingerprint = 0;           // content hash, valid if fingerprinted
+    bool fingerprinted = false;
+    bool indexed = false;               // if canonical block in dedup index
+    uint32_t merges = 0;                // references taken by dedup merges, if canonical
+
+    uint64_t saved_generation = 0;      // snapshot content was written to, 0 if changed since
+    uint64_t saved_offset = 0;          // data offset in that snapshot
+
+    static block_list_t lru;            // raw blocks
+    static block_list_t incompressible; // cold blocks compression could not shrink
+
+    explicit block_t(uint64_t size);
+    block_t(const char * tail, uint64_t length, uint64_t size);
+    block_t(char * content, uint64_t size) : block_size(size), block_data(content), mapped(true) { }
+    ~block_t();
+
+    /// return block data to block pool, tail slab, compressor or spill file, mapped data is kept
+    void free_data();
+
+    /// mark block as used, bringing it back into memory if needed
+    void touch();
+
+    /// insert block at head of a list, removing it from its current list
+    /** @param target list to insert into **/
+    void list_insert(block_list_t & target);
+
+    /// remove block from its list
+    void list_remove();
+
+    /// bytes charged to quota for this block
+    [[nodiscard]] uint64_t charged_size() const;
+
+    /// drop fingerprint before content changes
+    void forget_fingerprint();
+
+    friend class compressor_t;
+    friend class dedup_t;
+    friend class spill_t;
+    friend class image_t;
+
+public:
+    /// allocate a block from block pool, content is undefined
+    /** @param size block size **/
+    static block_t * create(uint64_t size);
+
+    /// pack a partial extent into a tail slab
+    /** @param tail valid data of extent
+     *  @param length valid length, no more than PACKED_TAIL_MAX
+     *  @param size extent size **/
+    static block_t * create_packed(const char * tail, uint64_t length, uint64_t size);
+
+    /// serve content of a mapped base image, which has to outlive the block
+    /** @param content valid data of extent
+     *  @param length valid length, a partial tail is treated like a packed one
+     *  @param size extent size **/
+    static block_t * create_mapped(const char * content, uint64_t length, uint64_t size);
+
+    /// drop references of blocks, returning unreferenced data to block pool in bulk
+    /** @param blocks blocks to release, nullptr (holes) are skipped **/
+    static void release(const std::vector < block_t * > & blocks);
+
+    /// take a reference
+    block_t * share() { refcount++; return this; }
+
+    /// drop a reference, freeing the block once unreferenced
+    void release();
+
+    /// if block is referenced by more than one owner
+    [[nodiscard]] bool shared() const { return refcount > 1; }
+
+    /// if block only holds the partial tail of an extent, packed or mapped
+    [[nodiscard]] bool packed() const { return packed_length != 0; }
+
+    /// if block content is in a base image
+    [[nodiscard]] bool is_mapped() const { return mapped; }
+
+    /// block content for read, only packed_length bytes are valid if packed
+    [[nodiscard]] const char * data() { touch(); return block_data; }
+
+    /// block content for write, block must not be shared, packed or mapped
+    [[nodiscard]] char * writable_data() { touch(); if (fingerprinted) forget_fingerprint(); saved_generation = 0; return block_data; }
+
+    /// copy valid content out, leaving a compressed or spilled block as it is
+    /** @param buffer output of valid_length() bytes **/
+    void read_content(char * buffer) const;
+
+    /// if block content is compressed
+    [[nodiscard]] bool compressed() const { return compressed_data != nullptr; }
+
+    /// if block content is in spill file
+    [[nodiscard]] bool spilled() const { return spill_offset != UINT64_MAX; }
+
+    [[nodiscard]] uint64_t size() const { return block_size; }
+
+    /// bytes of block data that are valid
+    [[nodiscard]] uint64_t valid_length() const { return packed() ? packed_length : block_size; }
+
+    block_t(const block_t &) = delete;
+    block_t & operator=(const block_t &) = delete;
+};
+
+/// make block referenced by owner writable, copying it if shared, packed or mapped
+/** @param block block reference of caller, replaced by the private copy **/
+char * block_for_write(block_t * & block);
+
+#endif //STMPFS_BLOCK_H
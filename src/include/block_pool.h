@@ -0,0 +1,111 @@
+#ifndef STMPFS_BLOCK_POOL_H
+#define STMPFS_BLOCK_POOL_H
+
+/** @file
+ *
+ * This file defines the slab allocator for file data blocks
+ */
+
+#include <cstdint>
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <vector>
+#include <unordered_map>
+
+#define SLAB_SIZE           (2 * 1024 * 1024)   /* 2 MiB, slabs are aligned to their size */
+#define BLOCK_CLASS_COUNT   (64)                /* one size class per power of 2 */
+#define ARENA_SIZE          (256 * 1024 * 1024) /* 256 MiB, mmap backed slabs are carved out of arenas */
+
+/// where slab memory comes from
+enum block_pool_backing_t
+{
+    POOL_BACKING_HEAP,      // aligned_alloc
+    POOL_BACKING_MADVISE,   // anonymous mmap arenas hinted with MADV_HUGEPAGE
+    POOL_BACKING_EXPLICIT,  // MAP_HUGETLB arenas of 2 MiB pages, MADV_HUGEPAGE arenas once they run out
+};
+
+/// Slab allocator for power-of-2 sized data blocks
+/// Blocks are carved out of SLAB_SIZE aligned slabs (blocks larger than SLAB_SIZE
+/// use a slab of their own), every thread keeps a small free list of its own in
+/// front of the shared slabs, and slabs are released once all their blocks are free.
+class block_pool_t
+{
+private:
+    struct slab_t
+    {
+        char *      base;
+        uint64_t    size;               // slab size
+        uint64_t    block_size;
+        uint64_t    carved;             // blocks handed out by bump allocation so far
+        uint64_t    used;               // blocks not in free list of this slab
+        char *      free_list;          // intrusive list, next pointer stored in free block
+    };
+
+    struct size_class_t
+    {
+        std::vector < slab_t * > partial;   // slabs having free blocks
+    };
+
+    std::mutex lock;
+    std::unordered_map < uintptr_t, slab_t > slabs;   // slab base -> slab
+    size_class_t classes[BLOCK_CLASS_COUNT];
+
+    char * arena_next = nullptr;        // unused part of current arena
+    char * arena_end = nullptr;
+    std::vector < char * > retained;    // released mmap slabs, not resident
+    uint64_t arena_bytes = 0;           // address space mapped for arenas
+    uint64_t explicit_arenas = 0;       // arenas of MAP_HUGETLB pages
+
+    uint64_t slab_bytes = 0;            // memory held by slabs
+    uint64_t global_used_bytes = 0;     // blocks handed out to threads, including thread caches
+    std::atomic < uint64_t > cached_bytes = 0;  // blocks sitting in thread caches
+
+    /// take up to count blocks from slabs, lock must be held
+    void take_blocks(unsigned int size_class, std::vector < char * > & blocks, uint64_t count);
+
+    /// return one block to its slab, lock must be held
+    void return_block(char * block);
+
+    /// create a new slab in size class, lock must be held
+    slab_t & new_slab(unsigned int size_class);
+
+    /// get memory for a slab, throw error if out of memory, lock must be held
+    /** @param size slab size **/
+    char * map_slab(uint64_t size);
+
+    /// give memory of an empty slab back, lock must be held
+    /** @param base slab memory
+     *  @param size slab size **/
+    void unmap_slab(char * base, uint64_t size);
+
+    friend struct block_thread_cache_t;
+
+public:
+    /// slab memory source, set before first allocation
+    block_pool_backing_t backing = POOL_BACKING_HEAP;
+
+    /// allocate a block, throw error if out of memory
+    /** @param size block size, power of 2 **/
+    char * allocate(uint64_t size);
+
+    /// free a block
+    /** @param block block allocated by this pool
+     *  @param size block size **/
+    void deallocate(char * block, uint64_t size);
+
+    /// free blocks in bulk, taking the slab lock at most once
+    /** @param blocks blocks allocated by this pool and their sizes **/
+    void deallocate(const std::vector < std::pair < char *, uint64_t > > & blocks);
+
+    /// bytes of blocks handed out, including thread caches
+    [[nodiscard]] uint64_t used_bytes();
+
+    /// fill and fragmentation statistics
+    [[nodiscard]] std::string statistics();
+};
+
+/// data block pool, never destructed so blocks can be freed during exit
+extern block_pool_t & block_pool;
+
+#endif //STMPFS_BLOCK_POOL_H
@@ -0,0 +1,75 @@
+#ifndef STMPFS_COMPRESSOR_H
+#define STMPFS_COMPRESSOR_H
+
+/** @file
+ *
+ * This file defines background compression of cold data blocks
+ */
+
+#include <block.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <thread>
+
+#define COMPRESS_BATCH      (64)    /* blocks compressed per filesystem lock round */
+
+/// Compresses blocks idle longer than cold_age in background
+/// Candidates are taken from the cold end of block LRU list under filesystem
+/// lock, and compressed outside of it while a reference is held, which makes
+/// any concurrent write copy the block instead of modifying it.
+/// Compressed blocks leave the list and are decompressed on next access,
+/// blocks that do not compress are moved to the incompressible list.
+class compressor_t
+{
+private:
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    bool running = false;
+
+    std::atomic < uint64_t > compressed_blocks = 0;
+    std::atomic < uint64_t > raw_bytes = 0;             // original size of compressed blocks
+    std::atomic < uint64_t > compressed_bytes = 0;
+    std::atomic < uint64_t > decompressions = 0;
+    std::atomic < uint64_t > decompress_time = 0;       // nanoseconds, sum
+    std::atomic < uint64_t > decompress_time_max = 0;   // nanoseconds
+
+    /// compress cold blocks until none is left
+    void compress_cold();
+
+    /// background loop
+    void run();
+
+public:
+    /// idle time after which a block is compressed, 0 disables compression
+    std::chrono::seconds cold_age { 0 };
+
+    /// start background compression if enabled
+    void start();
+
+    /// stop background compression
+    void stop();
+
+    /// decompress block, filesystem lock must be held
+    /** @param block compressed block **/
+    void decompress(block_t * block);
+
+    /// decompress block content into a buffer, leaving block compressed
+    /** @param block compressed block
+     *  @param buffer output of block size **/
+    void peek(const block_t * block, char * buffer);
+
+    /// free compressed data of an unreferenced block
+    /** @param block compressed block **/
+    void discard(block_t * block);
+
+    /// compression ratio and decompression latency
+    [[nodiscard]] std::string statistics();
+};
+
+/// cold data compressor, never destructed so blocks can be freed during exit
+extern compressor_t & compressor;
+
+#endif //STMPFS_COMPRESSOR_H
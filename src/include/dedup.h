@@ -0,0 +1,92 @@
+#ifndef STMPFS_DEDUP_H
+#define STMPFS_DEDUP_H
+
+/** @file
+ *
+ * This file defines block-level content deduplication
+ */
+
+#include <block.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define DEDUP_SCAN_BUDGET   (64 * 1024 * 1024)  /* bytes hashed or compared per filesystem lock round of scanner */
+#define DEDUP_SCAN_BLOCKS   (16 * 1024)         /* blocks and inode numbers visited per filesystem lock round of scanner */
+
+/// Shares full blocks with identical content
+/// Blocks are fingerprinted with a fast 64-bit hash, the first block seen with
+/// a fingerprint becomes canonical and is kept in the content index. Later
+/// blocks with the same content are replaced by a reference to it and rely on
+/// copy-on-write from then on. Content is compared before sharing, so hash
+/// collisions only cost a missed merge.
+/// Cold blocks are hashed and compared from a copy of their content, so
+/// deduplication never brings them back into memory.
+/// A block loses its fingerprint once written in place.
+/// The scanner walks inode numbers instead of the tree, so it can drop the
+/// filesystem lock after a bounded round and carry on where it stopped.
+/// Everything except start() and stop() requires filesystem lock.
+class dedup_t
+{
+private:
+    std::unordered_map < uint64_t, block_t * > index;   // fingerprint -> canonical block
+
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wakeup;
+    bool running = false;
+
+    std::vector < char > block_buffer;                  // content of cold block
+    std::vector < char > canonical_buffer;              // content of cold canonical block
+
+    uint64_t hashed_bytes = 0;
+    uint64_t merged_blocks = 0;
+    uint64_t merged_bytes = 0;
+    std::atomic < uint64_t > scans = 0;
+
+    /// block content for read, copied into buffer if block is cold
+    /** @param block full block
+     *  @param buffer scratch buffer for cold content
+     *  @return block content **/
+    static const char * peek(block_t * block, std::vector < char > & buffer);
+
+    /// scan all inodes in number order, one budget per filesystem lock round
+    void scan();
+
+    /// background loop
+    void run();
+
+public:
+    /// if new data is deduplicated when files are closed
+    bool enabled = false;
+
+    /// interval of background scans of existing data, 0 disables scanner
+    std::chrono::seconds scan_interval { 0 };
+
+    /// replace block by canonical block of same content, or index it as canonical
+    /** @param block block reference of caller, nullptr (hole) is skipped
+     *  @return bytes hashed or compared **/
+    uint64_t deduplicate(block_t * & block);
+
+    /// drop block from content index, called when block is written or freed
+    /** @param block fingerprinted block **/
+    void forget(block_t * block);
+
+    /// start background scanner if enabled
+    void start();
+
+    /// stop background scanner
+    void stop();
+
+    /// index size and live dedup ratio
+    [[nodiscard]] std::string statistics();
+};
+
+/// content deduplicator, never destructed so blocks can be freed during exit
+extern dedup_t & dedup;
+
+#endif //STMPFS_DEDUP_H
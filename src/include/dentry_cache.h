@@ -0,0 +1,83 @@
+#ifndef STMPFS_DENTRY_CACHE_H
+#define STMPFS_DENTRY_CACHE_H
+
+/** @file
+ *
+ * This file defines the full path lookup cache in front of pathname_to_inode
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+#define DENTRY_CACHE_ENTRIES    (64 * 1024)     /* cache is emptied once it holds this many paths */
+
+class inode_t;
+
+/// Resolves a full path to its inode with one hash probe
+/// Paths removed by unlink, rmdir and rename are dropped from the cache,
+/// together with everything below a removed directory. An inode counts the
+/// cached paths leading to it, and the whole cache is emptied if an inode
+/// is destroyed while any are left, so a stale entry is never returned.
+/// Paths not found are cached as negative entries (nullptr inode), dropped
+/// once the path is created or something is renamed to it.
+/// Requires filesystem lock.
+class dentry_cache_t
+{
+private:
+    /// hash of a std::string or std::string_view, so lookups need no copy of path
+    struct path_hash_t
+    {
+        using is_transparent = void;
+        size_t operator()(std::string_view path) const { return std::hash < std::string_view > { }(path); }
+    };
+
+    typedef std::unordered_map < std::string, inode_t *, path_hash_t, std::equal_to < > > entry_map_t;
+
+    entry_map_t entries;                // path -> inode, nullptr if not found
+
+    uint64_t negative_entries = 0;
+
+    std::atomic < uint64_t > hits = 0;
+    std::atomic < uint64_t > negative_hits = 0;
+    std::atomic < uint64_t > misses = 0;
+    std::atomic < uint64_t > invalidations = 0;
+    std::atomic < uint64_t > resets = 0;
+
+    /// drop one entry
+    void erase(entry_map_t::iterator it);
+
+public:
+    /// look up a path
+    /** @param path full path, starting with /
+     *  @param inode cached inode, nullptr if the path is cached as not found
+     *  @return if the path is cached **/
+    bool find(std::string_view path, inode_t * & inode);
+
+    /// remember inode of a path
+    /** @param path full path, starting with /
+     *  @param inode inode, nullptr if the path is not found **/
+    void insert(std::string_view path, inode_t * inode);
+
+    /// drop a path once it is created, removed or renamed
+    /** @param path full path, starting with /
+     *  @param below also drop every cached path below it, for a directory with entries **/
+    void invalidate(std::string_view path, bool below);
+
+    /// drop everything
+    void clear();
+
+    /// called by inode destructor, drops everything if a cached path still leads to the inode
+    void forget(const inode_t * inode);
+
+    /// entries, hits and misses, negative ones apart
+    [[nodiscard]] std::string statistics();
+};
+
+/// full path lookup cache
+extern dentry_cache_t & dentry_cache;
+
+#endif //STMPFS_DENTRY_CACHE_H
@@ -0,0 +1,137 @@
+#ifndef STMPFS_DENTRY_INDEX_H
+#define STMPFS_DENTRY_INDEX_H
+
+/** @file
+ *
+ * This file defines the directory entry index of an inode
+ */
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define DENTRY_INDEX_LINEAR_MAX     (32)    /* directories up to this size are searched without hash table */
+#define DENTRY_INDEX_COMPACT_MIN    (16)    /* removed entries are compacted once there are this many, and more than live ones */
+#define DENTRY_INDEX_FIRST_COOKIE   (3)     /* readdir offsets 1 and 2 are . and .. */
+
+class inode_t;
+
+/// directory entry
+struct dentry_t
+{
+    uint64_t    if_constructed_by_inode:1;  // if this dentry is emplace'd
+    inode_t *   inode;
+};
+
+/// Entries of a directory
+/// Entries are kept in one vector in the order they were added, each with
+/// the hash of its name, so a directory takes one allocation for entries
+/// instead of one per entry. Small directories are searched by comparing
+/// hashes linearly, larger ones get an open addressing table of entry
+/// positions (linear probing, removal by backward shift) beside the vector.
+/// A removed entry leaves a hole in the vector until holes outnumber entries,
+/// then the vector is compacted in order and the table is rebuilt.
+/// Every entry gets a cookie, increasing in the order entries are added and
+/// never reused in the directory, so a listing resumed after a cookie neither
+/// repeats nor skips entries that stayed, whatever was added or removed.
+class dentry_index_t
+{
+public:
+    struct entry_t
+    {
+        std::string name;
+        uint64_t    hash;
+        uint64_t    cookie;                 // readdir offset of entry
+        dentry_t    dentry;                 // inode is nullptr for a removed entry
+    };
+
+    /// iterates over entries not removed, in the order they were added
+    template < typename entry_type >
+    class basic_iterator
+    {
+    private:
+        entry_type * cur;
+        entry_type * end;
+
+        void skip() { while (cur != end && cur->dentry.inode == nullptr) { cur++; } }
+
+    public:
+        basic_iterator(entry_type * cur, entry_type * end) : cur(cur), end(end) { skip(); }
+        entry_type & operator*() const { return *cur; }
+        entry_type * operator->() const { return cur; }
+        basic_iterator & operator++() { cur++; skip(); return *this; }
+        bool operator==(const basic_iterator & other) const { return cur == other.cur; }
+    };
+
+    typedef basic_iterator < entry_t > iterator;
+    typedef basic_iterator < const entry_t > const_iterator;
+
+private:
+    /// table slot, empty if index is 0
+    struct slot_t
+    {
+        uint32_t index;                     // entry position + 1
+        uint32_t tag;                       // high half of name hash, checked before the name
+    };
+
+    std::vector < entry_t > entries;
+    std::vector < slot_t > table;           // empty while linear
+    uint64_t live = 0;
+    uint64_t next_cookie = DENTRY_INDEX_FIRST_COOKIE;
+
+    static uint64_t hash_of(std::string_view name);
+
+    /// position of a name in entries, entries.size() if not found
+    [[nodiscard]] uint64_t position(std::string_view name, uint64_t hash) const;
+
+    /// add an entry position to table
+    void table_insert(uint64_t index);
+
+    /// remove an entry position from table
+    void table_erase(uint64_t index);
+
+    /// rebuild table for current entries, or drop it if directory became small
+    void rebuild();
+
+    /// drop removed entries if they outnumber live ones
+    void compact();
+
+public:
+    /// number of entries
+    [[nodiscard]] uint64_t size() const { return live; }
+
+    /// if there are no entries
+    [[nodiscard]] bool empty() const { return live == 0; }
+
+    /// find an entry
+    /** @param name entry name
+     *  @return entry, nullptr if not found **/
+    [[nodiscard]] dentry_t * find(std::string_view name);
+
+    /// add an entry
+    /** @param name entry name
+     *  @param dentry entry
+     *  @return false if name is already taken **/
+    bool emplace(std::string_view name, dentry_t dentry);
+
+    /// remove an entry
+    /** @param name entry name
+     *  @return false if not found **/
+    bool erase(std::string_view name);
+
+    /// remove every entry
+    void clear();
+
+    /// entries after a readdir offset
+    /** @param cookie cookie of last entry listed, 0 to list from start
+     *  @return first entry not removed with a larger cookie **/
+    [[nodiscard]] const_iterator after(uint64_t cookie) const;
+
+    iterator begin() { return { entries.data(), entries.data() + entries.size() }; }
+    iterator end() { return { entries.data() + entries.size(), entries.data() + entries.size() }; }
+    [[nodiscard]] const_iterator begin() const { return { entries.data(), entries.data() + entries.size() }; }
+    [[nodiscard]] const_iterator end() const { return { entries.data() + entries.size(), entries.data() + entries.size() }; }
+};
+
+#endif //STMPFS_DENTRY_INDEX_H
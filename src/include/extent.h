@@ -0,0 +1,58 @@
+#ifndef STMPFS_EXTENT_H
+#define STMPFS_EXTENT_H
+
+/** @file
+ *
+ * This file defines extent size policy and extent layout of file data
+ */
+
+#include <cstdint>
+
+#define DEFAULT_MIN_EXTENT_SIZE (4 * 1024)          /* 4 KiB */
+#define DEFAULT_MAX_EXTENT_SIZE (2 * 1024 * 1024)   /* 2 MiB */
+#define MIN_EXTENT_SIZE_LIMIT   (512)               /* smallest extent allowed */
+
+/// Extent size policy
+/// File data is stored in extents that grow geometrically, extent n
+/// being min_extent_size * 2^n bytes long until max_extent_size is reached,
+/// after which every extent is max_extent_size bytes long.
+/// Setting both sizes to the same value results in fixed size blocks.
+class extent_policy_t
+{
+private:
+    uint64_t min_extent_size;
+    uint64_t max_extent_size;
+    uint64_t min_shift;                 // log2(min_extent_size)
+    uint64_t geometric_count;           // log2(max_extent_size / min_extent_size)
+    uint64_t geometric_length;          // length covered by geometric extents
+
+public:
+    /// create an extent policy, throw error if sizes are not powers of 2 or too small
+    /** @param min_size size of the first extent
+     *  @param max_size size limit of an extent **/
+    extent_policy_t(uint64_t min_size, uint64_t max_size);
+
+    /// index of the extent containing offset
+    /** @param offset data offset **/
+    [[nodiscard]] uint64_t index(uint64_t offset) const;
+
+    /// start offset of the extent
+    /** @param index extent index **/
+    [[nodiscard]] uint64_t offset(uint64_t index) const;
+
+    /// size of the extent
+    /** @param index extent index **/
+    [[nodiscard]] uint64_t size(uint64_t index) const;
+
+    /// extent count needed to hold length bytes
+    /** @param length data length **/
+    [[nodiscard]] uint64_t count(uint64_t length) const;
+
+    [[nodiscard]] uint64_t min_size() const { return min_extent_size; }
+    [[nodiscard]] uint64_t max_size() const { return max_extent_size; }
+};
+
+/// extent policy of current mount, must not be changed once files exist
+extern extent_policy_t extent_policy;
+
+#endif //STMPFS_EXTENT_H
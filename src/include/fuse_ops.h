@@ -7,20 +7,25 @@
  */
 
 #include <inode.h>
+#include <stmpfs_error.h>
 
 extern inode_t filesystem_root;
 
-int do_getattr  (const char * path, struct stat *stbuf);
+/// errno of a failed operation, positive
+/** @param error error thrown by the filesystem **/
+int error_number(const stmpfs_error_t & error);
+
+int do_getattr  (const char * path, struct stat *stbuf, struct fuse_file_info *);
 int do_readlink (const char * path, char *, size_t);
 int do_mknod    (const char * path, mode_t mode, dev_t device);
 int do_mkdir    (const char * path, mode_t mode);
 int do_unlink   (const char * path);
 int do_rmdir    (const char * path);
 int do_symlink  (const char * path, const char *);
-int do_rename   (const char * path, const char * name);
-int do_chmod    (const char * path, mode_t mode);
-int do_chown    (const char * path, uid_t uid, gid_t gid);
-int do_truncate (const char * path, off_t size);
+int do_rename   (const char * path, const char * name, unsigned int flags);
+int do_chmod    (const char * path, mode_t mode, struct fuse_file_info *);
+int do_chown    (const char * path, uid_t uid, gid_t gid, struct fuse_file_info *);
+int do_truncate (const char * path, off_t size, struct fuse_file_info *);
 int do_open     (const char * path, struct fuse_file_info * fi);
 int do_read     (const char * path, char *buffer, size_t size, off_t offset, struct fuse_file_info *fi);
 int do_write    (const char * path, const char * buffer, size_t size, off_t offset, struct fuse_file_info * fi);
@@ -32,11 +37,53 @@ int do_setxattr (const char * path, const char *, const char *, size_t, int);
 int do_getxattr (const char * path, const char *, char *, size_t);
 int do_listxattr (const char *path, char *, size_t);
 int do_removexattr (const char *path, const char *);
-int do_readdir  (const char * path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi);
+int do_readdir  (const char * path, void *buffer, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi,
+                  enum fuse_readdir_flags);
 int do_releasedir (const char *path, struct fuse_file_info *);
 int do_fsyncdir (const char * path, int, struct fuse_file_info *);
 int do_create   (const char * path, mode_t mode, struct fuse_file_info * fi);
-int do_utimens  (const char * path, const struct timespec tv[2]);
-//int do_ioctl    (const char * path, int cmd, void *arg, struct fuse_file_info *, unsigned int flags, void *data);
+int do_utimens  (const char * path, const struct timespec tv[2], struct fuse_file_info *);
 int do_fallocate(const char * path, int mode, off_t offset, off_t length, struct fuse_file_info * fi);
+ssize_t do_copy_file_range (const char * path, struct fuse_file_info *, off_t offset,
+                            const char * destination, struct fuse_file_info *, off_t destination_offset, size_t size, int flags);
+off_t do_lseek   (const char * path, off_t offset, int whence, struct fuse_file_info *);
+void * do_init  (struct fuse_conn_info *, struct fuse_config *);
+
+// cores of the operations above for a known inode, without walking its path, throw error if failed,
+// the ones returning a number return -errno where the operation does
+// path is passed on to backing directory and journal, nullptr if neither is enabled or
+// the inode is an orphan (see inode_table.h), whose changes are not journaled
+void    inode_chmod     (const char * path, inode_t & inode, mode_t mode);
+void    inode_chown     (const char * path, inode_t & inode, uid_t uid, gid_t gid);
+void    inode_truncate  (const char * path, inode_t & inode, off_t size);
+void    inode_utimens   (const char * path, inode_t & inode, const struct timespec tv[2]);
+size_t  inode_write     (const char * path, inode_t & inode, const char * buffer, size_t size, off_t offset);
+void    inode_release   (const char * path, inode_t & inode);
+int     inode_fallocate (const char * path, inode_t & inode, int mode, off_t offset, off_t length);
+off_t   inode_lseek     (inode_t & inode, off_t offset, int whence);
+ssize_t inode_copy_file_range (const char * path, inode_t & source, off_t offset,
+                               const char * destination, inode_t & inode, off_t destination_offset,
+                               size_t size, int flags);
+void    inode_readlink  (inode_t & inode, char * buffer, size_t size);
+int     inode_setxattr  (const char * path, inode_t & inode, const char * name, const char * value, size_t size, int flag);
+int     inode_getxattr  (inode_t & inode, const char * name, char * value, size_t size);
+int     inode_listxattr (inode_t & inode, char * list, size_t list_size);
+int     inode_removexattr (const char * path, inode_t & inode, const char * name);
+
+// namespace cores, on entry name of a parent directory, path is the entry path as above,
+// and paths cached for it are invalidated only if given, the creating ones return the new inode
+inode_t & inode_mknod   (const char * path, inode_t & parent, std::string_view name, mode_t mode, dev_t device);
+inode_t & inode_mkdir   (const char * path, inode_t & parent, std::string_view name, mode_t mode);
+inode_t & inode_create  (const char * path, inode_t & parent, std::string_view name, mode_t mode);
+inode_t & inode_symlink (const char * path, inode_t & parent, std::string_view name, const char * linkname);
+void      inode_unlink  (const char * path, inode_t & parent, std::string_view name);
+int       inode_rmdir   (const char * path, inode_t & parent, std::string_view name);
+int       inode_rename  (const char * path, inode_t & parent, std::string_view name,
+                         const char * new_path, inode_t & new_parent, std::string_view new_name, unsigned int flags);
+void do_destroy (void *);
+
+/// apply journal records past a position before mounting, see journal.h
+/** @param after lsn of the restored image, 0 without an image **/
+void replay_journal(uint64_t after);
+
 #endif //SMNXFS_FUSE_OPS_H
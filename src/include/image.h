@@ -0,0 +1,158 @@
+#ifndef STMPFS_IMAGE_H
+#define STMPFS_IMAGE_H
+
+/** @file
+ *
+ * This file defines checkpoint images of the whole filesystem
+ */
+
+#include <inode.h>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define IMAGE_MAGIC         "STMPFSIM"
+#define IMAGE_VERSION       (4)
+#define IMAGE_ALIGN         (4096)      /* data of every extent starts on a page */
+#define IMAGE_READ_THREADS  (8)         /* restore reads data with up to this many threads */
+#define IMAGE_NO_DATA       UINT64_MAX  /* extent location of a hole */
+#define IMAGE_CHAIN_LENGTH  (8)         /* snapshots per chain, the first one is full */
+
+/// Image file header, at offset 0 and padded to IMAGE_ALIGN
+/// Data of every extent written by this snapshot follows the header page aligned,
+/// followed by metadata: numbers of inodes removed since the previous snapshot as
+/// count (u64) and numbers (u64), then one record per inode saved (inode_count), each as
+///     inode number (u64), record length (u64), struct stat, xattr count (u64),
+///     xattrs as key length (u32), key, value length (u32), value,
+///     data size (u64), inline flag (u8), inline data (INLINE_DATA_SIZE) if set,
+///     otherwise extent count (u64) and extents as generation (u64), offset (u64), length (u64),
+///     dentry count (u64) and dentries as name length (u32), name, inode number (u64).
+/// An extent shared by several files is stored once and shared again on restore.
+/// Snapshot generation G is written to PATH.G. A full snapshot, base_generation
+/// of its chain, holds every inode and extent. An incremental one only holds
+/// inodes and extents changed since the previous one, the rest refers to earlier
+/// generations of the same chain. Restore folds the chain from base_generation
+/// up, a later record of a number replacing an earlier one, and builds the tree
+/// from the record of INODE_TABLE_ROOT, keeping inode numbers.
+struct image_header_t
+{
+    char        magic[8];
+    uint32_t    version;
+    uint32_t    align;
+    uint64_t    min_extent_size;    // extent policy the image was written with
+    uint64_t    max_extent_size;
+    uint64_t    data_offset;
+    uint64_t    data_length;
+    uint64_t    metadata_offset;
+    uint64_t    metadata_length;
+    uint64_t    inode_count;
+    uint64_t    generation;
+    uint64_t    base_generation;
+    uint64_t    journal_lsn;        // last journal record included, see journal.h
+};
+
+/// Writes snapshots and loads them back
+/// A snapshot collects metadata and marks extents to write under filesystem
+/// lock, then forks. The child writes the image from its copy-on-write view of
+/// memory while the parent goes on serving requests, so the pause is the
+/// metadata walk and fork() itself. The parent pays for pages it modifies
+/// meanwhile by copying them.
+class image_t
+{
+private:
+    struct dump_context_t;
+    struct restore_context_t;
+
+    std::atomic < bool > signal_running = false;
+    std::thread signal_thread;
+
+    uint64_t generation = 0;            // last snapshot written
+    uint64_t restored_journal_lsn = 0;  // last journal record included in restored image
+    std::vector < uint64_t > chain;     // generations of current chain, full snapshot first
+    std::vector < uint64_t > removed;   // numbers of saved inodes destroyed since last snapshot
+
+    std::atomic < uint64_t > snapshots = 0;
+    std::atomic < uint64_t > incremental_snapshots = 0;
+    std::atomic < uint64_t > failed_snapshots = 0;
+    std::atomic < uint64_t > snapshot_bytes = 0;    // last snapshot
+    std::atomic < uint64_t > snapshot_time = 0;     // milliseconds, last snapshot
+    std::atomic < uint64_t > pause_time = 0;        // microseconds, last snapshot
+    std::atomic < uint64_t > pause_time_max = 0;    // microseconds
+    std::atomic < uint64_t > restore_bytes = 0;
+    std::atomic < uint64_t > restore_time = 0;      // milliseconds
+    std::atomic < uint64_t > mapped_bytes = 0;      // data served from base images
+
+    /// serialize an inode if it changed since last snapshot, and its dentries
+    static void save_inode(dump_context_t & context, inode_t & inode);
+
+    /// deserialize an inode from its latest record in chain and its dentries, throw error if metadata is corrupted
+    /** @param number inode number **/
+    static void load_inode(restore_context_t & context, inode_t & inode, uint64_t number);
+
+    /// write an image file, replacing target atomically, only reads blocks so it is safe after fork()
+    /** @param context serialized tree
+     *  @param target image file
+     *  @return false if failed **/
+    static bool write_image(const dump_context_t & context, const std::string & target);
+
+    /// load an image file into an empty tree, reading its data or mapping it
+    /** @param root filesystem root
+     *  @param source image file
+     *  @param map serve data from the mapped image instead of reading it **/
+    void load(inode_t & root, const std::string & source, bool map);
+
+    /// snapshot on every SIGUSR1 and every interval until stopped
+    void signal_loop(inode_t & root);
+
+public:
+    /// snapshots are written to PATH.GENERATION, PATH links to the latest one, empty disables snapshots
+    std::string path;
+
+    /// time between snapshots, 0 only writes them on SIGUSR1
+    std::chrono::seconds interval = std::chrono::seconds(0);
+
+    /// write a snapshot of the whole tree in the background, returning once it is complete
+    /// filesystem lock must not be held, only one snapshot may run at a time
+    /** @param root filesystem root **/
+    void snapshot(inode_t & root);
+
+    /// load an image file into an empty tree, together with the images it refers to
+    /** @param root filesystem root
+     *  @param source image file **/
+    void restore(inode_t & root, const std::string & source);
+
+    /// map an image file and its chain as read-only base of an empty tree
+    /// metadata is loaded, but data is not read, files share it with every mount
+    /// of the same image through the page cache and copy up extents they write.
+    /// Images must not be changed while mapped.
+    /** @param root filesystem root
+     *  @param source image file **/
+    void map_base(inode_t & root, const std::string & source);
+
+    /// called by inode destructor, the next snapshot records removal of a saved inode
+    /** @param inode inode destroyed **/
+    void forget(const inode_t & inode);
+
+    /// last journal record included in the restored image, replay goes on after it
+    [[nodiscard]] uint64_t journal_lsn() const { return restored_journal_lsn; }
+
+    /// block SIGUSR1 in calling thread and threads it creates, call before any thread is started
+    static void block_signal();
+
+    /// start writing snapshots if a path is set
+    /** @param root filesystem root **/
+    void start(inode_t & root);
+
+    /// stop writing snapshots, waiting for one in progress
+    void stop();
+
+    /// snapshot pause, sizes and throughput
+    [[nodiscard]] std::string statistics();
+};
+
+/// snapshots
+extern image_t & image;
+
+#endif //STMPFS_IMAGE_H
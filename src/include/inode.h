@@ -10,34 +10,59 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <string>
+#include <string_view>
 #include <map>
 #include <debug.h>
+#include <extent.h>
+#include <block.h>
+#include <dentry_index.h>
 
-#define BLOCK_SIZE (1024)
+#define INLINE_DATA_SIZE (128)  /* files up to this size are kept inside inode */
 
 class inode_t
 {
 private:
-    struct dentry_t
-    {
-        uint64_t    if_constructed_by_inode:1;  // if this dentry is emplace'd
-        inode_t *   inode;
-    };
-
-    std::vector < char * > data;                // if is a file, use this data
+    std::vector < block_t * > data;             // if is a file, use this data (extents, see extent.h), nullptr is a hole
     uint64_t cur_data_size = 0;
-    std::map < std::string, dentry_t > dentry;  // if is a directory, use this dentry
+    uint64_t allocated_size = 0;                // size of allocated extents
+    char inline_data[INLINE_DATA_SIZE] { };     // small file content, 0s past end
+    dentry_index_t dentry;                      // if is a directory, use this dentry
+    bool charged_inode = false;                 // if counted against inode limit
+    bool listed = true;                         // if every entry of backing directory is loaded (see backing.h)
+    uint64_t cached_paths = 0;                  // paths leading here in dentry cache (see dentry_cache.h)
+    uint64_t number = 0;                        // inode number, 0 if not numbered (see inode_table.h)
+    uint64_t saved_generation = 0;              // snapshot metadata was written to, 0 if changed since (see image.h)
+
+    /// if content is kept in inline_data instead of extents
+    [[nodiscard]] bool is_inline() const { return data.empty() && cur_data_size <= INLINE_DATA_SIZE; }
+
+    /// move inline content into extents
+    void uninline();
+
+    /// promote packed tail back to a full extent before data grows past it
+    void unpack_tail();
 
 #ifdef CMAKE_BUILD_DEBUG
     /// return hash of current data
     std::string hash();
 #endif // CMAKE_BUILD_DEBUG
 
+    friend class image_t;
+    friend class backing_t;
+    friend class dentry_cache_t;
+    friend class inode_table_t;
+    friend class dedup_t;
+
 public:
     struct stat fs_stat { };            // file/dir stat, publicly changeable
 
     std::map < std::string, std::string > xattr;
 
+    uint64_t journal_lsn = 0;           // last journal record changing this inode or its dentries
+
+    /// metadata changed, the next snapshot saves it again, called by whoever changes fs_stat or xattr
+    void changed() { saved_generation = 0; }
+
     /// read from buffer
     /** @param buffer output buffer
      *  @param length length for reading
@@ -47,7 +72,8 @@ public:
     /// write to buffer
     /** @param buffer output buffer
      *  @param length length for writing
-     *  @param offset write offset **/
+     *  @param offset write offset
+     *  @return bytes written, less than length if space ran out **/
     size_t write(const char * buffer, size_t length, off_t offset);
 
     /// clear content
@@ -56,35 +82,74 @@ public:
     /// add directory entry
     /** @param name dentry name
      *  @param inode inode **/
-    void add_dentry(const std::string& name, inode_t& inode, uint64_t if_alloc_by_inode = 0);
+    void add_dentry(std::string_view name, inode_t& inode, uint64_t if_alloc_by_inode = 0);
 
     /// create a new directory entry
     /** @param name dentry name
-     *  @param inode inode **/
-    void emplace_new_dentry(const std::string& name, const inode_t& inode);
+     *  @param inode inode
+     *  @return inode created for the entry **/
+    inode_t & emplace_new_dentry(std::string_view name, const inode_t& inode);
 
     /// delete directory entry
     /** @param name dentry name
      *  @param protect_child if delete child **/
-    void del_dentry(const std::string& name, bool protect_child = false);
+    void del_dentry(std::string_view name, bool protect_child = false);
 
-    /// find name in next level dentry list
+    /// find name in next level dentry list, throw error if not found
     /** @param name pathname (one level) **/
-    inode_t* find_in_dentry(const std::string& name);
+    inode_t* find_in_dentry(std::string_view name);
+
+    /// find name in next level dentry list
+    /** @param name pathname (one level)
+     *  @return inode, nullptr if not found **/
+    [[nodiscard]] inode_t* lookup_dentry(std::string_view name);
 
     /// get dentry list
-    [[nodiscard]] std::map < std::string, dentry_t > my_dentry () const { return dentry; }
+    [[nodiscard]] const dentry_index_t & my_dentry () const { return dentry; }
 
     /// deconstruction
-    ~inode_t() { clear(); }
+    ~inode_t();
 
     /// construction
     inode_t() noexcept;
 
-    /// change buffer size
+    /// change buffer size, growing leaves a hole
     /** @param size target size **/
     void truncate(off_t size);
 
+    /// zero a range, releasing the extents inside it
+    /** @param offset hole offset
+     *  @param length hole length **/
+    void punch_hole(off_t offset, off_t length);
+
+    /// allocate zeroed extents for the holes in a range, up to data size
+    /** @param offset range offset
+     *  @param length range length **/
+    void allocate(off_t offset, off_t length);
+
+    /// find next data or hole
+    /** @param offset start offset
+     *  @param whence SEEK_DATA or SEEK_HOLE
+     *  @return offset found, -1 if offset is beyond data or no data follows **/
+    off_t seek(off_t offset, int whence);
+
+    /// copy a range from source, sharing extents that line up instead of copying them
+    /** @param source source inode, may be this inode if ranges do not overlap
+     *  @param source_offset offset in source, range must be inside source data
+     *  @param offset offset in this inode
+     *  @param length clone length
+     *  @return bytes cloned, less than length if space ran out **/
+    size_t clone_range(inode_t & source, off_t source_offset, off_t offset, size_t length);
+
+    /// data size
+    [[nodiscard]] uint64_t size() const { return cur_data_size; }
+
+    /// move partial last extent into a shared tail slab if tail packing is enabled
+    void pack_tail();
+
+    /// share full extents with identical extents elsewhere
+    void deduplicate();
+
     /// count inode (includes self) since this inode
     size_t count_inode();
 
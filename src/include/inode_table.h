@@ -0,0 +1,114 @@
+#ifndef STMPFS_INODE_TABLE_H
+#define STMPFS_INODE_TABLE_H
+
+/** @file
+ *
+ * This file defines the inode number table
+ */
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define INODE_TABLE_ROOT    (1)     /* inode number of filesystem root, as FUSE expects */
+
+class inode_t;
+
+/// Gives every inode of the tree a number, kept in fs_stat.st_ino
+/// Number n is slot n of one vector, so a number is resolved to its inode
+/// with one index. Numbers of destroyed inodes are reused, last freed first,
+/// and every reuse increases the generation of the number, so a number and
+/// generation pair kept by a client never finds a different inode.
+/// A number the kernel still holds from lookups is not reused before the
+/// kernel forgets it, even if its inode is gone.
+/// An inode removed from the tree while the kernel holds its number, an
+/// unlinked open file or a replaced rename target, is kept as an orphan and
+/// destroyed once the kernel forgets it, so open files keep their content.
+/// Numbers are stable while mounted, and kept by image restore, where
+/// snapshots refer to inodes by number (see image.h).
+/// Requires filesystem lock.
+class inode_table_t
+{
+private:
+    struct slot_t
+    {
+        inode_t *   inode;                  // nullptr if number is free
+        uint64_t    generation;             // increased each time number is freed
+        uint64_t    lookups;                // held by kernel, number is not reused before 0
+        bool        orphan;                 // inode is out of tree, destroyed once lookups reach 0
+    };
+
+    std::vector < slot_t > slots;           // slot 0 is never used, slot 1 is root
+    std::vector < uint64_t > free_numbers;  // freed numbers, reused from the back
+
+    std::atomic < uint64_t > reused = 0;
+    std::atomic < uint64_t > orphans = 0;
+
+public:
+    /// number an inode, again after its fs_stat was overwritten
+    /** @param inode inode **/
+    void attach(inode_t & inode);
+
+    /// number an inode as an image recorded it, throw error if number is taken
+    /// numbers skipped are freed by restored() once every inode is attached
+    /** @param inode inode
+     *  @param number inode number **/
+    void attach(inode_t & inode, uint64_t number);
+
+    /// free numbers not taken by an image restore
+    void restored();
+
+    /// number filesystem root as INODE_TABLE_ROOT
+    /** @param root filesystem root **/
+    void attach_root(inode_t & root);
+
+    /// called by inode destructor, frees number of inode
+    void detach(inode_t & inode);
+
+    /// inode left the tree, destroy it, or keep it as an orphan while the kernel holds its number
+    /** @param inode inode removed **/
+    void remove(inode_t & inode);
+
+    /// kernel got a number in a lookup reply
+    /** @param number inode number **/
+    void hold(uint64_t number);
+
+    /// kernel forgot lookups of a number, which may be reused once all are forgotten
+    /// an orphan is destroyed once all are forgotten
+    /** @param number inode number
+     *  @param count lookups forgotten
+     *  @return lookups left **/
+    uint64_t release(uint64_t number, uint64_t count);
+
+    /// find inode by number
+    /** @param number inode number
+     *  @return inode, nullptr if number is free **/
+    [[nodiscard]] inode_t * find(uint64_t number) const;
+
+    /// find inode by number and generation
+    /** @param number inode number
+     *  @param generation generation number had when given out
+     *  @return inode, nullptr if number is free or was reused since **/
+    [[nodiscard]] inode_t * find(uint64_t number, uint64_t generation) const;
+
+    /// if inode of a number is out of tree, kept only for the kernel
+    /** @param number inode number **/
+    [[nodiscard]] bool orphan(uint64_t number) const;
+
+    /// current generation of a number
+    [[nodiscard]] uint64_t generation(uint64_t number) const;
+
+    /// every number given out so far is below this
+    [[nodiscard]] uint64_t size() const;
+
+    /// numbers in use, free and reused, orphans
+    [[nodiscard]] std::string statistics();
+
+    inode_table_t();
+};
+
+/// inode number table
+extern inode_table_t & inode_table;
+
+#endif //STMPFS_INODE_TABLE_H
@@ -0,0 +1,206 @@
+#ifndef STMPFS_JOURNAL_H
+#define STMPFS_JOURNAL_H
+
+/** @file
+ *
+ * This file defines the write-ahead journal of filesystem mutations
+ */
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#define JOURNAL_BUFFER_LIMIT    (64 * 1024 * 1024)  /* pending bytes before appending waits for writer */
+
+/// when journal records become durable
+enum journal_durability_t
+{
+    JOURNAL_DURABILITY_NONE,    // written out at once, never synced, survives a daemon crash only
+    JOURNAL_DURABILITY_ASYNC,   // synced every commit interval, fsync does not wait
+    JOURNAL_DURABILITY_SYNC,    // fsync waits until records of its file are synced
+};
+
+/// mutation kept in a journal record, with the arguments of its fuse operation
+enum journal_op_t : uint32_t
+{
+    JOURNAL_MKDIR = 1,          // path, mode
+    JOURNAL_MKNOD,              // path, mode, device
+    JOURNAL_CREATE,             // path, mode
+    JOURNAL_SYMLINK,            // path, link
+    JOURNAL_UNLINK,             // path
+    JOURNAL_RMDIR,              // path
+    JOURNAL_RENAME,             // path, new path
+    JOURNAL_CHMOD,              // path, mode
+    JOURNAL_CHOWN,              // path, uid, gid
+    JOURNAL_UTIMENS,            // path, atime sec, atime nsec, mtime sec, mtime nsec
+    JOURNAL_TRUNCATE,           // path, size
+    JOURNAL_WRITE,              // path, offset, data
+    JOURNAL_FALLOCATE,          // path, mode, offset, length
+    JOURNAL_CLONE,              // path, source path, source offset, offset, length
+    JOURNAL_SETXATTR,           // path, name, value
+    JOURNAL_REMOVEXATTR,        // path, name
+};
+
+/// record header, followed by arguments as u64 numbers and u32 length prefixed strings
+struct journal_record_header_t
+{
+    uint32_t        length;     // whole record
+    uint32_t        checksum;   // CRC-32 of everything after this field
+    uint64_t        lsn;        // log sequence number, consecutive from 1
+    struct timespec time;       // time of mutation
+    uint32_t        op;
+    uint32_t        reserved;
+};
+
+/// arguments of a record being replayed
+class journal_reader_t
+{
+private:
+    const char * data;
+    uint64_t length;
+    uint64_t cursor = 0;
+
+public:
+    /** @param data arguments
+     *  @param length length of arguments **/
+    journal_reader_t(const char * data, uint64_t length) : data(data), length(length) { }
+
+    /// next number, throw error if record is too short
+    uint64_t number();
+
+    /// next string, throw error if record is too short
+    std::string_view string();
+
+    /// next string as a C string
+    std::string c_string() { return std::string(string()); }
+};
+
+/// Append-only journal of mutations, replayed on top of a restored image at mount
+/// Operations append records to a memory buffer under filesystem lock, a writer
+/// thread writes out everything pending with one write and, as durability asks
+/// for, one fdatasync for all of it (group commit). fsync only waits until the
+/// last record of its own file is durable.
+/// A snapshot (see image.h) remembers the journal position it was taken at,
+/// records before it are dropped once the snapshot is written.
+class journal_t
+{
+public:
+    /// journal position
+    struct mark_t
+    {
+        uint64_t lsn;           // last record before position
+        uint64_t offset;        // file offset of position
+    };
+
+private:
+    int fd = -1;
+    std::thread worker;
+    std::mutex lock;
+    std::condition_variable wakeup;         // writer
+    std::condition_variable progress;       // appenders and waiters
+    std::atomic < bool > running = false;
+
+    std::string pending;                    // records not written yet
+    uint64_t next_lsn = 1;
+    uint64_t appended_offset = 0;           // file offset past last appended record
+    uint64_t written_offset = 0;            // file offset past last written record
+    uint64_t written_lsn = 0;
+    uint64_t durable_lsn = 0;
+    uint64_t wanted_lsn = 0;                // highest lsn a fsync waits for
+    bool failed = false;
+    mark_t truncate_mark { 0, 0 };          // drop records before, offset 0 if nothing to drop
+
+    std::atomic < uint64_t > records = 0;
+    std::atomic < uint64_t > record_bytes = 0;
+    std::atomic < uint64_t > commits = 0;
+    std::atomic < uint64_t > syncs = 0;
+    std::atomic < uint64_t > waits = 0;
+    std::atomic < uint64_t > wait_time = 0;     // nanoseconds
+    std::atomic < uint64_t > replayed = 0;
+
+    static void encode(std::string & out, uint64_t value) { out.append((const char *)&value, sizeof(value)); }
+    static void encode(std::string & out, std::string_view value);
+
+    /// begin a record at end of pending buffer, waiting for room if needed
+    uint64_t begin_record(std::unique_lock < std::mutex > & guard);
+
+    /// fill in header of record started at begin, return its lsn
+    uint64_t finish_record(uint64_t begin, journal_op_t op);
+
+    /// write out records past mark into a new journal file and replace the old one
+    void drop_records(mark_t mark);
+
+    /// background loop
+    void run();
+
+public:
+    /// journal file, empty disables journaling
+    std::string path;
+
+    journal_durability_t durability = JOURNAL_DURABILITY_SYNC;
+
+    /// time between syncs with async durability
+    std::chrono::milliseconds interval = std::chrono::milliseconds(1000);
+
+    /// time of record being replayed, nullptr if not replaying
+    const struct timespec * replay_time = nullptr;
+
+    /// replay records past a position, then keep appending to the journal
+    /// throw error if records are missing, a torn last record is cut off
+    /** @param after lsn of the restored image, 0 without an image
+     *  @param apply applies one record **/
+    void replay(uint64_t after, const std::function < void (journal_op_t, journal_reader_t &) > & apply);
+
+    /// start writer, journal is replayed first
+    void start();
+
+    /// write out everything and stop writer
+    void stop();
+
+    /// if records are kept
+    [[nodiscard]] bool enabled() const { return running; }
+
+    /// append a record, filesystem lock must be held
+    /** @param op mutation
+     *  @param args arguments, numbers as uint64_t, strings as std::string_view
+     *  @return lsn of record, 0 if journaling is disabled **/
+    template < typename ... Args >
+    uint64_t append(journal_op_t op, const Args & ... args)
+    {
+        if (!running)
+        {
+            return 0;
+        }
+
+        std::unique_lock < std::mutex > guard(lock);
+        uint64_t begin = begin_record(guard);
+        (encode(pending, args), ...);
+        return finish_record(begin, op);
+    }
+
+    /// wait until a record is durable as durability asks for, throw error if journal cannot be written
+    /** @param lsn record to wait for, 0 returns at once **/
+    void wait(uint64_t lsn);
+
+    /// current position, records before it are in a snapshot taken now, filesystem lock must be held
+    [[nodiscard]] mark_t mark();
+
+    /// drop records before a position once a snapshot holding them is written
+    /** @param position position from mark() **/
+    void truncate(mark_t position);
+
+    /// record counts, commits and fsync waits
+    [[nodiscard]] std::string statistics();
+};
+
+/// write-ahead journal
+extern journal_t & journal;
+
+#endif //STMPFS_JOURNAL_H
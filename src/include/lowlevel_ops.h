@@ -0,0 +1,23 @@
+#ifndef STMPFS_LOWLEVEL_OPS_H
+#define STMPFS_LOWLEVEL_OPS_H
+
+/** @file
+ *
+ * This file defines the FUSE low-level frontend, keyed by inode number
+ */
+
+#include <fuse_common.h>
+
+#define LOWLEVEL_TIMEOUT    (1.0)   /* seconds kernel keeps entries, missing names and attributes */
+
+/// serve the mount through the low-level API instead of fuse_main
+/// Requests name inodes by number (see inode_table.h), so lookups, getattr,
+/// open, read and readdir go to the inode directly. Changes are still applied
+/// through the path operations of fuse_ops.h, as journal and backing directory
+/// address entries by path; the path is rebuilt from the names the kernel
+/// looked numbers up by.
+/** @param args fuse arguments, mount point and -s, -d, -f included
+ *  @return exit code **/
+int lowlevel_main(struct fuse_args * args);
+
+#endif //STMPFS_LOWLEVEL_OPS_H
@@ -7,10 +7,44 @@
  */
 
 #include <string>
+#include <string_view>
 #include <vector>
 
 typedef std::vector < std::string > pathname_t;
 
+/// Splits a path into components without copying it
+/// Empty components (from //, leading and trailing /) and . are skipped,
+/// components are views into the path, which must outlive the tokenizer.
+class path_tokenizer_t
+{
+private:
+    std::string_view rest;
+
+public:
+    /** @param path path to split **/
+    explicit path_tokenizer_t(std::string_view path) : rest(path) { }
+
+    /// get next component
+    /** @param component next component
+     *  @return false if there are no more **/
+    bool next(std::string_view & component)
+    {
+        while (!rest.empty())
+        {
+            auto end = rest.find('/');
+            component = rest.substr(0, end);
+            rest.remove_prefix(end == std::string_view::npos ? rest.size() : end + 1);
+
+            if (!component.empty() && component != ".")
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+};
+
 /// STMPFS pathname Entry
 class stmpfs_pathname_t
 {
@@ -20,9 +54,9 @@ private:
 public:
     /// create an entry link
     /// @param pathname entry
-    explicit stmpfs_pathname_t(std::string pathname);
+    explicit stmpfs_pathname_t(std::string_view pathname);
 
-    [[nodiscard]] pathname_t get_pathname() const { return pathname; }
+    [[nodiscard]] const pathname_t & get_pathname() const { return pathname; }
     [[nodiscard]] pathname_t & get_direct_pathname() { return pathname; }
 };
 
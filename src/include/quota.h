@@ -0,0 +1,55 @@
+#ifndef STMPFS_QUOTA_H
+#define STMPFS_QUOTA_H
+
+/** @file
+ *
+ * This file defines size and inode limits of the filesystem
+ */
+
+#include <cstdint>
+#include <atomic>
+#include <string>
+
+/// Usage counters and limits, like size= and nr_inodes= of tmpfs
+/// Counters are kept up to date by block and inode operations, so reading
+/// them costs nothing. Bytes are charged per data block, a block shared by
+/// several files is charged once.
+class quota_t
+{
+private:
+    std::atomic < uint64_t > used_bytes = 0;
+    std::atomic < uint64_t > used_inodes = 1;       // root
+
+public:
+    /// byte limit, 0 is unlimited
+    uint64_t max_bytes = 0;
+
+    /// inode limit, 0 is unlimited
+    uint64_t max_inodes = 0;
+
+    /// account bytes, throw error if over limit
+    /** @param size bytes to charge
+     *  @param force charge even if over limit, for operations that free more than they take **/
+    void charge_bytes(uint64_t size, bool force = false);
+
+    /// give charged bytes back
+    /** @param size bytes to uncharge **/
+    void uncharge_bytes(uint64_t size) { used_bytes -= size; }
+
+    /// account one inode, throw error if over limit
+    void charge_inode();
+
+    /// give one inode back
+    void uncharge_inode() { used_inodes--; }
+
+    [[nodiscard]] uint64_t bytes() const { return used_bytes; }
+    [[nodiscard]] uint64_t inodes() const { return used_inodes; }
+
+    /// usage against limits
+    [[nodiscard]] std::string statistics() const;
+};
+
+/// filesystem usage, never destructed so blocks can be freed during exit
+extern quota_t & quota;
+
+#endif //STMPFS_QUOTA_H
@@ -0,0 +1,110 @@
+#ifndef STMPFS_SPILL_H
+#define STMPFS_SPILL_H
+
+/** @file
+ *
+ * This file defines the spill file tier for cold data under memory pressure
+ */
+
+#include <block.h>
+#include <block_pool.h>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define SPILL_BATCH_BYTES   (8 * 1024 * 1024)       /* data written per filesystem lock round */
+#define SPILL_PSI_BYTES     (64 * 1024 * 1024)      /* data spilled per memory pressure event */
+#define SPILL_PSI_TRIGGER   "some 150000 1000000"   /* 150 ms of stall in a 1 s window */
+
+/// Writes cold blocks out to an unnamed file once memory runs low
+/// Eviction starts when block pool usage passes the high watermark (and goes
+/// on until usage is 1/8 below it), or when the kernel reports memory pressure
+/// through PSI. Blocks compression could not shrink go first, then blocks from
+/// the cold end of block LRU list. Like the compressor, blocks are collected
+/// under filesystem lock and written outside of it while a reference is held,
+/// contiguous file slots are written with one pwritev. Spilled blocks are read
+/// back on next access.
+/// Everything except start() and stop() requires filesystem lock.
+class spill_t
+{
+private:
+    int fd = -1;                        // spill file
+    int psi_fd = -1;                    // memory pressure trigger, -1 if not used
+    int wakeup_fd = -1;                 // eventfd to stop worker
+    std::thread worker;
+    std::atomic < bool > running = false;
+
+    std::vector < uint64_t > free_slots[BLOCK_CLASS_COUNT];   // offsets of freed slots per size class
+    uint64_t file_size = 0;
+    bool slots_held = false;
+    std::vector < std::pair < uint64_t, uint64_t > > held_slots;  // offset and size of slots freed while held
+
+    uint64_t spilled_blocks = 0;
+    uint64_t spilled_bytes = 0;
+    uint64_t free_slot_bytes = 0;
+    std::atomic < uint64_t > evicted_bytes = 0;
+    std::atomic < uint64_t > write_errors = 0;
+    std::atomic < uint64_t > psi_events = 0;
+    uint64_t loads = 0;
+
+    /// get a file slot for a block
+    /** @param size block size **/
+    uint64_t allocate_slot(uint64_t size);
+
+    /// give a file slot back
+    /** @param offset slot offset
+     *  @param size block size **/
+    void free_slot(uint64_t offset, uint64_t size);
+
+    /// spill cold blocks
+    /** @param target bytes to spill
+     *  @return bytes spilled **/
+    uint64_t evict(uint64_t target);
+
+    /// background loop
+    void run();
+
+public:
+    /// directory the spill file is created in, empty disables spilling
+    std::string directory;
+
+    /// block pool usage that starts eviction, 0 is 3/4 of RAM
+    uint64_t high_watermark = 0;
+
+    /// if PSI memory pressure notifications also start eviction
+    bool psi = false;
+
+    /// create spill file and start background eviction if enabled
+    void start();
+
+    /// stop background eviction
+    void stop();
+
+    /// read a spilled block back
+    /** @param block spilled block **/
+    void load(block_t * block);
+
+    /// read spilled block content into a buffer, leaving block spilled
+    /** @param block spilled block
+     *  @param buffer output of block size **/
+    void peek(const block_t * block, char * buffer) const;
+
+    /// keep freed file slots from being reused, so a forked snapshot reads the content it saw
+    void hold_slots();
+
+    /// make file slots freed since hold_slots() reusable
+    void release_slots();
+
+    /// free file slot of an unreferenced spilled block
+    /** @param block spilled block **/
+    void discard(block_t * block);
+
+    /// spill file usage and eviction activity
+    [[nodiscard]] std::string statistics();
+};
+
+/// spill file tier, never destructed so blocks can be freed during exit
+extern spill_t & spill;
+
+#endif //STMPFS_SPILL_H
@@ -7,15 +7,48 @@
  */
 
 #include <chrono>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
 #include <inode.h>
 #include <pathname_t.h>
 
+/// statistics are exposed as read-only xattrs of root directory under this prefix
+#define STATISTICS_XATTR_PREFIX "user.stmpfs."
+
+/// serializes filesystem operations against background workers
+extern std::mutex filesystem_lock;
+
 /// pathname to inode, throw error if not found
 /** @param pathname pathname to inode
  *  @param root root inode **/
 inode_t & pathname_to_inode(const stmpfs_pathname_t & pathname, inode_t & root);
 
-/// get current time
+/// full path to inode through dentry cache, throw error if not found
+/** @param path full path, starting with /
+ *  @param root root inode, always filesystem root as cached paths are absolute **/
+inode_t & pathname_to_inode(std::string_view path, inode_t & root);
+
+/// pathname to inode, without throwing if not found
+/** @param pathname pathname to inode
+ *  @param root root inode
+ *  @return inode, nullptr if not found **/
+inode_t * lookup_inode(const stmpfs_pathname_t & pathname, inode_t & root);
+
+/// full path to inode through dentry cache, without throwing if not found
+/// paths not found are cached too, so probing missing paths stays cheap, and
+/// resolving a path not cached yet splits it in place without allocating
+/** @param path full path, starting with /
+ *  @param root root inode, always filesystem root as cached paths are absolute
+ *  @return inode, nullptr if not found **/
+inode_t * lookup_inode(std::string_view path, inode_t & root);
+
+/// collect filesystem statistics
+/** @return statistics name (without STATISTICS_XATTR_PREFIX) -> report **/
+std::map < std::string, std::string > filesystem_statistics();
+
+/// get current time, or time of the journal record being replayed
 struct timespec current_time();
 
 #endif //SMNXFS_STMPFS_H
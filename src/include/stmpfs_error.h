@@ -12,8 +12,11 @@
 
 #define STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY  0xA00001    /* No such file or directory */
 #define STMPFS_ERROR_PATHNAME_ALREADY_USED      0xA00002    /* Pathname is already used in directory */
+#define STMPFS_ERROR_NO_SPACE_LEFT              0xA00003    /* No space left on filesystem */
 #define STMPFS_ERROR_CANNOT_PARSE_ARGUMENT      0xB00001    /* Cannot parse the argument */
 #define STMPFS_ERROR_EXTERNAL_LIB_ERROR         0xB00002    /* External library error */
+#define STMPFS_ERROR_CORRUPTED_IMAGE            0xB00003    /* Image file is corrupted */
+#define STMPFS_ERROR_CORRUPTED_JOURNAL          0xB00004    /* Journal is corrupted or incomplete */
 
 /// Filesystem Error
 class stmpfs_error_t : public std::exception
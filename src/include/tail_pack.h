@@ -0,0 +1,63 @@
+#ifndef STMPFS_TAIL_PACK_H
+#define STMPFS_TAIL_PACK_H
+
+/** @file
+ *
+ * This file defines tail packing of partial last extents into shared slabs
+ */
+
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#define PACKED_SLAB_SIZE    (64 * 1024)             /* 64 KiB, allocated from block pool */
+#define PACKED_TAIL_MAX     (PACKED_SLAB_SIZE / 4)  /* longer tails are left in their extent */
+#define PACKED_TAIL_ALIGN   (16)
+
+/// Packs file tails into shared slabs
+/// Tails are appended to the current slab and never moved, a slab goes
+/// back to block pool once all tails packed into it are released.
+class tail_pack_t
+{
+private:
+    struct slab_t
+    {
+        uint64_t live_tails;
+        uint64_t live_bytes;
+    };
+
+    std::mutex lock;
+    std::unordered_map < uintptr_t, slab_t > slabs;     // slab base -> slab
+    char * current = nullptr;                           // slab tails are appended to
+    uint64_t current_used = 0;
+
+    uint64_t packed_tails = 0;
+    uint64_t packed_bytes = 0;
+    uint64_t extent_bytes = 0;                          // extent size the packed tails would take
+
+public:
+    /// if tail packing is enabled for this mount
+    bool enabled = false;
+
+    /// copy a tail into a packed slab
+    /** @param tail tail data
+     *  @param length tail length, no more than PACKED_TAIL_MAX
+     *  @param extent_size size of extent the tail came from
+     *  @return packed tail **/
+    char * pack(const char * tail, uint64_t length, uint64_t extent_size);
+
+    /// release a packed tail
+    /** @param tail packed tail
+     *  @param length tail length
+     *  @param extent_size size of extent the tail came from **/
+    void release(char * tail, uint64_t length, uint64_t extent_size);
+
+    /// packing statistics, including bytes recovered
+    [[nodiscard]] std::string statistics();
+};
+
+/// tail packer, never destructed so tails can be released during exit
+extern tail_pack_t & tail_pack;
+
+#endif //STMPFS_TAIL_PACK_H
@@ -0,0 +1,698 @@
+/** @file
+ *
+ * This file implements the read-through cache mode in front of a backing directory
+ */
+
+#include <backing.h>
+#include <quota.h>
+#include <stmpfs.h>
+#include <stmpfs_error.h>
+#include <inode_table.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/sysinfo.h>
+#include <sys/uio.h>
+
+backing_t & backing = * new backing_t;
+
+/// write all of buffer at offset, return false if failed
+static bool write_all(int fd, const char * buffer, uint64_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t ret = pwrite(fd, buffer, length, (off_t)offset);
+        if (ret <= 0)
+        {
+            return false;
+        }
+
+        buffer += ret;
+        length -= ret;
+        offset += ret;
+    }
+
+    return true;
+}
+
+std::string backing_t::relative(const char * path)
+{
+    while (*path == '/')
+    {
+        path++;
+    }
+
+    return *path == 0 ? "." : path;
+}
+
+int backing_t::open_file(const std::string & path, int flags, mode_t mode) const
+{
+    int fd = openat(root_fd, path.c_str(), flags | O_CLOEXEC, mode);
+    if (fd == -1)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+
+    return fd;
+}
+
+inode_t * backing_t::load(inode_t & parent, const std::string & name, const std::string & path, const struct stat & st)
+{
+    quota.charge_inode();
+    auto * inode = new inode_t;
+    inode->charged_inode = true;
+    inode->fs_stat = st;
+    inode_table.attach(*inode);
+    inode->fs_stat.st_blocks = 0;
+    inode->listed = !S_ISDIR(st.st_mode);
+
+    try
+    {
+        if (S_ISREG(st.st_mode))
+        {
+            inode->cur_data_size = st.st_size;
+            if (inode->cur_data_size <= INLINE_DATA_SIZE)
+            {
+                // small files are read at once, into the inode itself
+                int fd = open_file(path, O_RDONLY);
+                ssize_t ret = pread(fd, inode->inline_data, inode->cur_data_size, 0);
+                close(fd);
+                if (ret < 0)
+                {
+                    throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+                }
+
+                inode->cur_data_size = ret;
+                inode->fs_stat.st_size = ret;
+            }
+            else
+            {
+                // every extent is fetched on first read
+                inode->data.resize(extent_policy.count(inode->cur_data_size), nullptr);
+            }
+        }
+        else if (S_ISLNK(st.st_mode))
+        {
+            char link[PATH_MAX];
+            ssize_t length = readlinkat(root_fd, path.c_str(), link, sizeof(link));
+            if (length < 0)
+            {
+                throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+            }
+
+            inode->fs_stat.st_size = 0;
+            inode->write(link, length, 0);
+        }
+    }
+    catch (...)
+    {
+        delete inode;
+        throw;
+    }
+
+    parent.dentry.emplace(name, dentry_t { .if_constructed_by_inode = 1, .inode = inode });
+    loaded_entries++;
+    return inode;
+}
+
+backing_t::file_t & backing_t::touch(inode_t & inode)
+{
+    auto & file = files[&inode];
+    if (file.sequence != 0)
+    {
+        lru.erase(file.sequence);
+    }
+
+    file.sequence = next_sequence++;
+    lru.emplace(file.sequence, &inode);
+    return file;
+}
+
+void backing_t::fetch_extents(const std::string & path, inode_t & inode, uint64_t first, uint64_t last)
+{
+    uint64_t size = inode.cur_data_size;
+    last = std::min(last, extent_policy.count(size));
+    if (inode.data.size() < last)
+    {
+        inode.data.resize(last, nullptr);
+    }
+
+    int fd = -1;
+    for (uint64_t index = first; index < last; )
+    {
+        if (inode.data[index] != nullptr)
+        {
+            index++;
+            continue;
+        }
+
+        // one preadv per run of missing extents, undone if it fails
+        uint64_t begin = index, length = 0;
+        std::vector < struct iovec > iov;
+
+        try
+        {
+            for (; index < last && inode.data[index] == nullptr && iov.size() < IOV_MAX; index++)
+            {
+                block_t * block = block_t::create(extent_policy.size(index));
+                uint64_t valid = std::min(block->size(), size - extent_policy.offset(index));
+                inode.data[index] = block;
+                inode.allocated_size += block->size();
+                memset(block->writable_data() + valid, 0, block->size() - valid);
+                iov.emplace_back(iovec { .iov_base = block->writable_data(), .iov_len = valid });
+                length += valid;
+            }
+
+            if (fd == -1)
+            {
+                fd = open_file(path, O_RDONLY);
+            }
+
+            ssize_t ret = preadv(fd, iov.data(), (int)iov.size(), (off_t)extent_policy.offset(begin));
+            if (ret < 0)
+            {
+                throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+            }
+
+            // backing file may have shrunk, what is missing reads as 0s
+            for (auto & i : iov)
+            {
+                uint64_t filled = std::min < uint64_t > (ret, i.iov_len);
+                memset((char *)i.iov_base + filled, 0, i.iov_len - filled);
+                ret -= (ssize_t)filled;
+            }
+        }
+        catch (...)
+        {
+            for (uint64_t i = begin; i < index; i++)
+            {
+                inode.allocated_size -= inode.data[i]->size();
+                inode.data[i]->release();
+                inode.data[i] = nullptr;
+            }
+
+            if (fd != -1)
+            {
+                close(fd);
+            }
+
+            inode.fs_stat.st_blocks = (blkcnt_t)(inode.allocated_size / 512);
+            throw;
+        }
+
+        fetches++;
+        fetched_bytes += length;
+    }
+
+    if (fd != -1)
+    {
+        close(fd);
+    }
+
+    inode.fs_stat.st_blocks = (blkcnt_t)(inode.allocated_size / 512);
+    inode.changed();
+}
+
+void backing_t::evict(uint64_t needed, const inode_t * keep, uint64_t keep_first, uint64_t keep_last)
+{
+    for (auto it = lru.begin(); it != lru.end() && quota.bytes() + needed > budget; )
+    {
+        inode_t * inode = it->second;
+        auto & file = files[inode];
+
+        // dirty extents stay until written back
+        for (uint64_t index = 0; index < inode->data.size(); index++)
+        {
+            auto & block = inode->data[index];
+            if (block != nullptr && (index >= file.dirty.size() || !file.dirty[index])
+                && (inode != keep || index < keep_first || index >= keep_last))
+            {
+                inode->allocated_size -= block->size();
+                evicted_bytes += block->size();
+                block->release();
+                block = nullptr;
+            }
+        }
+
+        inode->fs_stat.st_blocks = (blkcnt_t)(inode->allocated_size / 512);
+        inode->changed();
+
+        if (inode == keep)
+        {
+            ++it;
+            continue;
+        }
+
+        file.sequence = 0;
+        it = lru.erase(it);
+    }
+}
+
+void backing_t::write_back_file(const std::string & path, inode_t & inode, bool sync)
+{
+    auto it = files.find(&inode);
+    bool dirty = it != files.end() && std::find(it->second.dirty.begin(), it->second.dirty.end(), true) != it->second.dirty.end();
+    if (!dirty && !sync)
+    {
+        return;
+    }
+
+    int fd = open_file(path, O_WRONLY);
+    bool ok = true;
+
+    if (dirty && inode.is_inline())
+    {
+        ok = write_all(fd, inode.inline_data, inode.cur_data_size, 0);
+        written_bytes += inode.cur_data_size;
+    }
+    else if (dirty)
+    {
+        auto & flags = it->second.dirty;
+        for (uint64_t index = 0; ok && index < flags.size() && index < inode.data.size(); index++)
+        {
+            uint64_t offset = extent_policy.offset(index);
+            if (!flags[index] || inode.data[index] == nullptr || offset >= inode.cur_data_size)
+            {
+                continue;
+            }
+
+            uint64_t length = std::min(inode.data[index]->size(), inode.cur_data_size - offset);
+            ok = write_all(fd, inode.data[index]->data(), length, offset);
+            written_bytes += length;
+        }
+    }
+
+    ok = ok && (!sync || fdatasync(fd) == 0);
+    close(fd);
+
+    if (!ok)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+
+    if (dirty)
+    {
+        it->second.dirty.clear();
+        write_backs++;
+    }
+}
+
+void backing_t::write_back_tree(const std::string & path, inode_t & inode)
+{
+    if (S_ISREG(inode.fs_stat.st_mode))
+    {
+        try
+        {
+            write_back_file(path, inode, false);
+        }
+        catch (stmpfs_error_t & error)
+        {
+            std::cerr << "Cannot write back " << path << " (errno=" << error.what_errno() << ")" << std::endl;
+        }
+
+        return;
+    }
+
+    for (auto & i : inode.dentry)
+    {
+        write_back_tree(path == "." ? i.name : path + "/" + i.name, *i.dentry.inode);
+    }
+}
+
+void backing_t::start(inode_t & root)
+{
+    if (directory.empty() || enabled())
+    {
+        return;
+    }
+
+    root_fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+
+    if (budget == 0)
+    {
+        struct sysinfo _sysinfo{};
+        sysinfo(&_sysinfo);
+        budget = (uint64_t)_sysinfo.totalram * _sysinfo.mem_unit / 2;
+    }
+
+    root.listed = false;
+}
+
+void backing_t::stop(inode_t & root)
+{
+    std::lock_guard < std::mutex > guard(filesystem_lock);
+    if (!enabled())
+    {
+        return;
+    }
+
+    write_back_tree(".", root);
+    close(root_fd);
+    root_fd = -1;
+}
+
+inode_t * backing_t::lookup(inode_t & parent, const std::string & name, const std::string & path)
+{
+    auto * existing = parent.dentry.find(name);
+    if (existing != nullptr)
+    {
+        return existing->inode;
+    }
+
+    struct stat st { };
+    if (parent.listed || fstatat(root_fd, path.c_str(), &st, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        return nullptr;
+    }
+
+    return load(parent, name, path, st);
+}
+
+void backing_t::list(const char * path, inode_t & inode)
+{
+    if (!enabled() || inode.listed)
+    {
+        return;
+    }
+
+    std::string directory_path = relative(path);
+    int fd = open_file(directory_path, O_RDONLY | O_DIRECTORY);
+    DIR * dir = fdopendir(fd);
+    if (dir == nullptr)
+    {
+        close(fd);
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+
+    try
+    {
+        while (auto * entry = readdir(dir))
+        {
+            std::string name = entry->d_name;
+            struct stat st { };
+
+            // entries removed meanwhile are skipped
+            if (name == "." || name == ".." || inode.dentry.find(name) != nullptr
+                || fstatat(fd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0)
+            {
+                continue;
+            }
+
+            load(inode, name, directory_path == "." ? name : directory_path + "/" + name, st);
+        }
+    }
+    catch (...)
+    {
+        closedir(dir);
+        throw;
+    }
+
+    closedir(dir);
+    inode.listed = true;
+}
+
+void backing_t::read(const char * path, inode_t & inode, uint64_t offset, uint64_t length)
+{
+    if (!enabled() || !S_ISREG(inode.fs_stat.st_mode) || inode.is_inline() || offset >= inode.cur_data_size)
+    {
+        return;
+    }
+
+    // sequential reads double readahead, others reset it
+    auto & file = touch(inode);
+    if (offset == file.next_offset)
+    {
+        file.window = file.window == 0 ? BACKING_READAHEAD_MIN : std::min < uint64_t > (file.window * 2, BACKING_READAHEAD_MAX);
+    }
+    else
+    {
+        file.window = 0;
+    }
+
+    file.next_offset = offset + length;
+
+    uint64_t first = extent_policy.index(offset);
+    uint64_t requested = extent_policy.count(std::min(offset + length, inode.cur_data_size));
+    uint64_t last = extent_policy.count(std::min(offset + length + file.window, inode.cur_data_size));
+    uint64_t needed = 0, ahead = 0;
+    for (uint64_t index = first; index < last; index++)
+    {
+        if (index >= inode.data.size() || inode.data[index] == nullptr)
+        {
+            needed += extent_policy.size(index);
+            ahead += index >= requested ? extent_policy.size(index) : 0;
+        }
+    }
+
+    if (needed == 0)
+    {
+        return;
+    }
+
+    evict(needed, &inode, first, last);
+    fetch_extents(relative(path), inode, first, last);
+    readahead_bytes += ahead;
+}
+
+void backing_t::prepare_write(const char * path, inode_t & inode, const char * buffer, uint64_t length, uint64_t offset)
+{
+    if (!enabled() || length == 0)
+    {
+        return;
+    }
+
+    std::string file_path = relative(path);
+
+    // extents written in full need no old content
+    if (!inode.is_inline())
+    {
+        for (auto index : { extent_policy.index(offset), extent_policy.index(offset + length - 1) })
+        {
+            uint64_t begin = extent_policy.offset(index), end = begin + extent_policy.size(index);
+            if ((offset > begin || offset + length < end) && begin < inode.cur_data_size
+                && (index >= inode.data.size() || inode.data[index] == nullptr))
+            {
+                fetch_extents(file_path, inode, index, index + 1);
+            }
+        }
+    }
+
+    if (!write_back)
+    {
+        int fd = open_file(file_path, O_WRONLY);
+        bool ok = write_all(fd, buffer, length, offset);
+        close(fd);
+        if (!ok)
+        {
+            throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+        }
+
+        written_bytes += length;
+    }
+}
+
+void backing_t::commit_write(inode_t & inode, uint64_t offset, uint64_t length)
+{
+    if (!enabled() || length == 0)
+    {
+        return;
+    }
+
+    auto & file = touch(inode);
+    if (write_back)
+    {
+        uint64_t last = extent_policy.index(offset + length - 1);
+        if (file.dirty.size() <= last)
+        {
+            file.dirty.resize(last + 1, false);
+        }
+
+        for (uint64_t index = extent_policy.index(offset); index <= last; index++)
+        {
+            file.dirty[index] = true;
+        }
+    }
+
+    evict(0, &inode, extent_policy.index(offset), extent_policy.count(offset + length));
+}
+
+void backing_t::flush(const char * path, inode_t & inode, bool sync)
+{
+    if (enabled() && S_ISREG(inode.fs_stat.st_mode))
+    {
+        write_back_file(relative(path), inode, sync);
+    }
+}
+
+void backing_t::forget(const inode_t * inode)
+{
+    if (files.empty())
+    {
+        return;
+    }
+
+    auto it = files.find(inode);
+    if (it != files.end())
+    {
+        if (it->second.sequence != 0)
+        {
+            lru.erase(it->second.sequence);
+        }
+
+        files.erase(it);
+    }
+}
+
+void backing_t::mkdir(const char * path, mode_t mode)
+{
+    if (enabled() && mkdirat(root_fd, relative(path).c_str(), mode) != 0)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+void backing_t::mknod(const char * path, mode_t mode, dev_t device)
+{
+    if (enabled() && mknodat(root_fd, relative(path).c_str(), mode, device) != 0)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+void backing_t::create(const char * path, mode_t mode)
+{
+    if (enabled())
+    {
+        close(open_file(relative(path), O_WRONLY | O_CREAT | O_TRUNC, mode));
+    }
+}
+
+void backing_t::symlink(const char * path, const char * link)
+{
+    if (enabled() && symlinkat(link, root_fd, relative(path).c_str()) != 0)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+void backing_t::unlink(const char * path)
+{
+    if (enabled() && unlinkat(root_fd, relative(path).c_str(), 0) != 0)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+void backing_t::rmdir(const char * path)
+{
+    if (enabled() && unlinkat(root_fd, relative(path).c_str(), AT_REMOVEDIR) != 0)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+void backing_t::rename(const char * path, const char * new_path)
+{
+    // dirty extents belong to the inode and are written back to wherever it is by then
+    if (enabled() && renameat(root_fd, relative(path).c_str(), root_fd, relative(new_path).c_str()) != 0)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+void backing_t::chmod(const char * path, mode_t mode)
+{
+    if (enabled() && fchmodat(root_fd, relative(path).c_str(), mode & 07777, 0) != 0)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+void backing_t::chown(const char * path, uid_t uid, gid_t gid)
+{
+    if (enabled() && fchownat(root_fd, relative(path).c_str(), uid, gid, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+void backing_t::utimens(const char * path, const struct timespec time[2])
+{
+    if (enabled() && utimensat(root_fd, relative(path).c_str(), time, AT_SYMLINK_NOFOLLOW) != 0)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+void backing_t::truncate(const char * path, inode_t & inode, off_t size)
+{
+    if (!enabled())
+    {
+        return;
+    }
+
+    // dirty extents past new end would be written back too late
+    write_back_file(relative(path), inode, false);
+
+    // what is left moves back into the inode if small enough, so it has to be read first
+    if (size <= INLINE_DATA_SIZE && !inode.is_inline())
+    {
+        fetch_extents(relative(path), inode, 0, 1);
+    }
+
+    int fd = open_file(relative(path), O_WRONLY);
+    bool ok = ftruncate(fd, size) == 0;
+    close(fd);
+    if (!ok)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+void backing_t::fallocate(const char * path, inode_t & inode, int mode, off_t offset, off_t length)
+{
+    if (!enabled())
+    {
+        return;
+    }
+
+    // a punched range is fetched again as 0s, so dirty content must not come back over it
+    write_back_file(relative(path), inode, false);
+
+    int fd = open_file(relative(path), O_WRONLY);
+    bool ok = ::fallocate(fd, mode, offset, length) == 0;
+    close(fd);
+    if (!ok)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+std::string backing_t::statistics()
+{
+    std::stringstream ret;
+
+    ret << "directory=" << directory
+        << " write_back=" << write_back
+        << " budget=" << budget
+        << " used_bytes=" << quota.bytes()
+        << " cached_files=" << lru.size()
+        << " loaded_entries=" << loaded_entries
+        << " fetches=" << fetches
+        << " fetched_bytes=" << fetched_bytes
+        << " readahead_bytes=" << readahead_bytes
+        << " evicted_bytes=" << evicted_bytes
+        << " written_bytes=" << written_bytes
+        << " write_backs=" << write_backs;
+
+    return ret.str();
+}
@@ -0,0 +1,220 @@
+/** @file
+ *
+ * This file implements reference counted, copy-on-write data blocks
+ */
+
+#include <block.h>
+#include <block_pool.h>
+#include <tail_pack.h>
+#include <compressor.h>
+#include <dedup.h>
+#include <quota.h>
+#include <spill.h>
+#include <cstring>
+
+block_list_t block_t::lru;
+block_list_t block_t::incompressible;
+
+block_t::block_t(uint64_t size) : block_size(size), block_data(block_pool.allocate(size))
+{
+    last_access = std::chrono::steady_clock::now();
+    list_insert(lru);
+}
+
+block_t::block_t(const char * tail, uint64_t length, uint64_t size)
+    : block_size(size), packed_length(length), block_data(tail_pack.pack(tail, length, size))
+{
+    last_access = std::chrono::steady_clock::now();
+}
+
+block_t::~block_t()
+{
+    quota.uncharge_bytes(charged_size());
+    list_remove();
+    if (fingerprinted)
+    {
+        dedup.forget(this);
+    }
+}
+
+uint64_t block_t::charged_size() const
+{
+    if (mapped)
+    {
+        return 0;
+    }
+
+    return packed() ? (packed_length + PACKED_TAIL_ALIGN - 1) & ~(uint64_t)(PACKED_TAIL_ALIGN - 1) : block_size;
+}
+
+block_t * block_t::create(uint64_t size)
+{
+    quota.charge_bytes(size);
+    try
+    {
+        return new block_t(size);
+    }
+    catch (...)
+    {
+        quota.uncharge_bytes(size);
+        throw;
+    }
+}
+
+block_t * block_t::create_packed(const char * tail, uint64_t length, uint64_t size)
+{
+    // packing replaces a full extent, so it is never refused
+    auto * block = new block_t(tail, length, size);
+    quota.charge_bytes(block->charged_size(), true);
+    return block;
+}
+
+block_t * block_t::create_mapped(const char * content, uint64_t length, uint64_t size)
+{
+    // base image is never written, copy-up replaces the block first
+    auto * block = new block_t(const_cast < char * > (content), size);
+    block->packed_length = length == size ? 0 : length;
+    return block;
+}
+
+void block_t::list_insert(block_list_t & target)
+{
+    list_remove();
+
+    list_prev = nullptr;
+    list_next = target.head;
+    (target.head != nullptr ? target.head->list_prev : target.tail) = this;
+    target.head = this;
+    list = &target;
+}
+
+void block_t::list_remove()
+{
+    if (list == nullptr)
+    {
+        return;
+    }
+
+    (list_prev != nullptr ? list_prev->list_next : list->head) = list_next;
+    (list_next != nullptr ? list_next->list_prev : list->tail) = list_prev;
+    list_prev = list_next = nullptr;
+    list = nullptr;
+}
+
+void block_t::forget_fingerprint()
+{
+    dedup.forget(this);
+}
+
+void block_t::touch()
+{
+    if (packed() || mapped)
+    {
+        return;
+    }
+
+    if (compressed())
+    {
+        compressor.decompress(this);
+    }
+    else if (spilled())
+    {
+        spill.load(this);
+    }
+
+    last_access = std::chrono::steady_clock::now();
+
+    // move to head
+    if (lru.head != this)
+    {
+        list_insert(lru);
+    }
+}
+
+void block_t::read_content(char * buffer) const
+{
+    if (compressed())
+    {
+        compressor.peek(this, buffer);
+    }
+    else if (spilled())
+    {
+        spill.peek(this, buffer);
+    }
+    else
+    {
+        memcpy(buffer, block_data, valid_length());
+    }
+}
+
+void block_t::free_data()
+{
+    if (mapped)
+    {
+        // unmapped with the process
+    }
+    else if (packed())
+    {
+        tail_pack.release(block_data, packed_length, block_size);
+    }
+    else if (compressed())
+    {
+        compressor.discard(this);
+    }
+    else if (spilled())
+    {
+        spill.discard(this);
+    }
+    else
+    {
+        block_pool.deallocate(block_data, block_size);
+    }
+}
+
+void block_t::release()
+{
+    if (--refcount == 0)
+    {
+        free_data();
+        delete this;
+    }
+}
+
+void block_t::release(const std::vector < block_t * > & blocks)
+{
+    std::vector < std::pair < char *, uint64_t > > unreferenced;
+
+    for (auto block : blocks)
+    {
+        if (block != nullptr && --block->refcount == 0)
+        {
+            if (block->packed() || block->mapped || block->block_data == nullptr)
+            {
+                block->free_data();
+            }
+            else
+            {
+                unreferenced.emplace_back(block->block_data, block->block_size);
+            }
+
+            delete block;
+        }
+    }
+
+    block_pool.deallocate(unreferenced);
+}
+
+char * block_for_write(block_t * & block)
+{
+    if (block->shared() || block->packed() || block->is_mapped())
+    {
+        uint64_t length = block->valid_length();
+        block_t * copy = block_t::create(block->size());
+        memcpy(copy->writable_data(), block->data(), length);
+        memset(copy->writable_data() + length, 0, block->size() - length);
+        block->release();
+        block = copy;
+    }
+
+    return block->writable_data();
+}
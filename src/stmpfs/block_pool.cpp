@@ -0,0 +1,371 @@
+/** @file
+ *
+ * This file implements the slab allocator for file data blocks
+ */
+
+#include <block_pool.h>
+#include <stmpfs_error.h>
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <sstream>
+#include <sys/mman.h>
+
+#define THREAD_CACHE_BYTES  (4 * 1024 * 1024)   /* per size class */
+#define THREAD_CACHE_MIN    (4)                 /* blocks per size class */
+
+block_pool_t & block_pool = * new block_pool_t;
+
+/// per-thread free lists in front of the shared slabs
+struct block_thread_cache_t
+{
+    std::vector < char * > blocks[BLOCK_CLASS_COUNT];
+
+    static uint64_t limit(unsigned int size_class)
+    {
+        return std::max < uint64_t > (THREAD_CACHE_MIN, THREAD_CACHE_BYTES >> size_class);
+    }
+
+    ~block_thread_cache_t();
+};
+
+static thread_local block_thread_cache_t thread_cache;
+static thread_local bool thread_cache_destroyed = false;
+
+block_thread_cache_t::~block_thread_cache_t()
+{
+    std::lock_guard < std::mutex > guard(block_pool.lock);
+    for (unsigned int i = 0; i < BLOCK_CLASS_COUNT; i++)
+    {
+        for (auto block : blocks[i])
+        {
+            block_pool.return_block(block);
+        }
+
+        block_pool.cached_bytes -= blocks[i].size() << i;
+    }
+
+    thread_cache_destroyed = true;
+}
+
+/// map anonymous memory aligned to SLAB_SIZE, nullptr if failed
+/** @param size mapping size, multiple of SLAB_SIZE
+ *  @param flags extra mmap flags **/
+static char * map_aligned(uint64_t size, int flags)
+{
+    // huge page mappings are aligned by kernel, others are over-mapped and trimmed
+    uint64_t slack = (flags & MAP_HUGETLB) ? 0 : SLAB_SIZE;
+    void * map = mmap(nullptr, size + slack, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | flags, -1, 0);
+    if (map == MAP_FAILED)
+    {
+        return nullptr;
+    }
+
+    auto * base = (char *)(((uintptr_t)map + slack) & ~(uintptr_t)(SLAB_SIZE - 1));
+    if (slack != 0)
+    {
+        if (base != map)
+        {
+            munmap(map, base - (char *)map);
+        }
+
+        if (base + size != (char *)map + size + slack)
+        {
+            munmap(base + size, (char *)map + size + slack - (base + size));
+        }
+
+        madvise(base, size, MADV_HUGEPAGE);
+    }
+
+    return base;
+}
+
+char * block_pool_t::map_slab(uint64_t size)
+{
+    if (backing == POOL_BACKING_HEAP)
+    {
+        auto * base = (char *)aligned_alloc(SLAB_SIZE, size);
+        if (base == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        return base;
+    }
+
+    // blocks larger than a slab get a mapping of their own
+    if (size > SLAB_SIZE)
+    {
+        char * base = map_aligned(size, 0);
+        if (base == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        return base;
+    }
+
+    if (!retained.empty())
+    {
+        char * base = retained.back();
+        retained.pop_back();
+        return base;
+    }
+
+    if (arena_next == arena_end)
+    {
+        char * arena = nullptr;
+        if (backing == POOL_BACKING_EXPLICIT)
+        {
+            arena = map_aligned(ARENA_SIZE, MAP_HUGETLB);
+            explicit_arenas += arena != nullptr;
+        }
+
+        if (arena == nullptr)
+        {
+            arena = map_aligned(ARENA_SIZE, 0);
+        }
+
+        if (arena == nullptr)
+        {
+            throw std::bad_alloc();
+        }
+
+        arena_next = arena;
+        arena_end = arena + ARENA_SIZE;
+        arena_bytes += ARENA_SIZE;
+    }
+
+    char * base = arena_next;
+    arena_next += SLAB_SIZE;
+    return base;
+}
+
+void block_pool_t::unmap_slab(char * base, uint64_t size)
+{
+    if (backing == POOL_BACKING_HEAP)
+    {
+        free(base);
+    }
+    else if (size > SLAB_SIZE)
+    {
+        munmap(base, size);
+    }
+    else
+    {
+        // keep address range inside arena, drop its pages
+        madvise(base, size, MADV_DONTNEED);
+        retained.emplace_back(base);
+    }
+}
+
+block_pool_t::slab_t & block_pool_t::new_slab(unsigned int size_class)
+{
+    uint64_t block_size = 1ULL << size_class;
+    uint64_t size = std::max < uint64_t > (block_size, SLAB_SIZE);
+    char * base = map_slab(size);
+
+    slab_t slab {
+        .base = base,
+        .size = size,
+        .block_size = block_size,
+        .carved = 0,
+        .used = 0,
+        .free_list = nullptr,
+    };
+
+    slab_bytes += size;
+    auto & ret = slabs.emplace((uintptr_t)base, slab).first->second;
+    classes[size_class].partial.emplace_back(&ret);
+    return ret;
+}
+
+void block_pool_t::take_blocks(unsigned int size_class, std::vector < char * > & blocks, uint64_t count)
+{
+    auto & partial = classes[size_class].partial;
+    global_used_bytes += count << size_class;
+
+    while (count > 0)
+    {
+        slab_t & slab = partial.empty() ? new_slab(size_class) : *partial.back();
+        uint64_t capacity = slab.size / slab.block_size;
+
+        // recycled blocks first, then untouched memory
+        while (count > 0 && slab.free_list != nullptr)
+        {
+            char * block = slab.free_list;
+            slab.free_list = *(char **)block;
+            blocks.emplace_back(block);
+            slab.used++;
+            count--;
+        }
+
+        while (count > 0 && slab.carved < capacity)
+        {
+            blocks.emplace_back(slab.base + slab.carved * slab.block_size);
+            slab.carved++;
+            slab.used++;
+            count--;
+        }
+
+        if (slab.used == capacity)
+        {
+            partial.pop_back();
+        }
+    }
+}
+
+void block_pool_t::return_block(char * block)
+{
+    auto it = slabs.find((uintptr_t)block & ~(uintptr_t)(SLAB_SIZE - 1));
+    slab_t & slab = it->second;
+    unsigned int size_class = std::countr_zero(slab.block_size);
+    auto & partial = classes[size_class].partial;
+    uint64_t capacity = slab.size / slab.block_size;
+
+    if (slab.used == capacity)
+    {
+        partial.emplace_back(&slab);
+    }
+
+    *(char **)block = slab.free_list;
+    slab.free_list = block;
+    slab.used--;
+    global_used_bytes -= slab.block_size;
+
+    // release empty slab
+    if (slab.used == 0)
+    {
+        partial.erase(std::find(partial.begin(), partial.end(), &slab));
+        slab_bytes -= slab.size;
+        unmap_slab(slab.base, slab.size);
+        slabs.erase(it);
+    }
+}
+
+char * block_pool_t::allocate(uint64_t size)
+{
+    if (!std::has_single_bit(size) || size < sizeof(char *))
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_CANNOT_PARSE_ARGUMENT);
+    }
+
+    unsigned int size_class = std::countr_zero(size);
+
+    if (thread_cache_destroyed)
+    {
+        std::vector < char * > block;
+        std::lock_guard < std::mutex > guard(lock);
+        take_blocks(size_class, block, 1);
+        return block.front();
+    }
+
+    auto & cache = thread_cache.blocks[size_class];
+    if (cache.empty())
+    {
+        // refill half of the cache
+        std::lock_guard < std::mutex > guard(lock);
+        uint64_t count = block_thread_cache_t::limit(size_class) / 2 + 1;
+        take_blocks(size_class, cache, count);
+        cached_bytes += count << size_class;
+    }
+
+    char * block = cache.back();
+    cache.pop_back();
+    cached_bytes -= size;
+    return block;
+}
+
+void block_pool_t::deallocate(char * block, uint64_t size)
+{
+    unsigned int size_class = std::countr_zero(size);
+
+    if (thread_cache_destroyed)
+    {
+        std::lock_guard < std::mutex > guard(lock);
+        return_block(block);
+        return;
+    }
+
+    auto & cache = thread_cache.blocks[size_class];
+    cache.emplace_back(block);
+    cached_bytes += size;
+
+    if (cache.size() > block_thread_cache_t::limit(size_class))
+    {
+        // flush half of the cache
+        std::lock_guard < std::mutex > guard(lock);
+        uint64_t count = cache.size() / 2;
+        for (uint64_t i = 0; i < count; i++)
+        {
+            return_block(cache.back());
+            cache.pop_back();
+        }
+
+        cached_bytes -= count << size_class;
+    }
+}
+
+void block_pool_t::deallocate(const std::vector < std::pair < char *, uint64_t > > & blocks)
+{
+    auto it = blocks.begin();
+
+    // top up thread caches first
+    if (!thread_cache_destroyed)
+    {
+        for (; it != blocks.end(); it++)
+        {
+            unsigned int size_class = std::countr_zero(it->second);
+            auto & cache = thread_cache.blocks[size_class];
+            if (cache.size() >= block_thread_cache_t::limit(size_class))
+            {
+                break;
+            }
+
+            cache.emplace_back(it->first);
+            cached_bytes += it->second;
+        }
+    }
+
+    if (it == blocks.end())
+    {
+        return;
+    }
+
+    std::lock_guard < std::mutex > guard(lock);
+    for (; it != blocks.end(); it++)
+    {
+        return_block(it->first);
+    }
+}
+
+uint64_t block_pool_t::used_bytes()
+{
+    std::lock_guard < std::mutex > guard(lock);
+    return global_used_bytes;
+}
+
+std::string block_pool_t::statistics()
+{
+    std::lock_guard < std::mutex > guard(lock);
+    std::stringstream ret;
+    uint64_t thread_cached_bytes = std::min < uint64_t > (cached_bytes, global_used_bytes);
+    uint64_t used_bytes = global_used_bytes - thread_cached_bytes;
+    uint64_t free_bytes = slab_bytes - global_used_bytes;
+
+    static const char * backing_name[] = { "heap", "madvise", "explicit" };
+
+    ret << "backing=" << backing_name[backing]
+        << " arena_bytes=" << arena_bytes
+        << " explicit_arenas=" << explicit_arenas
+        << " retained_slabs=" << retained.size()
+        << " slabs=" << slabs.size()
+        << " slab_bytes=" << slab_bytes
+        << " used_bytes=" << used_bytes
+        << " cached_bytes=" << thread_cached_bytes
+        << " free_bytes=" << free_bytes
+        << " fill=" << (slab_bytes ? used_bytes * 100 / slab_bytes : 0) << "%"
+        << " fragmentation=" << (slab_bytes ? free_bytes * 100 / slab_bytes : 0) << "%";
+
+    return ret.str();
+}
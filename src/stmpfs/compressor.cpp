@@ -0,0 +1,252 @@
+/** @file
+ *
+ * This file implements background compression of cold data blocks
+ */
+
+#include <compressor.h>
+#include <block_pool.h>
+#include <stmpfs.h>
+#include <stmpfs_error.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <vector>
+
+#ifdef STMPFS_HAVE_LZ4
+# include <lz4.h>
+# define CODEC_NAME "lz4"
+#else // STMPFS_HAVE_LZ4
+# include <zlib.h>
+# define CODEC_NAME "zlib"
+#endif // STMPFS_HAVE_LZ4
+
+compressor_t & compressor = * new compressor_t;
+
+/// compress length bytes, return compressed length or 0 if not worth it
+static uint64_t codec_compress(const char * source, uint64_t length, std::vector < char > & output)
+{
+    // keep blocks that do not shrink by at least 1/8 raw
+    uint64_t limit = length - length / 8;
+
+#ifdef STMPFS_HAVE_LZ4
+    output.resize(LZ4_compressBound((int)length));
+    int ret = LZ4_compress_default(source, output.data(), (int)length, (int)output.size());
+    uint64_t compressed_length = ret > 0 ? ret : 0;
+#else // STMPFS_HAVE_LZ4
+    output.resize(compressBound(length));
+    uLongf compressed_length = output.size();
+    if (compress2((Bytef *)output.data(), &compressed_length,
+                  (const Bytef *)source, length, Z_BEST_SPEED) != Z_OK)
+    {
+        compressed_length = 0;
+    }
+#endif // STMPFS_HAVE_LZ4
+
+    return compressed_length <= limit ? compressed_length : 0;
+}
+
+/// decompress into exactly length bytes, return false if data is corrupted
+static bool codec_decompress(const char * source, uint64_t source_length, char * output, uint64_t length)
+{
+#ifdef STMPFS_HAVE_LZ4
+    return LZ4_decompress_safe(source, output, (int)source_length, (int)length) == (int)length;
+#else // STMPFS_HAVE_LZ4
+    uLongf output_length = length;
+    return uncompress((Bytef *)output, &output_length, (const Bytef *)source, source_length) == Z_OK
+        && output_length == length;
+#endif // STMPFS_HAVE_LZ4
+}
+
+void compressor_t::compress_cold()
+{
+    auto now = std::chrono::steady_clock::now();
+    std::vector < char > output;
+
+    while (true)
+    {
+        struct candidate_t
+        {
+            block_t * block;
+            std::chrono::steady_clock::time_point last_access;
+            std::unique_ptr < char[] > compressed;
+            uint64_t length;
+        };
+
+        std::vector < candidate_t > batch;
+
+        // hold a reference, so block content does not change while compressing
+        {
+            std::lock_guard < std::mutex > guard(filesystem_lock);
+            for (auto block = block_t::lru.tail;
+                 block != nullptr && batch.size() < COMPRESS_BATCH && now - block->last_access >= cold_age;
+                 block = block->list_prev)
+            {
+                // skip blocks being spilled
+                if (!block->busy)
+                {
+                    block->busy = true;
+                    batch.emplace_back(candidate_t { block->share(), block->last_access, nullptr, 0 });
+                }
+            }
+        }
+
+        if (batch.empty())
+        {
+            return;
+        }
+
+        for (auto & i : batch)
+        {
+            i.length = codec_compress(i.block->block_data, i.block->size(), output);
+            if (i.length != 0)
+            {
+                i.compressed = std::make_unique < char[] > (i.length);
+                memcpy(i.compressed.get(), output.data(), i.length);
+            }
+        }
+
+        {
+            std::lock_guard < std::mutex > guard(filesystem_lock);
+            for (auto & i : batch)
+            {
+                // skip blocks used meanwhile or left only to us
+                i.block->busy = false;
+                if (i.block->shared() && i.block->last_access == i.last_access)
+                {
+                    if (i.compressed != nullptr)
+                    {
+                        block_pool.deallocate(i.block->block_data, i.block->size());
+                        i.block->block_data = nullptr;
+                        i.block->compressed_data = i.compressed.release();
+                        i.block->compressed_length = i.length;
+                        compressed_blocks++;
+                        raw_bytes += i.block->size();
+                        compressed_bytes += i.length;
+                        i.block->list_remove();
+                    }
+                    else
+                    {
+                        // left for spill file, compression is not tried again until next access
+                        i.block->list_insert(block_t::incompressible);
+                    }
+                }
+
+                i.block->release();
+            }
+        }
+
+        if (batch.size() < COMPRESS_BATCH)
+        {
+            return;
+        }
+    }
+}
+
+void compressor_t::run()
+{
+    // check a few times per age
+    auto interval = std::max < std::chrono::seconds > (cold_age / 4, std::chrono::seconds(1));
+    std::unique_lock < std::mutex > guard(lock);
+
+    while (running)
+    {
+        wakeup.wait_for(guard, interval);
+        if (!running)
+        {
+            break;
+        }
+
+        guard.unlock();
+        compress_cold();
+        guard.lock();
+    }
+}
+
+void compressor_t::start()
+{
+    if (cold_age.count() == 0 || running)
+    {
+        return;
+    }
+
+    running = true;
+    worker = std::thread(&compressor_t::run, this);
+}
+
+void compressor_t::stop()
+{
+    {
+        std::lock_guard < std::mutex > guard(lock);
+        if (!running)
+        {
+            return;
+        }
+
+        running = false;
+    }
+
+    wakeup.notify_all();
+    worker.join();
+}
+
+void compressor_t::decompress(block_t * block)
+{
+    auto begin = std::chrono::steady_clock::now();
+    char * data = block_pool.allocate(block->size());
+
+    if (!codec_decompress(block->compressed_data, block->compressed_length, data, block->size()))
+    {
+        block_pool.deallocate(data, block->size());
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+
+    discard(block);
+    block->block_data = data;
+
+    auto time = (uint64_t)std::chrono::duration_cast < std::chrono::nanoseconds >
+            (std::chrono::steady_clock::now() - begin).count();
+    decompressions++;
+    decompress_time += time;
+    if (time > decompress_time_max)
+    {
+        decompress_time_max = time;
+    }
+}
+
+void compressor_t::peek(const block_t * block, char * buffer)
+{
+    if (!codec_decompress(block->compressed_data, block->compressed_length, buffer, block->size()))
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+void compressor_t::discard(block_t * block)
+{
+    compressed_blocks--;
+    raw_bytes -= block->size();
+    compressed_bytes -= block->compressed_length;
+
+    delete[] block->compressed_data;
+    block->compressed_data = nullptr;
+    block->compressed_length = 0;
+}
+
+std::string compressor_t::statistics()
+{
+    std::stringstream ret;
+    uint64_t raw = raw_bytes, compressed = compressed_bytes, count = decompressions;
+
+    ret << "codec=" CODEC_NAME
+        << " cold_age=" << cold_age.count() << "s"
+        << " compressed_blocks=" << compressed_blocks
+        << " raw_bytes=" << raw
+        << " compressed_bytes=" << compressed
+        << " ratio=" << (compressed ? (double)raw / (double)compressed : 0)
+        << " decompressions=" << count
+        << " decompress_avg=" << (count ? decompress_time / count : 0) << "ns"
+        << " decompress_max=" << decompress_time_max << "ns";
+
+    return ret.str();
+}
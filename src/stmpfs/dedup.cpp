@@ -0,0 +1,250 @@
+/** @file
+ *
+ * This file implements block-level content deduplication
+ */
+
+#include <dedup.h>
+#include <inode.h>
+#include <inode_table.h>
+#include <stmpfs.h>
+#include <algorithm>
+#include <bit>
+#include <cstring>
+#include <sstream>
+
+dedup_t & dedup = * new dedup_t;
+
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+
+/// one lane round of fingerprint
+static inline uint64_t fingerprint_round(uint64_t lane, uint64_t input)
+{
+    lane += input * PRIME64_2;
+    lane = std::rotl(lane, 31);
+    return lane * PRIME64_1;
+}
+
+/// 64-bit fingerprint over four independent lanes, size must be a multiple of 32
+/** @param data block data
+ *  @param size block size **/
+static uint64_t fingerprint(const char * data, uint64_t size)
+{
+    uint64_t lane[4] = { PRIME64_1 + PRIME64_2, PRIME64_2, 0, 0 - PRIME64_1 };
+
+    for (uint64_t offset = 0; offset < size; offset += sizeof(lane))
+    {
+        uint64_t input[4];
+        memcpy(input, data + offset, sizeof(input));
+        for (int i = 0; i < 4; i++)
+        {
+            lane[i] = fingerprint_round(lane[i], input[i]);
+        }
+    }
+
+    uint64_t hash = std::rotl(lane[0], 1) + std::rotl(lane[1], 7) + std::rotl(lane[2], 12) + std::rotl(lane[3], 18);
+
+    // blocks of different sizes never match
+    hash ^= size * PRIME64_3;
+    hash ^= hash >> 33;
+    hash *= PRIME64_2;
+    hash ^= hash >> 29;
+    hash *= PRIME64_3;
+    hash ^= hash >> 32;
+
+    return hash;
+}
+
+const char * dedup_t::peek(block_t * block, std::vector < char > & buffer)
+{
+    if (block->block_data != nullptr)
+    {
+        return block->block_data;
+    }
+
+    buffer.resize(block->size());
+    block->read_content(buffer.data());
+    return buffer.data();
+}
+
+uint64_t dedup_t::deduplicate(block_t * & block)
+{
+    if (block == nullptr || block->indexed || block->packed())
+    {
+        return 0;
+    }
+
+    uint64_t hashed = 0;
+    const char * content = nullptr;
+    if (!block->fingerprinted)
+    {
+        content = peek(block, block_buffer);
+        block->fingerprint = fingerprint(content, block->size());
+        block->fingerprinted = true;
+        hashed = block->size();
+        hashed_bytes += hashed;
+    }
+
+    auto it = index.find(block->fingerprint);
+    if (it == index.end())
+    {
+        index.emplace(block->fingerprint, block);
+        block->indexed = true;
+        return hashed;
+    }
+
+    block_t * canonical = it->second;
+    if (canonical == block || canonical->size() != block->size())
+    {
+        return hashed;
+    }
+
+    if (content == nullptr)
+    {
+        content = peek(block, block_buffer);
+    }
+
+    if (memcmp(peek(canonical, canonical_buffer), content, block->size()) == 0)
+    {
+        merged_blocks++;
+        merged_bytes += block->size();
+        canonical->merges++;
+        block->release();
+        block = canonical->share();
+    }
+
+    return hashed + block->size();
+}
+
+void dedup_t::forget(block_t * block)
+{
+    if (block->indexed)
+    {
+        index.erase(block->fingerprint);
+        block->indexed = false;
+        block->merges = 0;
+    }
+
+    block->fingerprinted = false;
+}
+
+void dedup_t::scan()
+{
+    // position of next block, inodes created or destroyed in between are fine
+    uint64_t number = INODE_TABLE_ROOT;
+    uint64_t extent = 0;
+
+    while (true)
+    {
+        {
+            std::lock_guard < std::mutex > guard(filesystem_lock);
+            uint64_t hashed = 0, visited = 0;
+
+            while (hashed < DEDUP_SCAN_BUDGET && visited < DEDUP_SCAN_BLOCKS && number < inode_table.size())
+            {
+                visited++;
+
+                inode_t * inode = inode_table.find(number);
+                if (inode == nullptr || !S_ISREG(inode->fs_stat.st_mode) || extent >= inode->data.size())
+                {
+                    number++;
+                    extent = 0;
+                    continue;
+                }
+
+                // a shared extent is saved once by the next snapshot, see image.h
+                auto & block = inode->data[extent++];
+                auto * before = block;
+                hashed += deduplicate(block);
+                if (block != before)
+                {
+                    inode->changed();
+                }
+            }
+
+            if (number >= inode_table.size())
+            {
+                scans++;
+                return;
+            }
+        }
+
+        std::unique_lock < std::mutex > guard(lock);
+        if (!running)
+        {
+            return;
+        }
+    }
+}
+
+void dedup_t::run()
+{
+    std::unique_lock < std::mutex > guard(lock);
+
+    while (running)
+    {
+        guard.unlock();
+        scan();
+        guard.lock();
+
+        if (running)
+        {
+            wakeup.wait_for(guard, scan_interval);
+        }
+    }
+}
+
+void dedup_t::start()
+{
+    if (!enabled || scan_interval.count() == 0 || running)
+    {
+        return;
+    }
+
+    running = true;
+    worker = std::thread(&dedup_t::run, this);
+}
+
+void dedup_t::stop()
+{
+    {
+        std::lock_guard < std::mutex > guard(lock);
+        if (!running)
+        {
+            return;
+        }
+
+        running = false;
+    }
+
+    wakeup.notify_all();
+    worker.join();
+}
+
+std::string dedup_t::statistics()
+{
+    std::stringstream ret;
+    uint64_t indexed_bytes = 0, shared_bytes = 0;
+
+    // references taken by merges and still held are memory saved, copies and clones share on their own
+    for (auto & i : index)
+    {
+        uint64_t references = i.second->refcount;
+        indexed_bytes += i.second->size();
+        shared_bytes += std::min < uint64_t > (i.second->merges, references - 1) * i.second->size();
+    }
+
+    ret << "enabled=" << enabled
+        << " scan_interval=" << scan_interval.count() << "s"
+        << " scans=" << scans
+        << " indexed_blocks=" << index.size()
+        << " indexed_bytes=" << indexed_bytes
+        << " shared_bytes=" << shared_bytes
+        << " ratio=" << (indexed_bytes ? (double)(indexed_bytes + shared_bytes) / (double)indexed_bytes : 0)
+        << " hashed_bytes=" << hashed_bytes
+        << " merged_blocks=" << merged_blocks
+        << " merged_bytes=" << merged_bytes;
+
+    return ret.str();
+}
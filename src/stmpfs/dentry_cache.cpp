@@ -0,0 +1,131 @@
+/** @file
+ *
+ * This file implements the full path lookup cache in front of pathname_to_inode
+ */
+
+#include <dentry_cache.h>
+#include <inode.h>
+#include <sstream>
+
+dentry_cache_t & dentry_cache = * new dentry_cache_t;
+
+bool dentry_cache_t::find(std::string_view path, inode_t * & inode)
+{
+    auto it = entries.find(path);
+    if (it == entries.end())
+    {
+        misses++;
+        return false;
+    }
+
+    inode = it->second;
+    (inode == nullptr ? negative_hits : hits)++;
+    return true;
+}
+
+void dentry_cache_t::insert(std::string_view path, inode_t * inode)
+{
+    if (entries.size() >= DENTRY_CACHE_ENTRIES)
+    {
+        clear();
+    }
+
+    if (!entries.emplace(path, inode).second)
+    {
+        return;
+    }
+
+    if (inode == nullptr)
+    {
+        negative_entries++;
+    }
+    else
+    {
+        inode->cached_paths++;
+    }
+}
+
+void dentry_cache_t::erase(entry_map_t::iterator it)
+{
+    if (it->second == nullptr)
+    {
+        negative_entries--;
+    }
+    else
+    {
+        it->second->cached_paths--;
+    }
+
+    entries.erase(it);
+    invalidations++;
+}
+
+void dentry_cache_t::invalidate(std::string_view path, bool below)
+{
+    auto it = entries.find(path);
+    if (it != entries.end())
+    {
+        erase(it);
+    }
+
+    if (!below)
+    {
+        return;
+    }
+
+    // paths below are not linked to the directory, so all of them are checked
+    for (it = entries.begin(); it != entries.end(); )
+    {
+        auto next = std::next(it);
+        if (it->first.size() > path.size() && it->first[path.size()] == '/' && it->first.starts_with(path))
+        {
+            erase(it);
+        }
+
+        it = next;
+    }
+}
+
+void dentry_cache_t::clear()
+{
+    if (entries.empty())
+    {
+        return;
+    }
+
+    for (auto & i : entries)
+    {
+        if (i.second != nullptr)
+        {
+            i.second->cached_paths = 0;
+        }
+    }
+
+    entries.clear();
+    negative_entries = 0;
+    resets++;
+}
+
+void dentry_cache_t::forget(const inode_t * inode)
+{
+    // an inode replaced in place or removed along with its directory is still cached
+    if (inode->cached_paths != 0)
+    {
+        clear();
+    }
+}
+
+std::string dentry_cache_t::statistics()
+{
+    std::stringstream ret;
+
+    ret << "entries=" << entries.size()
+        << " negative_entries=" << negative_entries
+        << " hits=" << hits
+        << " negative_hits=" << negative_hits
+        << " misses=" << misses
+        << " invalidations=" << invalidations
+        << " resets=" << resets;
+
+    return ret.str();
+}
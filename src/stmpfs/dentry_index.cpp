@@ -0,0 +1,195 @@
+/** @file
+ *
+ * This file implements the directory entry index of an inode
+ */
+
+#include <dentry_index.h>
+#include <algorithm>
+#include <functional>
+
+uint64_t dentry_index_t::hash_of(std::string_view name)
+{
+    return std::hash < std::string_view > { }(name);
+}
+
+uint64_t dentry_index_t::position(std::string_view name, uint64_t hash) const
+{
+    if (table.empty())
+    {
+        for (uint64_t index = 0; index < entries.size(); index++)
+        {
+            auto & entry = entries[index];
+            if (entry.hash == hash && entry.dentry.inode != nullptr && entry.name == name)
+            {
+                return index;
+            }
+        }
+
+        return entries.size();
+    }
+
+    uint64_t mask = table.size() - 1;
+    auto tag = (uint32_t)(hash >> 32);
+    for (uint64_t slot = hash & mask; table[slot].index != 0; slot = (slot + 1) & mask)
+    {
+        if (table[slot].tag == tag && entries[table[slot].index - 1].name == name)
+        {
+            return table[slot].index - 1;
+        }
+    }
+
+    return entries.size();
+}
+
+void dentry_index_t::table_insert(uint64_t index)
+{
+    uint64_t mask = table.size() - 1;
+    uint64_t slot = entries[index].hash & mask;
+    while (table[slot].index != 0)
+    {
+        slot = (slot + 1) & mask;
+    }
+
+    table[slot] = slot_t { .index = (uint32_t)(index + 1), .tag = (uint32_t)(entries[index].hash >> 32) };
+}
+
+void dentry_index_t::table_erase(uint64_t index)
+{
+    uint64_t mask = table.size() - 1;
+    uint64_t hole = entries[index].hash & mask;
+    while (table[hole].index != index + 1)
+    {
+        hole = (hole + 1) & mask;
+    }
+
+    // move back every following entry that may sit in the hole, so probes never stop early
+    for (uint64_t slot = (hole + 1) & mask; table[slot].index != 0; slot = (slot + 1) & mask)
+    {
+        uint64_t home = entries[table[slot].index - 1].hash & mask;
+        if (((slot - home) & mask) >= ((slot - hole) & mask))
+        {
+            table[hole] = table[slot];
+            hole = slot;
+        }
+    }
+
+    table[hole] = slot_t { .index = 0, .tag = 0 };
+}
+
+void dentry_index_t::rebuild()
+{
+    table.clear();
+    if (live <= DENTRY_INDEX_LINEAR_MAX)
+    {
+        return;
+    }
+
+    // at most half full, counting room to grow to twice the entries
+    uint64_t capacity = 1;
+    while (capacity < entries.size() * 2)
+    {
+        capacity *= 2;
+    }
+
+    table.resize(capacity, slot_t { .index = 0, .tag = 0 });
+    for (uint64_t index = 0; index < entries.size(); index++)
+    {
+        if (entries[index].dentry.inode != nullptr)
+        {
+            table_insert(index);
+        }
+    }
+}
+
+void dentry_index_t::compact()
+{
+    uint64_t removed = entries.size() - live;
+    if (removed < DENTRY_INDEX_COMPACT_MIN || removed <= live)
+    {
+        return;
+    }
+
+    std::erase_if(entries, [](const entry_t & entry) { return entry.dentry.inode == nullptr; });
+    entries.shrink_to_fit();
+    rebuild();
+}
+
+dentry_t * dentry_index_t::find(std::string_view name)
+{
+    uint64_t index = position(name, hash_of(name));
+    return index == entries.size() ? nullptr : &entries[index].dentry;
+}
+
+bool dentry_index_t::emplace(std::string_view name, dentry_t dentry)
+{
+    uint64_t hash = hash_of(name);
+    if (position(name, hash) != entries.size())
+    {
+        return false;
+    }
+
+    entries.emplace_back(entry_t { .name = std::string(name), .hash = hash, .cookie = next_cookie++, .dentry = dentry });
+    live++;
+
+    if (table.empty() ? live > DENTRY_INDEX_LINEAR_MAX : entries.size() * 2 > table.size())
+    {
+        rebuild();
+    }
+    else if (!table.empty())
+    {
+        table_insert(entries.size() - 1);
+    }
+
+    return true;
+}
+
+bool dentry_index_t::erase(std::string_view name)
+{
+    uint64_t index = position(name, hash_of(name));
+    if (index == entries.size())
+    {
+        return false;
+    }
+
+    if (!table.empty())
+    {
+        table_erase(index);
+    }
+
+    // entry stays as a hole until compaction, only memory of its name is returned now
+    auto & entry = entries[index];
+    entry.dentry.inode = nullptr;
+    std::string().swap(entry.name);
+    live--;
+
+    if (live == 0)
+    {
+        clear();
+    }
+    else if (!table.empty() && live <= DENTRY_INDEX_LINEAR_MAX / 2)
+    {
+        std::erase_if(entries, [](const entry_t & entry) { return entry.dentry.inode == nullptr; });
+        table.clear();
+    }
+    else
+    {
+        compact();
+    }
+
+    return true;
+}
+
+dentry_index_t::const_iterator dentry_index_t::after(uint64_t cookie) const
+{
+    // cookies increase along entries, compaction keeps their order
+    auto it = std::upper_bound(entries.begin(), entries.end(), cookie,
+                               [](uint64_t value, const entry_t & entry) { return value < entry.cookie; });
+    return { entries.data() + (it - entries.begin()), entries.data() + entries.size() };
+}
+
+void dentry_index_t::clear()
+{
+    std::vector < entry_t > ().swap(entries);
+    std::vector < slot_t > ().swap(table);
+    live = 0;
+}
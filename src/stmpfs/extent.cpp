@@ -0,0 +1,66 @@
+/** @file
+ *
+ * This file implements extent size policy and extent layout of file data
+ */
+
+#include <extent.h>
+#include <stmpfs_error.h>
+#include <bit>
+
+extent_policy_t extent_policy(DEFAULT_MIN_EXTENT_SIZE, DEFAULT_MAX_EXTENT_SIZE);
+
+extent_policy_t::extent_policy_t(uint64_t min_size, uint64_t max_size)
+{
+    if (!std::has_single_bit(min_size) || !std::has_single_bit(max_size)
+        || min_size > max_size || min_size < MIN_EXTENT_SIZE_LIMIT)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_CANNOT_PARSE_ARGUMENT);
+    }
+
+    min_extent_size = min_size;
+    max_extent_size = max_size;
+    min_shift = std::countr_zero(min_size);
+    geometric_count = std::countr_zero(max_size) - min_shift;
+    geometric_length = min_size * ((1ULL << geometric_count) - 1);
+}
+
+uint64_t extent_policy_t::index(uint64_t offset) const
+{
+    if (offset < geometric_length)
+    {
+        // extent n covers [min * (2^n - 1), min * (2^(n+1) - 1))
+        return std::bit_width((offset >> min_shift) + 1) - 1;
+    }
+
+    return geometric_count + (offset - geometric_length) / max_extent_size;
+}
+
+uint64_t extent_policy_t::offset(uint64_t index) const
+{
+    if (index < geometric_count)
+    {
+        return min_extent_size * ((1ULL << index) - 1);
+    }
+
+    return geometric_length + (index - geometric_count) * max_extent_size;
+}
+
+uint64_t extent_policy_t::size(uint64_t index) const
+{
+    if (index < geometric_count)
+    {
+        return min_extent_size << index;
+    }
+
+    return max_extent_size;
+}
+
+uint64_t extent_policy_t::count(uint64_t length) const
+{
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    return index(length - 1) + 1;
+}
@@ -0,0 +1,988 @@
+/** @file
+ *
+ * This file implements checkpoint images of the whole filesystem
+ */
+
+#include <image.h>
+#include <stmpfs.h>
+#include <stmpfs_error.h>
+#include <quota.h>
+#include <spill.h>
+#include <journal.h>
+#include <inode_table.h>
+#include <algorithm>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/wait.h>
+
+#define IMAGE_WRITE_BATCH   (64 * 1024 * 1024)  /* bytes written per pwritev */
+
+image_t & image = * new image_t;
+
+/// round up to IMAGE_ALIGN
+static inline uint64_t image_align(uint64_t length)
+{
+    return (length + IMAGE_ALIGN - 1) & ~(uint64_t)(IMAGE_ALIGN - 1);
+}
+
+/// zeros padding extents up to IMAGE_ALIGN
+static const char image_padding[IMAGE_ALIGN] { };
+
+struct image_t::dump_context_t
+{
+    std::string metadata;
+    std::vector < const block_t * > blocks;                     // written by this image, in data order
+    std::unordered_map < const block_t *, uint64_t > locations; // block -> offset in data
+    uint64_t data_length = 0;
+    uint64_t inode_count = 0;
+    uint64_t generation = 0;
+    uint64_t base_generation = 0;
+    uint64_t journal_lsn = 0;
+    bool incremental = false;           // refer to blocks saved by earlier generations
+
+    template < typename T >
+    void put(const T & value)
+    {
+        metadata.append((const char *)&value, sizeof(value));
+    }
+
+    void put(const std::string & value)
+    {
+        put((uint32_t)value.size());
+        metadata.append(value);
+    }
+};
+
+/// an opened image of a chain
+struct image_file_t
+{
+    int fd;
+    uint64_t data_offset;
+    uint64_t data_length;
+    uint64_t metadata_offset;
+    uint64_t metadata_length;
+    const char * mapping;       // whole image up to metadata if mapped as base, nullptr otherwise
+};
+
+/// read all of buffer at offset, return false if failed
+static bool read_all(int fd, char * buffer, uint64_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t ret = pread(fd, buffer, length, (off_t)offset);
+        if (ret <= 0)
+        {
+            return false;
+        }
+
+        buffer += ret;
+        length -= ret;
+        offset += ret;
+    }
+
+    return true;
+}
+
+/// open an image and check its header, throw error if it is not a valid image
+/** @param source image file
+ *  @param header header output
+ *  @return file descriptor **/
+static int open_image(const std::string & source, image_header_t & header)
+{
+    int fd = open(source.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+
+    if (!read_all(fd, (char *)&header, sizeof(header), 0)
+        || memcmp(header.magic, IMAGE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != IMAGE_VERSION || header.align != IMAGE_ALIGN
+        || header.data_offset + header.data_length != header.metadata_offset
+        || header.base_generation > header.generation)
+    {
+        close(fd);
+        throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+    }
+
+    return fd;
+}
+
+struct image_t::restore_context_t
+{
+    struct record_t
+    {
+        uint64_t generation;            // image the record is from
+        std::string_view content;       // record after its length
+    };
+
+    std::map < uint64_t, std::string > metadata;            // generation -> metadata of its image
+    std::unordered_map < uint64_t, record_t > records;      // inode number -> latest record in chain
+    std::string_view record;                                // record being read
+    std::string prefix;                 // image of generation G is PREFIX.G
+    uint64_t generation = 0;
+    uint64_t base_generation = 0;
+    bool mark = false;                  // blocks count as saved in the images they are read from
+    bool map = false;                   // serve data from mapped images instead of reading it
+    uint64_t mapped_bytes = 0;
+    uint64_t cursor = 0;
+    uint64_t inode_count = 0;
+
+    struct read_t
+    {
+        int fd;
+        char * buffer;
+        uint64_t offset;
+        uint64_t length;
+    };
+
+    std::map < uint64_t, image_file_t > files;                          // generation -> image
+    std::map < std::pair < uint64_t, uint64_t >, block_t * > blocks;    // generation and offset -> block
+    std::vector < read_t > reads;
+
+    ~restore_context_t()
+    {
+        // mappings stay, mapped blocks refer to them until exit
+        for (auto & i : files)
+        {
+            close(i.second.fd);
+        }
+    }
+
+    /// add an opened image, mapping it if data is served from it
+    const image_file_t & add_file(int fd, const image_header_t & header)
+    {
+        const char * mapping = nullptr;
+        if (map && header.data_length != 0)
+        {
+            void * ret = mmap(nullptr, header.data_offset + header.data_length, PROT_READ, MAP_SHARED, fd, 0);
+            if (ret == MAP_FAILED)
+            {
+                close(fd);
+                throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+            }
+
+            mapping = (const char *)ret;
+            mapped_bytes += header.data_length;
+        }
+
+        return files.emplace(header.generation,
+                             image_file_t { fd, header.data_offset, header.data_length,
+                                            header.metadata_offset, header.metadata_length, mapping }).first->second;
+    }
+
+    /// image of a generation in chain, opened on first use
+    const image_file_t & file(uint64_t file_generation)
+    {
+        auto it = files.find(file_generation);
+        if (it != files.end())
+        {
+            return it->second;
+        }
+
+        if (file_generation < base_generation || file_generation > generation)
+        {
+            throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+        }
+
+        image_header_t header { };
+        int fd = open_image(prefix + "." + std::to_string(file_generation), header);
+        if (header.generation != file_generation || header.base_generation != base_generation
+            || header.min_extent_size != extent_policy.min_size() || header.max_extent_size != extent_policy.max_size())
+        {
+            close(fd);
+            throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+        }
+
+        return add_file(fd, header);
+    }
+
+    /// read metadata of every image of chain, keeping the latest record of every inode number
+    void fold()
+    {
+        for (auto file_generation = base_generation; file_generation <= generation; file_generation++)
+        {
+            auto & image_file = file(file_generation);
+            auto & content = metadata[file_generation];
+            content.resize(image_file.metadata_length);
+            if (!read_all(image_file.fd, content.data(), content.size(), image_file.metadata_offset))
+            {
+                throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+            }
+
+            // removals go first, a number reused since is saved again after them
+            record = content;
+            cursor = 0;
+            for (auto count = get < uint64_t > (); count > 0; count--)
+            {
+                records.erase(get < uint64_t > ());
+            }
+
+            while (cursor < record.size())
+            {
+                auto number = get < uint64_t > ();
+                auto length = get < uint64_t > ();
+                if (length > record.size() - cursor)
+                {
+                    throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+                }
+
+                records[number] = record_t { file_generation, record.substr(cursor, length) };
+                cursor += length;
+            }
+        }
+    }
+
+    template < typename T >
+    T get()
+    {
+        T value;
+        get(&value, sizeof(value));
+        return value;
+    }
+
+    void get(void * buffer, uint64_t length)
+    {
+        if (length > record.size() - cursor)
+        {
+            throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+        }
+
+        memcpy(buffer, record.data() + cursor, length);
+        cursor += length;
+    }
+
+    std::string get_string()
+    {
+        std::string value(get < uint32_t > (), 0);
+        get(value.data(), value.size());
+        return value;
+    }
+};
+
+void image_t::save_inode(dump_context_t & context, inode_t & inode)
+{
+    // an inode unchanged since an earlier generation of chain is kept from there,
+    // unless an extent it refers to is not saved yet
+    bool changed = !context.incremental || inode.saved_generation == 0;
+    for (uint64_t i = 0; !changed && i < inode.data.size(); i++)
+    {
+        changed = inode.data[i] != nullptr && inode.data[i]->saved_generation == 0;
+    }
+
+    if (changed)
+    {
+        context.inode_count++;
+        context.put(inode.number);
+
+        // record length is filled in once the record is complete
+        uint64_t length_offset = context.metadata.size();
+        context.put((uint64_t)0);
+        context.put(inode.fs_stat);
+
+        context.put((uint64_t)inode.xattr.size());
+        for (auto & i : inode.xattr)
+        {
+            context.put(i.first);
+            context.put(i.second);
+        }
+
+        context.put(inode.cur_data_size);
+        context.put((uint8_t)inode.is_inline());
+        if (inode.is_inline())
+        {
+            context.metadata.append(inode.inline_data, INLINE_DATA_SIZE);
+        }
+        else
+        {
+            context.put((uint64_t)inode.data.size());
+            for (auto block : inode.data)
+            {
+                if (block == nullptr)
+                {
+                    context.put((uint64_t)0);
+                    context.put((uint64_t)IMAGE_NO_DATA);
+                    context.put((uint64_t)0);
+                    continue;
+                }
+
+                // unchanged blocks stay where an earlier generation wrote them
+                if (!context.incremental || block->saved_generation == 0)
+                {
+                    // shared extents are stored once
+                    auto it = context.locations.find(block);
+                    if (it == context.locations.end())
+                    {
+                        it = context.locations.emplace(block, context.data_length).first;
+                        context.blocks.emplace_back(block);
+                        context.data_length += image_align(block->valid_length());
+                    }
+
+                    block->saved_generation = context.generation;
+                    block->saved_offset = it->second;
+                }
+
+                context.put(block->saved_generation);
+                context.put(block->saved_offset);
+                context.put(block->valid_length());
+            }
+        }
+
+        context.put((uint64_t)inode.dentry.size());
+        for (auto & i : inode.dentry)
+        {
+            context.put(i.name);
+            context.put(i.dentry.inode->number);
+        }
+
+        uint64_t length = context.metadata.size() - length_offset - sizeof(length);
+        memcpy(context.metadata.data() + length_offset, &length, sizeof(length));
+        inode.saved_generation = context.generation;
+    }
+
+    for (auto & i : inode.dentry)
+    {
+        save_inode(context, *i.dentry.inode);
+    }
+}
+
+void image_t::load_inode(restore_context_t & context, inode_t & inode, uint64_t number)
+{
+    auto record = context.records.find(number);
+    if (record == context.records.end())
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+    }
+
+    context.record = record->second.content;
+    context.cursor = 0;
+    context.inode_count++;
+    context.get(&inode.fs_stat, sizeof(inode.fs_stat));
+
+    // root keeps its number, no other inode may take it
+    if (number == INODE_TABLE_ROOT && inode.number == INODE_TABLE_ROOT)
+    {
+        inode_table.attach(inode);
+    }
+    else
+    {
+        inode_table.attach(inode, number);
+    }
+
+    for (auto count = context.get < uint64_t > (); count > 0; count--)
+    {
+        std::string key = context.get_string();
+        inode.xattr[key] = context.get_string();
+    }
+
+    inode.cur_data_size = context.get < uint64_t > ();
+    if (context.get < uint8_t > ())
+    {
+        if (inode.cur_data_size > INLINE_DATA_SIZE)
+        {
+            throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+        }
+
+        context.get(inode.inline_data, INLINE_DATA_SIZE);
+    }
+    else
+    {
+        auto count = context.get < uint64_t > ();
+        if (count > extent_policy.count(inode.cur_data_size))
+        {
+            throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+        }
+
+        inode.data.resize(count, nullptr);
+        for (uint64_t index = 0; index < count; index++)
+        {
+            auto generation = context.get < uint64_t > ();
+            auto offset = context.get < uint64_t > ();
+            auto length = context.get < uint64_t > ();
+            uint64_t size = extent_policy.size(index);
+            if (offset == IMAGE_NO_DATA)
+            {
+                continue;
+            }
+
+            auto & file = context.file(generation);
+            if (length > size || offset > file.data_length || image_align(length) > file.data_length - offset)
+            {
+                throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+            }
+
+            auto it = context.blocks.find({ generation, offset });
+            if (it != context.blocks.end())
+            {
+                if (it->second->size() != size)
+                {
+                    throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+                }
+
+                inode.data[index] = it->second->share();
+            }
+            else if (context.map)
+            {
+                block_t * block = block_t::create_mapped(file.mapping + file.data_offset + offset, length, size);
+                context.blocks.emplace(std::make_pair(generation, offset), block);
+                inode.data[index] = block;
+            }
+            else
+            {
+                // content is read in parallel once all metadata is loaded
+                block_t * block = block_t::create(size);
+                char * buffer = block->writable_data();
+                memset(buffer + length, 0, size - length);
+                context.reads.emplace_back(restore_context_t::read_t { file.fd, buffer, file.data_offset + offset, length });
+                context.blocks.emplace(std::make_pair(generation, offset), block);
+                inode.data[index] = block;
+
+                if (context.mark)
+                {
+                    block->saved_generation = generation;
+                    block->saved_offset = offset;
+                }
+            }
+
+            inode.allocated_size += size;
+        }
+
+        inode.fs_stat.st_blocks = (blkcnt_t)(inode.allocated_size / 512);
+    }
+
+    // next snapshots of the same chain keep the record as long as inode is unchanged
+    if (context.mark)
+    {
+        inode.saved_generation = record->second.generation;
+    }
+
+    // loading children moves on to their records
+    std::vector < std::pair < std::string, uint64_t > > children;
+    for (auto count = context.get < uint64_t > (); count > 0; count--)
+    {
+        std::string name = context.get_string();
+        children.emplace_back(std::move(name), context.get < uint64_t > ());
+    }
+
+    if (context.cursor != context.record.size())
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+    }
+
+    for (auto & i : children)
+    {
+        quota.charge_inode();
+        auto * child = new inode_t;
+        child->charged_inode = true;
+        if (!inode.dentry.emplace(i.first, dentry_t { .if_constructed_by_inode = 1, .inode = child }))
+        {
+            delete child;
+            throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+        }
+
+        load_inode(context, *child, i.second);
+    }
+}
+
+/// write all of buffer at offset, return false if failed
+static bool write_all(int fd, const char * buffer, uint64_t length, uint64_t offset)
+{
+    while (length > 0)
+    {
+        ssize_t ret = pwrite(fd, buffer, length, (off_t)offset);
+        if (ret <= 0)
+        {
+            return false;
+        }
+
+        buffer += ret;
+        length -= ret;
+        offset += ret;
+    }
+
+    return true;
+}
+
+bool image_t::write_image(const dump_context_t & context, const std::string & target)
+{
+    image_header_t header {
+        .magic = { },
+        .version = IMAGE_VERSION,
+        .align = IMAGE_ALIGN,
+        .min_extent_size = extent_policy.min_size(),
+        .max_extent_size = extent_policy.max_size(),
+        .data_offset = IMAGE_ALIGN,
+        .data_length = context.data_length,
+        .metadata_offset = IMAGE_ALIGN + context.data_length,
+        .metadata_length = context.metadata.size(),
+        .inode_count = context.inode_count,
+        .generation = context.generation,
+        .base_generation = context.base_generation,
+        .journal_lsn = context.journal_lsn,
+    };
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+
+    std::string temporary = target + ".tmp";
+    int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1)
+    {
+        return false;
+    }
+
+    bool ok = true;
+    std::vector < struct iovec > iov;
+    std::vector < std::unique_ptr < char[] > > copies;     // content of compressed or spilled blocks
+    uint64_t batch_offset = header.data_offset, batch_length = 0;
+
+    try
+    {
+        for (uint64_t i = 0; ok && i <= context.blocks.size(); i++)
+        {
+            // flush a batch once it is large enough, or at the end
+            if (i == context.blocks.size() || iov.size() + 2 > IOV_MAX || batch_length >= IMAGE_WRITE_BATCH)
+            {
+                ok = pwritev(fd, iov.data(), (int)iov.size(), (off_t)batch_offset) == (ssize_t)batch_length;
+                batch_offset += batch_length;
+                batch_length = 0;
+                iov.clear();
+                copies.clear();
+
+                if (i == context.blocks.size())
+                {
+                    break;
+                }
+            }
+
+            const block_t * block = context.blocks[i];
+            uint64_t length = block->valid_length();
+            const char * content = block->block_data;
+            if (content == nullptr)
+            {
+                copies.emplace_back(std::make_unique < char[] > (block->size()));
+                block->read_content(copies.back().get());
+                content = copies.back().get();
+            }
+
+            iov.emplace_back(iovec { .iov_base = (void *)content, .iov_len = length });
+            if (image_align(length) != length)
+            {
+                iov.emplace_back(iovec { .iov_base = (void *)image_padding, .iov_len = image_align(length) - length });
+            }
+
+            batch_length += image_align(length);
+        }
+    }
+    catch (...)
+    {
+        ok = false;
+    }
+
+    ok = ok && write_all(fd, context.metadata.data(), context.metadata.size(), header.metadata_offset)
+            && write_all(fd, (const char *)&header, sizeof(header), 0)
+            && fdatasync(fd) == 0;
+    close(fd);
+
+    if (!ok || rename(temporary.c_str(), target.c_str()) != 0)
+    {
+        unlink(temporary.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+/// point link at target, replacing it atomically
+static bool update_link(const std::string & link, const std::string & target)
+{
+    // relative, so the directory can be moved as a whole
+    std::string name = target.substr(target.find_last_of('/') + 1);
+    std::string temporary = link + ".tmp";
+    unlink(temporary.c_str());
+    return symlink(name.c_str(), temporary.c_str()) == 0 && rename(temporary.c_str(), link.c_str()) == 0;
+}
+
+void image_t::snapshot(inode_t & root)
+{
+    uint64_t next = generation + 1;
+    bool incremental = !chain.empty() && chain.size() < IMAGE_CHAIN_LENGTH;
+    std::string target = path + "." + std::to_string(next);
+    uint64_t bytes;
+    journal_t::mark_t mark { };
+    pid_t pid;
+
+    // a failed snapshot leaves blocks marked as saved in it, so the next one is full again
+    {
+        dump_context_t context;
+        context.generation = next;
+        context.base_generation = incremental ? chain.front() : next;
+        context.incremental = incremental;
+
+        std::lock_guard < std::mutex > guard(filesystem_lock);
+        auto begin = std::chrono::steady_clock::now();
+
+        try
+        {
+            // removals go first, see image.h, a full snapshot holds none
+            context.put((uint64_t)(incremental ? removed.size() : 0));
+            for (uint64_t i = 0; incremental && i < removed.size(); i++)
+            {
+                context.put(removed[i]);
+            }
+
+            removed.clear();
+            save_inode(context, root);
+        }
+        catch (...)
+        {
+            chain.clear();
+            failed_snapshots++;
+            throw;
+        }
+
+        // replay after this image starts past the last record of what it holds
+        mark = journal.mark();
+        context.journal_lsn = mark.lsn;
+
+        // child reads spilled blocks from spill file, which has to keep their content
+        spill.hold_slots();
+        pid = fork();
+        if (pid == 0)
+        {
+            _exit(write_image(context, target) ? 0 : 1);
+        }
+
+        if (pid == -1)
+        {
+            spill.release_slots();
+            chain.clear();
+            failed_snapshots++;
+            throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+        }
+
+        auto pause = (uint64_t)std::chrono::duration_cast < std::chrono::microseconds >
+                (std::chrono::steady_clock::now() - begin).count();
+        pause_time = pause;
+        if (pause > pause_time_max)
+        {
+            pause_time_max = pause;
+        }
+
+        bytes = IMAGE_ALIGN + context.data_length + context.metadata.size();
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    int status = 0;
+    while (waitpid(pid, &status, 0) == -1 && errno == EINTR)
+    {
+    }
+
+    {
+        std::lock_guard < std::mutex > guard(filesystem_lock);
+        spill.release_slots();
+    }
+
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0 || !update_link(path, target))
+    {
+        chain.clear();
+        failed_snapshots++;
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+
+    // older chains are not referred to once a full snapshot is written
+    if (!incremental)
+    {
+        for (auto i : chain)
+        {
+            unlink((path + "." + std::to_string(i)).c_str());
+        }
+
+        chain.clear();
+    }
+
+    journal.truncate(mark);
+    generation = next;
+    chain.emplace_back(next);
+    snapshots++;
+    incremental_snapshots += incremental;
+    snapshot_bytes = bytes;
+    snapshot_time = std::chrono::duration_cast < std::chrono::milliseconds >
+            (std::chrono::steady_clock::now() - begin).count();
+}
+
+void image_t::load(inode_t & root, const std::string & source, bool map)
+{
+    auto begin = std::chrono::steady_clock::now();
+
+    if (!root.dentry.empty() || !root.data.empty())
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_PATHNAME_ALREADY_USED);
+    }
+
+    image_header_t header { };
+    restore_context_t context;
+    context.map = map;
+    int fd = open_image(source, header);
+    context.add_file(fd, header);
+    context.generation = header.generation;
+    context.base_generation = header.base_generation;
+
+    // other generations are next to source, which is either one of them or the link to the latest
+    std::string suffix = "." + std::to_string(header.generation);
+    context.prefix = source;
+    if (source.size() > suffix.size() && source.compare(source.size() - suffix.size(), suffix.size(), suffix) == 0)
+    {
+        context.prefix.resize(source.size() - suffix.size());
+    }
+
+    // next snapshots go on with the same chain, a shared base is never part of it
+    context.mark = !map && context.prefix == path;
+
+    // extent indexes in image only make sense with its own extent policy
+    if (header.min_extent_size != extent_policy.min_size() || header.max_extent_size != extent_policy.max_size())
+    {
+        std::cerr << "Using extent sizes " << header.min_extent_size << "-" << header.max_extent_size
+                  << " of image " << source << std::endl;
+        extent_policy = extent_policy_t(header.min_extent_size, header.max_extent_size);
+    }
+
+    try
+    {
+        context.fold();
+        load_inode(context, root, INODE_TABLE_ROOT);
+        inode_table.restored();
+    }
+    catch (...)
+    {
+        root.clear();
+        inode_table.restored();
+        throw;
+    }
+
+    // split data into ranges of about the same size, one sequential reader each
+    std::sort(context.reads.begin(), context.reads.end(),
+              [](const restore_context_t::read_t & a, const restore_context_t::read_t & b)
+              { return a.fd != b.fd ? a.fd < b.fd : a.offset < b.offset; });
+
+    uint64_t total = 0;
+    for (auto & i : context.reads)
+    {
+        total += i.length;
+    }
+
+    uint64_t threads = std::clamp < uint64_t > (std::thread::hardware_concurrency(), 1, IMAGE_READ_THREADS);
+    std::vector < std::thread > readers;
+    std::atomic < bool > ok = true;
+    uint64_t share = total / threads + 1;
+
+    for (uint64_t first = 0; first < context.reads.size(); )
+    {
+        uint64_t last = first, bytes = 0;
+        while (last < context.reads.size() && (bytes < share || readers.size() + 1 == threads))
+        {
+            bytes += context.reads[last++].length;
+        }
+
+        readers.emplace_back([&context, &ok, first, last]()
+        {
+            std::unique_ptr < char[] > padding(new char[IMAGE_ALIGN]);
+            std::vector < struct iovec > iov;
+            int batch_fd = -1;
+            uint64_t batch_offset = 0, batch_length = 0;
+
+            for (uint64_t i = first; ok && i <= last; i++)
+            {
+                // one preadv per run of adjacent extents
+                if (i == last || iov.size() + 2 > IOV_MAX || batch_length >= IMAGE_WRITE_BATCH
+                    || context.reads[i].fd != batch_fd || context.reads[i].offset != batch_offset + batch_length)
+                {
+                    if (!iov.empty() && preadv(batch_fd, iov.data(), (int)iov.size(), (off_t)batch_offset) != (ssize_t)batch_length)
+                    {
+                        ok = false;
+                    }
+
+                    iov.clear();
+                    if (i == last)
+                    {
+                        break;
+                    }
+
+                    batch_fd = context.reads[i].fd;
+                    batch_offset = context.reads[i].offset;
+                    batch_length = 0;
+                }
+
+                auto & read = context.reads[i];
+                iov.emplace_back(iovec { .iov_base = read.buffer, .iov_len = read.length });
+                if (image_align(read.length) != read.length)
+                {
+                    iov.emplace_back(iovec { .iov_base = padding.get(), .iov_len = image_align(read.length) - read.length });
+                }
+
+                batch_length += image_align(read.length);
+            }
+        });
+
+        first = last;
+    }
+
+    for (auto & reader : readers)
+    {
+        reader.join();
+    }
+
+    if (!ok)
+    {
+        root.clear();
+        inode_table.restored();
+        throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+    }
+
+    // removals only refer to the tree replaced
+    if (context.mark)
+    {
+        generation = header.generation;
+        removed.clear();
+        chain.clear();
+        for (uint64_t i = header.base_generation; i <= header.generation; i++)
+        {
+            chain.emplace_back(i);
+        }
+    }
+
+    restored_journal_lsn = header.journal_lsn;
+    mapped_bytes = context.mapped_bytes;
+    uint64_t metadata_bytes = 0;
+    for (auto & i : context.metadata)
+    {
+        metadata_bytes += i.second.size();
+    }
+
+    restore_bytes = total + metadata_bytes;
+    restore_time = std::chrono::duration_cast < std::chrono::milliseconds >
+            (std::chrono::steady_clock::now() - begin).count();
+}
+
+void image_t::restore(inode_t & root, const std::string & source)
+{
+    load(root, source, false);
+}
+
+void image_t::map_base(inode_t & root, const std::string & source)
+{
+    load(root, source, true);
+}
+
+void image_t::forget(const inode_t & inode)
+{
+    if (inode.saved_generation != 0 && inode.number != 0)
+    {
+        removed.emplace_back(inode.number);
+    }
+}
+
+void image_t::block_signal()
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+    pthread_sigmask(SIG_BLOCK, &set, nullptr);
+}
+
+void image_t::signal_loop(inode_t & root)
+{
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGUSR1);
+
+    while (true)
+    {
+        if (interval.count() != 0)
+        {
+            // times out with -1
+            struct timespec timeout { .tv_sec = interval.count(), .tv_nsec = 0 };
+            sigtimedwait(&set, nullptr, &timeout);
+        }
+        else
+        {
+            int signal = 0;
+            sigwait(&set, &signal);
+        }
+
+        if (!signal_running)
+        {
+            return;
+        }
+
+        try
+        {
+            snapshot(root);
+        }
+        catch (stmpfs_error_t & error)
+        {
+            std::cerr << error.what() << " (errno=" << error.what_errno() << ")" << std::endl;
+        }
+        catch (std::exception & error)
+        {
+            std::cerr << error.what() << " (errno=" << strerror(errno) << ")" << std::endl;
+        }
+    }
+}
+
+void image_t::start(inode_t & root)
+{
+    if (path.empty() || signal_running)
+    {
+        return;
+    }
+
+    signal_running = true;
+    signal_thread = std::thread(&image_t::signal_loop, this, std::ref(root));
+}
+
+void image_t::stop()
+{
+    if (!signal_running)
+    {
+        return;
+    }
+
+    signal_running = false;
+    pthread_kill(signal_thread.native_handle(), SIGUSR1);
+    signal_thread.join();
+}
+
+std::string image_t::statistics()
+{
+    std::stringstream ret;
+    uint64_t bytes = snapshot_bytes, time = snapshot_time;
+
+    ret << "path=" << path
+        << " interval=" << interval.count() << "s"
+        << " generation=" << generation
+        << " chain_length=" << chain.size()
+        << " snapshots=" << snapshots
+        << " incremental_snapshots=" << incremental_snapshots
+        << " failed_snapshots=" << failed_snapshots
+        << " pause=" << pause_time << "us"
+        << " pause_max=" << pause_time_max << "us"
+        << " snapshot_bytes=" << bytes
+        << " snapshot_time=" << time << "ms"
+        << " throughput=" << (time ? bytes * 1000 / time / (1024 * 1024) : 0) << "MiB/s"
+        << " mapped_bytes=" << mapped_bytes
+        << " restore_bytes=" << restore_bytes
+        << " restore_time=" << restore_time << "ms";
+
+    return ret.str();
+}
@@ -7,10 +7,20 @@
 #include <stmpfs_error.h>
 #include <iostream>
 #include <debug.h>
+#include <block.h>
+#include <tail_pack.h>
+#include <dedup.h>
+#include <quota.h>
+#include <backing.h>
+#include <dentry_cache.h>
+#include <inode_table.h>
+#include <image.h>
+#include <unistd.h>
 
 #define MIN(a, b) ((a) < (b) ? (a) : (b))
+#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
-/// read buffer from data
+/// read buffer from data, holes read as 0s
 /** @param buffer output buffer
  *  @param length read length
  *  @param offset read offset
@@ -19,101 +29,149 @@
 size_t read_buffer(char * & buffer,
                    size_t & length,
                    off_t & offset,
-                   std::vector < char * > & data)
+                   std::vector < block_t * > & data)
 {
-    uint64_t orphaned_skipped_read = offset % BLOCK_SIZE;
-    uint64_t orphaned_skipped_blocks = offset / BLOCK_SIZE;
-    uint64_t orphaned_read = MIN(BLOCK_SIZE - orphaned_skipped_read, length);
-    uint64_t rest_read_length = length - orphaned_read;
-    uint64_t full_read_count = rest_read_length / BLOCK_SIZE;
-    uint64_t orphaned_tail = rest_read_length % BLOCK_SIZE;
+    uint64_t index = extent_policy.index(offset);
+    uint64_t extent_skipped = offset - extent_policy.offset(index);
     size_t read_offset = 0;
 
-    // head
-    memcpy(buffer, data[orphaned_skipped_blocks] + orphaned_skipped_read, orphaned_read);
-    read_offset += orphaned_read;
-    
-    // full
-    for (uint64_t i = 1; i <= full_read_count; i++)
+    // one copy per extent
+    while (read_offset < length)
     {
-        memcpy(buffer + read_offset, 
-               data[orphaned_skipped_blocks + i], 
-               BLOCK_SIZE);
-        read_offset += BLOCK_SIZE;
-    }
+        uint64_t read_length = MIN(extent_policy.size(index) - extent_skipped, length - read_offset);
+        if (index < data.size() && data[index] != nullptr)
+        {
+            memcpy(buffer + read_offset, data[index]->data() + extent_skipped, read_length);
+        }
+        else
+        {
+            memset(buffer + read_offset, 0, read_length);
+        }
 
-    // tail
-    if (orphaned_tail)
-    {
-        memcpy(buffer + read_offset,
-               data[orphaned_skipped_blocks + full_read_count + 1], orphaned_tail);
-        read_offset += orphaned_tail;
+        read_offset += read_length;
+        extent_skipped = 0;
+        index++;
     }
 
     return read_offset;
 }
 
-/// write buffer to data
+/// write buffer to data, allocating extents in holes and copying shared extents
 /** @param buffer output buffer
  *  @param length read length
  *  @param offset read offset
  *  @param data input buffer
+ *  @param allocated_size allocated extent size, updated on allocation
+ *  @return bytes written, less than length if space ran out
  *  **/
 size_t write_buffer(const char * buffer,
                    size_t length,
                    off_t offset,
-                   std::vector < char * > & data)
+                   std::vector < block_t * > & data,
+                   uint64_t & allocated_size)
 {
-    uint64_t orphaned_skipped_write = offset % BLOCK_SIZE;
-    uint64_t orphaned_skipped_blocks = offset / BLOCK_SIZE;
-    uint64_t orphaned_write = MIN(BLOCK_SIZE - orphaned_skipped_write, length);
-    uint64_t rest_write_length = length - orphaned_write;
-    uint64_t full_write_count = rest_write_length / BLOCK_SIZE;
-    uint64_t orphaned_tail = rest_write_length % BLOCK_SIZE;
+    uint64_t index = extent_policy.index(offset);
+    uint64_t extent_skipped = offset - extent_policy.offset(index);
     size_t write_offset = 0;
 
-    // head
-    memcpy(data[orphaned_skipped_blocks] + orphaned_skipped_write, buffer, orphaned_write);
-    write_offset += orphaned_write;
-
-    // full
-    for (uint64_t i = 1; i <= full_write_count; i++)
+    if (length != 0 && data.size() < extent_policy.count(offset + length))
     {
-        data.emplace_back(new char [BLOCK_SIZE]);
-        memcpy(data[orphaned_skipped_blocks + i],
-               buffer + write_offset,
-               BLOCK_SIZE);
-        write_offset += BLOCK_SIZE;
+        data.resize(extent_policy.count(offset + length), nullptr);
     }
 
-    // tail
-    if (orphaned_tail)
+    // one copy per extent
+    while (write_offset < length)
     {
-        data.emplace_back(new char[BLOCK_SIZE]);
-        memcpy(data[orphaned_skipped_blocks + full_write_count + 1],
-               buffer + write_offset, orphaned_tail);
-        write_offset += orphaned_tail;
+        uint64_t extent_size = extent_policy.size(index);
+        uint64_t write_length = MIN(extent_size - extent_skipped, length - write_offset);
+
+        char * extent;
+        try
+        {
+            if (data[index] == nullptr)
+            {
+                // only zero what is not about to be overwritten
+                data[index] = block_t::create(extent_size);
+                extent = data[index]->writable_data();
+                memset(extent, 0, extent_skipped);
+                memset(extent + extent_skipped + write_length, 0,
+                       extent_size - extent_skipped - write_length);
+                allocated_size += extent_size;
+            }
+            else
+            {
+                extent = block_for_write(data[index]);
+            }
+        }
+        catch (stmpfs_error_t & error)
+        {
+            // out of space, keep what is written as a short write
+            while (!data.empty() && data.back() == nullptr)
+            {
+                data.pop_back();
+            }
+
+            if (write_offset == 0 || error.my_errcode() != STMPFS_ERROR_NO_SPACE_LEFT)
+            {
+                throw;
+            }
+
+            return write_offset;
+        }
+
+        memcpy(extent + extent_skipped, buffer + write_offset, write_length);
+        write_offset += write_length;
+        extent_skipped = 0;
+        index++;
     }
 
     return write_offset;
 }
 
-/// fill buffer with 0s at back
-/**
- *  @param length read length
+/// zero a range of data, freeing extents fully inside the range
+/** @param length zeroing length
+ *  @param offset zeroing offset
  *  @param data input buffer
+ *  @param allocated_size allocated extent size, updated on deallocation
  *  **/
-uint64_t fill_buffer(size_t length, std::vector < char * > & data)
+void zero_buffer(uint64_t length,
+                 uint64_t offset,
+                 std::vector < block_t * > & data,
+                 uint64_t & allocated_size)
 {
-    uint64_t alloc_blk_count = (length / BLOCK_SIZE) + (length % BLOCK_SIZE == 0 ? 0 : 1);
-    for (uint64_t i = 0; i < alloc_blk_count; i++)
+    uint64_t index = extent_policy.index(offset);
+    uint64_t extent_skipped = offset - extent_policy.offset(index);
+    uint64_t zero_offset = 0;
+
+    while (zero_offset < length && index < data.size())
     {
-        char * new_block = new char [BLOCK_SIZE];
-//        memset(new_block, 0, BLOCK_SIZE);
-        data.emplace_back(new_block);
+        uint64_t extent_size = extent_policy.size(index);
+        uint64_t zero_length = MIN(extent_size - extent_skipped, length - zero_offset);
+
+        if (data[index] != nullptr)
+        {
+            if (zero_length == extent_size)
+            {
+                data[index]->release();
+                data[index] = nullptr;
+                allocated_size -= extent_size;
+            }
+            else
+            {
+                memset(block_for_write(data[index]) + extent_skipped, 0, zero_length);
+            }
+        }
+
+        zero_offset += zero_length;
+        extent_skipped = 0;
+        index++;
     }
 
-    return length;
+    // trailing holes take no space
+    while (!data.empty() && data.back() == nullptr)
+    {
+        data.pop_back();
+    }
 }
 
 size_t inode_t::read(char *buffer, size_t length, off_t offset)
@@ -130,7 +188,7 @@ size_t inode_t::read(char *buffer, size_t length, off_t offset)
         return 0;
     }
 
-    if (offset > cur_data_size)
+    if ((uint64_t)offset > cur_data_size)
     {
         return 0;
     }
@@ -140,6 +198,12 @@ size_t inode_t::read(char *buffer, size_t length, off_t offset)
         length = cur_data_size - offset;
     }
 
+    if (is_inline())
+    {
+        memcpy(buffer, inline_data + offset, length);
+        return length;
+    }
+
     // read from changeable buffer
     return read_buffer(buffer, length, offset, data);
 }
@@ -153,17 +217,32 @@ size_t inode_t::write(const char *buffer, size_t length, off_t offset)
     }
 #endif // CMAKE_BUILD_DEBUG
 
-    // fill buffer
+    changed();
+
+    if (is_inline() && offset + length <= INLINE_DATA_SIZE)
+    {
+        memcpy(inline_data + offset, buffer, length);
+    }
+    else
+    {
+        uninline();
+
+        if (offset + length > cur_data_size)
+        {
+            unpack_tail();
+        }
+
+        // write, allocating extents in holes
+        length = write_buffer(buffer, length, offset, data, allocated_size);
+        fs_stat.st_blocks = (blkcnt_t)(allocated_size / 512);
+    }
+
     if ((offset + length) > cur_data_size)
     {
-        fill_buffer((offset + length) - cur_data_size, data);
         cur_data_size = length + offset;
         fs_stat.st_size = (off_t)cur_data_size;
     }
 
-    // overwrite
-    write_buffer(buffer, length, offset, data);
-
 #ifdef CMAKE_BUILD_DEBUG
     if (if_enable_hash_check)
     {
@@ -174,138 +253,477 @@ size_t inode_t::write(const char *buffer, size_t length, off_t offset)
     return length;
 }
 
-void inode_t::clear()
+void inode_t::uninline()
 {
-    for (auto i : data)
+    if (!is_inline())
     {
-        delete []i;
+        return;
     }
-    data.clear();
 
-    for (auto & i : dentry)
+    if (cur_data_size != 0)
+    {
+        write_buffer(inline_data, cur_data_size, 0, data, allocated_size);
+        fs_stat.st_blocks = (blkcnt_t)(allocated_size / 512);
+    }
+
+    memset(inline_data, 0, INLINE_DATA_SIZE);
+}
+
+void inode_t::unpack_tail()
+{
+    // only the last extent can be packed
+    if (!data.empty() && data.back() != nullptr && data.back()->packed())
+    {
+        block_for_write(data.back());
+    }
+}
+
+void inode_t::pack_tail()
+{
+    if (!tail_pack.enabled || is_inline() || data.empty() || data.back() == nullptr
+        || data.back()->packed() || data.back()->shared() || data.back()->is_mapped()
+        || extent_policy.count(cur_data_size) != data.size())
     {
-        if (i.second.if_constructed_by_inode)
+        return;
+    }
+
+    uint64_t tail_length = cur_data_size - extent_policy.offset(data.size() - 1);
+    if (tail_length > PACKED_TAIL_MAX || tail_length == data.back()->size())
+    {
+        return;
+    }
+
+    block_t * packed = block_t::create_packed(data.back()->data(), tail_length, data.back()->size());
+    data.back()->release();
+    data.back() = packed;
+    changed();
+}
+
+void inode_t::deduplicate()
+{
+    if (!dedup.enabled || !S_ISREG(fs_stat.st_mode))
+    {
+        return;
+    }
+
+    for (auto & block : data)
+    {
+        auto * before = block;
+        dedup.deduplicate(block);
+        if (block != before)
         {
-            delete i.second.inode;
+            changed();
         }
     }
-    dentry.clear();
 }
 
-void inode_t::add_dentry(const std::string& name, inode_t& inode, uint64_t if_alloc_by_inode)
+void inode_t::clear()
 {
-    auto it = dentry.find(name);
-    if (it != dentry.end())
+    changed();
+
+    // return all extents at once
+    block_t::release(data);
+    data.clear();
+    allocated_size = 0;
+
+    for (auto & i : dentry)
     {
-        if (it->second.if_constructed_by_inode)
+        if (i.dentry.if_constructed_by_inode)
         {
-            delete it->second.inode;
+            delete i.dentry.inode;
         }
-
-        dentry.erase(it);
     }
+    dentry.clear();
+}
 
+void inode_t::add_dentry(std::string_view name, inode_t& inode, uint64_t if_alloc_by_inode)
+{
     dentry_t new_dentry {
         .if_constructed_by_inode = if_alloc_by_inode,
         .inode = &inode,
     };
 
-    dentry.emplace(name, new_dentry);
-}
+    changed();
 
-void inode_t::emplace_new_dentry(const std::string& name, const inode_t& inode)
-{
-    auto it = dentry.find(name);
-    if (it != dentry.end())
+    // an existing entry is replaced in place
+    auto * existing = dentry.find(name);
+    if (existing != nullptr)
     {
-        if (it->second.if_constructed_by_inode)
+        if (existing->if_constructed_by_inode)
         {
-            delete it->second.inode;
+            inode_table.remove(*existing->inode);
         }
 
-        dentry.erase(it);
+        *existing = new_dentry;
+        return;
     }
 
+    dentry.emplace(name, new_dentry);
+}
+
+inode_t & inode_t::emplace_new_dentry(std::string_view name, const inode_t& inode)
+{
+    quota.charge_inode();
+
     dentry_t new_dentry
     {
         .if_constructed_by_inode = 1,
         .inode = new inode_t,
     };
 
+    new_dentry.inode->charged_inode = true;
+
     new_dentry.inode->fs_stat = inode.fs_stat;
+    inode_table.attach(*new_dentry.inode);
     new_dentry.inode->dentry = inode.dentry;
-    for (auto i : inode.data)
+    new_dentry.inode->cur_data_size = inode.cur_data_size;
+    new_dentry.inode->allocated_size = inode.allocated_size;
+    memcpy(new_dentry.inode->inline_data, inode.inline_data, INLINE_DATA_SIZE);
+
+    // extents are shared until either side writes them
+    for (auto block : inode.data)
     {
-        char * new_block = new char [BLOCK_SIZE];
-        memcpy(new_block, i, BLOCK_SIZE);
-        new_dentry.inode->data.emplace_back(new_block);
+        new_dentry.inode->data.emplace_back(block == nullptr ? nullptr : block->share());
+    }
+
+    // an existing entry is replaced in place
+    changed();
+    auto * existing = dentry.find(name);
+    if (existing != nullptr)
+    {
+        if (existing->if_constructed_by_inode)
+        {
+            inode_table.remove(*existing->inode);
+        }
+
+        *existing = new_dentry;
+        return *new_dentry.inode;
     }
 
     dentry.emplace(name, new_dentry);
+    return *new_dentry.inode;
 }
 
-void inode_t::del_dentry(const std::string& name, bool protect_child)
+void inode_t::del_dentry(std::string_view name, bool protect_child)
 {
-    auto it = dentry.find(name);
-    if (it != dentry.end())
+    auto * existing = dentry.find(name);
+    if (existing == nullptr)
     {
-        if (it->second.if_constructed_by_inode && !protect_child)
-        {
-            delete it->second.inode;
-        }
+        throw stmpfs_error_t(STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY);
+    }
 
-        dentry.erase(it);
-        return;
+    if (existing->if_constructed_by_inode && !protect_child)
+    {
+        inode_table.remove(*existing->inode);
     }
 
-    throw stmpfs_error_t(STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY);
+    dentry.erase(name);
+    changed();
 }
 
-inode_t *inode_t::find_in_dentry(const std::string &name)
+inode_t *inode_t::find_in_dentry(std::string_view name)
 {
-    auto it = dentry.find(name);
-    if (it != dentry.end())
+    auto * inode = lookup_dentry(name);
+    if (inode == nullptr)
     {
-        return it->second.inode;
+        throw stmpfs_error_t(STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY);
     }
 
-    throw stmpfs_error_t(STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY);
+    return inode;
+}
+
+inode_t *inode_t::lookup_dentry(std::string_view name)
+{
+    auto * existing = dentry.find(name);
+    return existing == nullptr ? nullptr : existing->inode;
 }
 
 inode_t::inode_t() noexcept = default;
 
+inode_t::~inode_t()
+{
+    backing.forget(this);
+    dentry_cache.forget(this);
+    image.forget(*this);
+    inode_table.detach(*this);
+    clear();
+    if (charged_inode)
+    {
+        quota.uncharge_inode();
+    }
+}
+
 void inode_t::truncate(off_t size)
 {
-    uint64_t alloc_count = (size / BLOCK_SIZE) + (size % BLOCK_SIZE == 0 ? 0 : 1);
-    uint64_t cur_blk_count = data.size();
+    changed();
 
-    if (alloc_count < cur_blk_count)
+    if (is_inline())
     {
-        for (uint64_t i = 0; i < cur_blk_count - alloc_count; i++)
+        if (size <= INLINE_DATA_SIZE)
         {
-            delete[] data.back();
-            data.pop_back();
+            if ((uint64_t)size < cur_data_size)
+            {
+                memset(inline_data + size, 0, cur_data_size - size);
+            }
+
+            cur_data_size = size;
+            fs_stat.st_size = size;
+            return;
         }
+
+        uninline();
     }
-    else if (alloc_count > cur_blk_count)
+
+    if ((uint64_t)size > cur_data_size)
     {
-        for (uint64_t i = 0; i < alloc_count - cur_blk_count; i++)
+        unpack_tail();
+    }
+
+    // zero and free everything past new end, growing only moves the end
+    if ((uint64_t)size < cur_data_size)
+    {
+        // extents entirely past new end are released, not only zeroed
+        for (uint64_t index = extent_policy.count(size); index < data.size(); index++)
+        {
+            if (data[index] != nullptr)
+            {
+                data[index]->release();
+                data[index] = nullptr;
+                allocated_size -= extent_policy.size(index);
+            }
+        }
+
+        zero_buffer(cur_data_size - size, size, data, allocated_size);
+
+        // small enough to move back into inode
+        if (size <= INLINE_DATA_SIZE && !data.empty())
         {
-            data.emplace_back(new char [BLOCK_SIZE]);
-//            memset(data.back(), 0, BLOCK_SIZE);
+            size_t length = size;
+            off_t offset = 0;
+            char * buffer = inline_data;
+            read_buffer(buffer, length, offset, data);
+            block_t::release(data);
+            data.clear();
+            allocated_size = 0;
         }
+
+        fs_stat.st_blocks = (blkcnt_t)(allocated_size / 512);
     }
 
     cur_data_size = size;
+    fs_stat.st_size = size;
+}
+
+void inode_t::punch_hole(off_t offset, off_t length)
+{
+    if ((uint64_t)offset >= cur_data_size)
+    {
+        return;
+    }
+
+    changed();
+
+    if (is_inline())
+    {
+        memset(inline_data + offset, 0, MIN((uint64_t)length, cur_data_size - offset));
+        return;
+    }
+
+    zero_buffer(MIN((uint64_t)length, cur_data_size - offset), offset, data, allocated_size);
+    fs_stat.st_blocks = (blkcnt_t)(allocated_size / 512);
+}
+
+void inode_t::allocate(off_t offset, off_t length)
+{
+    changed();
+
+    uint64_t end = MIN((uint64_t)(offset + length), cur_data_size);
+
+    // inline content is kept in inode itself
+    if ((uint64_t)offset >= end || is_inline())
+    {
+        return;
+    }
+
+    // a packed tail would take a whole extent once written
+    unpack_tail();
+
+    if (data.size() < extent_policy.count(end))
+    {
+        data.resize(extent_policy.count(end), nullptr);
+    }
+
+    try
+    {
+        for (uint64_t index = extent_policy.index(offset); index < extent_policy.count(end); index++)
+        {
+            if (data[index] == nullptr)
+            {
+                uint64_t extent_size = extent_policy.size(index);
+                data[index] = block_t::create(extent_size);
+                memset(data[index]->writable_data(), 0, extent_size);
+                allocated_size += extent_size;
+            }
+        }
+    }
+    catch (stmpfs_error_t &)
+    {
+        // extents allocated so far are kept, as written data would be
+        while (!data.empty() && data.back() == nullptr)
+        {
+            data.pop_back();
+        }
+
+        fs_stat.st_blocks = (blkcnt_t)(allocated_size / 512);
+        throw;
+    }
+
+    fs_stat.st_blocks = (blkcnt_t)(allocated_size / 512);
+}
+
+off_t inode_t::seek(off_t offset, int whence)
+{
+    if (offset < 0 || (uint64_t)offset >= cur_data_size)
+    {
+        return -1;
+    }
+
+    // inline content is all data
+    if (is_inline())
+    {
+        return whence == SEEK_DATA ? offset : (off_t)cur_data_size;
+    }
+
+    for (uint64_t index = extent_policy.index(offset); index < data.size(); index++)
+    {
+        if ((data[index] != nullptr) == (whence == SEEK_DATA))
+        {
+            return MIN(cur_data_size, MAX((uint64_t)offset, extent_policy.offset(index)));
+        }
+    }
+
+    // the rest of the file is a hole
+    if (whence == SEEK_DATA)
+    {
+        return -1;
+    }
+
+    return MAX((uint64_t)offset, MIN(cur_data_size, extent_policy.offset(data.size())));
+}
+
+size_t inode_t::clone_range(inode_t & source, off_t source_offset, off_t offset, size_t length)
+{
+    uint64_t cloned = 0;
+    changed();
+
+    // inline content has no extents to share
+    if (source.is_inline() || (is_inline() && offset + length <= INLINE_DATA_SIZE))
+    {
+        std::vector < char > buffer(length);
+        source.read(buffer.data(), length, source_offset);
+        return write(buffer.data(), length, offset);
+    }
+
+    uninline();
+
+    if (offset + length > cur_data_size)
+    {
+        unpack_tail();
+    }
+
+    try
+    {
+        while (cloned < length)
+        {
+            uint64_t index = extent_policy.index(offset + cloned);
+            uint64_t extent_size = extent_policy.size(index);
+            uint64_t extent_skipped = offset + cloned - extent_policy.offset(index);
+            uint64_t source_index = extent_policy.index(source_offset + cloned);
+            uint64_t source_size = extent_policy.size(source_index);
+            uint64_t source_skipped = source_offset + cloned - extent_policy.offset(source_index);
+            uint64_t clone_length = MIN(MIN(extent_size - extent_skipped, source_size - source_skipped),
+                                        length - cloned);
+            block_t * source_block = source_index < source.data.size() ? source.data[source_index] : nullptr;
+
+            if (extent_skipped == 0 && source_skipped == 0 && clone_length == extent_size
+                && source_size == extent_size)
+            {
+                // whole extent lines up and is the same size, share it
+                if (data.size() <= index)
+                {
+                    data.resize(index + 1, nullptr);
+                }
+
+                if (source_block != nullptr)
+                {
+                    source_block->share();
+                    allocated_size += extent_size;
+                }
+
+                if (data[index] != nullptr)
+                {
+                    data[index]->release();
+                    allocated_size -= extent_size;
+                }
+
+                data[index] = source_block;
+            }
+            else if (source_block == nullptr)
+            {
+                zero_buffer(clone_length, offset + cloned, data, allocated_size);
+            }
+            else
+            {
+                // out of space, keep what is cloned as a short clone
+                auto written = write_buffer(source_block->data() + source_skipped, clone_length,
+                                            (off_t)(offset + cloned), data, allocated_size);
+                if (written < clone_length)
+                {
+                    cloned += written;
+                    break;
+                }
+            }
+
+            cloned += clone_length;
+        }
+    }
+    catch (stmpfs_error_t &)
+    {
+        // extents cloned so far are kept as a short clone, so none is left past end of file
+        if (cloned == 0)
+        {
+            while (!data.empty() && data.back() == nullptr)
+            {
+                data.pop_back();
+            }
+
+            fs_stat.st_blocks = (blkcnt_t)(allocated_size / 512);
+            throw;
+        }
+    }
+
+    while (!data.empty() && data.back() == nullptr)
+    {
+        data.pop_back();
+    }
+
+    if (offset + cloned > cur_data_size)
+    {
+        cur_data_size = offset + cloned;
+        fs_stat.st_size = (off_t)cur_data_size;
+    }
+
+    fs_stat.st_blocks = (blkcnt_t)(allocated_size / 512);
+    return cloned;
 }
 
 size_t inode_t::count_inode()
 {
     uint64_t count = 0;
 
-    for (auto i : dentry)
+    for (auto & i : dentry)
     {
-        count += i.second.inode->count_inode();
+        count += i.dentry.inode->count_inode();
     }
 
     return count + 1;
@@ -317,13 +735,17 @@ std::string inode_t::hash()
 {
     std::string buff;
 
-    for (auto i : data)
+    buff.resize(cur_data_size);
+    if (is_inline())
     {
-        uint64_t rest = MIN(cur_data_size - buff.size(), BLOCK_SIZE);
-        for (uint64_t j = 0; j < rest; j++)
-        {
-            buff += i[j];
-        }
+        memcpy(buff.data(), inline_data, cur_data_size);
+    }
+    else
+    {
+        off_t offset = 0;
+        size_t length = cur_data_size;
+        char * buffer = buff.data();
+        read_buffer(buffer, length, offset, data);
     }
 
     return sha256(buff);
@@ -0,0 +1,180 @@
+/** @file
+ *
+ * This file implements the inode number table
+ */
+
+#include <inode_table.h>
+#include <inode.h>
+#include <stmpfs_error.h>
+#include <algorithm>
+#include <sstream>
+
+inode_table_t & inode_table = * new inode_table_t;
+
+inode_table_t::inode_table_t()
+    : slots(INODE_TABLE_ROOT + 1, slot_t { .inode = nullptr, .generation = 0, .lookups = 0, .orphan = false })
+{
+}
+
+void inode_table_t::attach(inode_t & inode)
+{
+    if (inode.number == 0)
+    {
+        if (free_numbers.empty())
+        {
+            inode.number = slots.size();
+            slots.emplace_back(slot_t { .inode = &inode, .generation = 0, .lookups = 0, .orphan = false });
+        }
+        else
+        {
+            inode.number = free_numbers.back();
+            free_numbers.pop_back();
+            slots[inode.number].inode = &inode;
+            reused++;
+        }
+    }
+
+    inode.fs_stat.st_ino = (ino_t)inode.number;
+}
+
+void inode_table_t::attach(inode_t & inode, uint64_t number)
+{
+    if (number <= INODE_TABLE_ROOT || inode.number != 0 || (number < slots.size() && slots[number].inode != nullptr))
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_IMAGE);
+    }
+
+    if (number >= slots.size())
+    {
+        slots.resize(number + 1, slot_t { .inode = nullptr, .generation = 0, .lookups = 0, .orphan = false });
+    }
+
+    slots[number].inode = &inode;
+    inode.number = number;
+    inode.fs_stat.st_ino = (ino_t)number;
+}
+
+void inode_table_t::restored()
+{
+    // lowest numbers are reused first
+    free_numbers.clear();
+    for (uint64_t number = slots.size() - 1; number > INODE_TABLE_ROOT; number--)
+    {
+        if (slots[number].inode == nullptr && slots[number].lookups == 0)
+        {
+            free_numbers.push_back(number);
+        }
+    }
+}
+
+void inode_table_t::attach_root(inode_t & root)
+{
+    slots[INODE_TABLE_ROOT].inode = &root;
+    root.number = INODE_TABLE_ROOT;
+    root.fs_stat.st_ino = INODE_TABLE_ROOT;
+}
+
+void inode_table_t::detach(inode_t & inode)
+{
+    if (inode.number == 0)
+    {
+        return;
+    }
+
+    auto & slot = slots[inode.number];
+    slot.inode = nullptr;
+    slot.generation++;
+
+    // root keeps its number, one still held is freed once forgotten
+    if (inode.number != INODE_TABLE_ROOT && slot.lookups == 0)
+    {
+        free_numbers.push_back(inode.number);
+    }
+
+    inode.number = 0;
+}
+
+void inode_table_t::remove(inode_t & inode)
+{
+    if (inode.number == 0 || slots[inode.number].lookups == 0)
+    {
+        delete &inode;
+        return;
+    }
+
+    slots[inode.number].orphan = true;
+    inode.fs_stat.st_nlink = 0;
+    orphans++;
+}
+
+void inode_table_t::hold(uint64_t number)
+{
+    slots[number].lookups++;
+}
+
+uint64_t inode_table_t::release(uint64_t number, uint64_t count)
+{
+    if (number >= slots.size() || slots[number].lookups == 0)
+    {
+        return 0;
+    }
+
+    auto & slot = slots[number];
+    slot.lookups -= std::min(count, slot.lookups);
+    if (slot.lookups != 0 || number == INODE_TABLE_ROOT)
+    {
+        return slot.lookups;
+    }
+
+    // inode destructor detaches and frees number
+    if (slot.orphan)
+    {
+        slot.orphan = false;
+        orphans--;
+        delete slot.inode;
+    }
+    else if (slot.inode == nullptr)
+    {
+        free_numbers.push_back(number);
+    }
+
+    return 0;
+}
+
+inode_t * inode_table_t::find(uint64_t number) const
+{
+    return number < slots.size() ? slots[number].inode : nullptr;
+}
+
+inode_t * inode_table_t::find(uint64_t number, uint64_t generation) const
+{
+    return number < slots.size() && slots[number].generation == generation ? slots[number].inode : nullptr;
+}
+
+bool inode_table_t::orphan(uint64_t number) const
+{
+    return number < slots.size() && slots[number].orphan;
+}
+
+uint64_t inode_table_t::generation(uint64_t number) const
+{
+    return number < slots.size() ? slots[number].generation : 0;
+}
+
+uint64_t inode_table_t::size() const
+{
+    return slots.size();
+}
+
+std::string inode_table_t::statistics()
+{
+    std::stringstream ret;
+
+    ret << "numbers=" << slots.size() - 1
+        << " in_use=" << slots.size() - 1 - free_numbers.size() - (slots[INODE_TABLE_ROOT].inode == nullptr)
+        << " free=" << free_numbers.size()
+        << " reused=" << reused
+        << " orphans=" << orphans;
+
+    return ret.str();
+}
@@ -0,0 +1,483 @@
+/** @file
+ *
+ * This file implements the write-ahead journal of filesystem mutations
+ */
+
+#include <journal.h>
+#include <stmpfs.h>
+#include <stmpfs_error.h>
+#include <algorithm>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define JOURNAL_RECORD_MAX  (1ULL << 32)    /* record length is u32 */
+#define JOURNAL_COPY_BUFFER (1024 * 1024)   /* bytes copied at once when records are dropped */
+
+journal_t & journal = * new journal_t;
+
+/// CRC-32 lookup table, reflected polynomial 0xEDB88320
+static const struct crc32_table_t
+{
+    uint32_t entry[256];
+
+    crc32_table_t() : entry()
+    {
+        for (uint32_t i = 0; i < 256; i++)
+        {
+            uint32_t crc = i;
+            for (int bit = 0; bit < 8; bit++)
+            {
+                crc = (crc >> 1) ^ (crc & 1 ? 0xEDB88320 : 0);
+            }
+
+            entry[i] = crc;
+        }
+    }
+} crc32_table;
+
+/// CRC-32 of a buffer
+static uint32_t crc32(const char * data, uint64_t length)
+{
+    uint32_t crc = 0xFFFFFFFF;
+    for (uint64_t i = 0; i < length; i++)
+    {
+        crc = crc32_table.entry[(crc ^ (uint8_t)data[i]) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+}
+
+/// checksum of a record, covering everything after the checksum field
+static uint32_t record_checksum(const char * record, uint64_t length)
+{
+    uint64_t skip = offsetof(journal_record_header_t, checksum) + sizeof(uint32_t);
+    return crc32(record + skip, length - skip);
+}
+
+/// write all of buffer, return false if failed
+static bool write_all(int fd, const char * buffer, uint64_t length)
+{
+    while (length > 0)
+    {
+        ssize_t ret = write(fd, buffer, length);
+        if (ret <= 0)
+        {
+            return false;
+        }
+
+        buffer += ret;
+        length -= ret;
+    }
+
+    return true;
+}
+
+uint64_t journal_reader_t::number()
+{
+    uint64_t value;
+    if (length - cursor < sizeof(value))
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_JOURNAL);
+    }
+
+    memcpy(&value, data + cursor, sizeof(value));
+    cursor += sizeof(value);
+    return value;
+}
+
+std::string_view journal_reader_t::string()
+{
+    uint32_t size;
+    if (length - cursor < sizeof(size))
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_JOURNAL);
+    }
+
+    memcpy(&size, data + cursor, sizeof(size));
+    cursor += sizeof(size);
+    if (length - cursor < size)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_JOURNAL);
+    }
+
+    std::string_view value(data + cursor, size);
+    cursor += size;
+    return value;
+}
+
+void journal_t::encode(std::string & out, std::string_view value)
+{
+    auto size = (uint32_t)value.size();
+    out.append((const char *)&size, sizeof(size));
+    out.append(value);
+}
+
+uint64_t journal_t::begin_record(std::unique_lock < std::mutex > & guard)
+{
+    // writer fell behind, hold mutations back instead of buffering without bound
+    progress.wait(guard, [&]() { return pending.size() < JOURNAL_BUFFER_LIMIT || failed; });
+
+    uint64_t begin = pending.size();
+    pending.resize(begin + sizeof(journal_record_header_t));
+    return begin;
+}
+
+uint64_t journal_t::finish_record(uint64_t begin, journal_op_t op)
+{
+    uint64_t length = pending.size() - begin;
+    if (length >= JOURNAL_RECORD_MAX)
+    {
+        pending.resize(begin);
+        throw stmpfs_error_t(STMPFS_ERROR_CANNOT_PARSE_ARGUMENT);
+    }
+
+    journal_record_header_t header {
+        .length = (uint32_t)length,
+        .checksum = 0,
+        .lsn = next_lsn++,
+        .time = current_time(),
+        .op = op,
+        .reserved = 0,
+    };
+    memcpy(pending.data() + begin, &header, sizeof(header));
+    header.checksum = record_checksum(pending.data() + begin, length);
+    memcpy(pending.data() + begin, &header, sizeof(header));
+
+    appended_offset += length;
+    records++;
+    record_bytes += length;
+
+    // writer only sleeps on an empty buffer
+    if (begin == 0)
+    {
+        wakeup.notify_one();
+    }
+
+    return header.lsn;
+}
+
+void journal_t::replay(uint64_t after, const std::function < void (journal_op_t, journal_reader_t &) > & apply)
+{
+    fd = open(path.c_str(), O_RDWR | O_CREAT | O_APPEND | O_CLOEXEC, 0600);
+    struct stat file_stat { };
+    if (fd == -1 || fstat(fd, &file_stat) != 0)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+
+    auto size = (uint64_t)file_stat.st_size;
+    const char * map = nullptr;
+    if (size != 0)
+    {
+        void * address = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (address == MAP_FAILED)
+        {
+            throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+        }
+
+        map = (const char *)address;
+        madvise(address, size, MADV_SEQUENTIAL);
+    }
+
+    uint64_t offset = 0, last = 0;
+    try
+    {
+        // a record cut short or failing its checksum ends the journal
+        while (size - offset >= sizeof(journal_record_header_t))
+        {
+            journal_record_header_t header { };
+            memcpy(&header, map + offset, sizeof(header));
+            if (header.length < sizeof(header) || header.length > size - offset
+                || header.checksum != record_checksum(map + offset, header.length)
+                || (last != 0 && header.lsn != last + 1))
+            {
+                break;
+            }
+
+            if (header.lsn > after)
+            {
+                // records between image and journal are lost
+                if (header.lsn != std::max(last, after) + 1)
+                {
+                    throw stmpfs_error_t(STMPFS_ERROR_CORRUPTED_JOURNAL);
+                }
+
+                journal_reader_t reader(map + offset + sizeof(header), header.length - sizeof(header));
+                replay_time = &header.time;
+                try
+                {
+                    apply((journal_op_t)header.op, reader);
+                }
+                catch (stmpfs_error_t & error)
+                {
+                    std::cerr << "Journal record " << header.lsn << ": " << error.what() << std::endl;
+                }
+
+                replay_time = nullptr;
+                replayed++;
+            }
+
+            last = header.lsn;
+            offset += header.length;
+        }
+    }
+    catch (...)
+    {
+        replay_time = nullptr;
+        munmap((void *)map, size);
+        throw;
+    }
+
+    if (map != nullptr)
+    {
+        munmap((void *)map, size);
+    }
+
+    if (offset != size)
+    {
+        std::cerr << "Cutting " << size - offset << " bytes of torn records off journal " << path << std::endl;
+        if (ftruncate(fd, (off_t)offset) != 0)
+        {
+            throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+        }
+    }
+
+    next_lsn = std::max(last, after) + 1;
+    written_lsn = durable_lsn = next_lsn - 1;
+    appended_offset = written_offset = offset;
+}
+
+void journal_t::drop_records(mark_t position)
+{
+    std::string temporary = path + ".tmp";
+    int new_fd = open(temporary.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0600);
+    if (new_fd == -1)
+    {
+        return;
+    }
+
+    // journal file starts at logical offset file_base
+    uint64_t file_base = written_offset - (uint64_t)lseek(fd, 0, SEEK_END);
+    uint64_t offset = position.offset - file_base;
+    std::unique_ptr < char[] > buffer(new char[JOURNAL_COPY_BUFFER]);
+    bool ok = true;
+
+    while (ok)
+    {
+        ssize_t length = pread(fd, buffer.get(), JOURNAL_COPY_BUFFER, (off_t)offset);
+        if (length <= 0)
+        {
+            ok = length == 0;
+            break;
+        }
+
+        ok = write_all(new_fd, buffer.get(), length);
+        offset += length;
+    }
+
+    if (!ok || fdatasync(new_fd) != 0 || rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        close(new_fd);
+        unlink(temporary.c_str());
+        return;
+    }
+
+    close(fd);
+    fd = new_fd;
+}
+
+void journal_t::run()
+{
+    std::unique_lock < std::mutex > guard(lock);
+    auto last_sync = std::chrono::steady_clock::now();
+
+    while (true)
+    {
+        bool unsynced = written_lsn > durable_lsn;
+        bool sync_due = durability == JOURNAL_DURABILITY_ASYNC && unsynced
+                && std::chrono::steady_clock::now() - last_sync >= interval;
+        bool sync_wanted = durability == JOURNAL_DURABILITY_SYNC && wanted_lsn > durable_lsn;
+
+        if (pending.empty() && !sync_due && !sync_wanted && truncate_mark.offset == 0)
+        {
+            if (!running)
+            {
+                break;
+            }
+
+            if (durability == JOURNAL_DURABILITY_ASYNC && unsynced)
+            {
+                wakeup.wait_until(guard, last_sync + interval);
+            }
+            else
+            {
+                wakeup.wait(guard);
+            }
+
+            continue;
+        }
+
+        // everything appended so far goes out with one write and at most one sync
+        std::string batch;
+        batch.swap(pending);
+        uint64_t batch_lsn = next_lsn - 1;
+        bool sync = sync_due || sync_wanted
+                || (durability == JOURNAL_DURABILITY_SYNC && wanted_lsn > written_lsn);
+        mark_t drop = truncate_mark;
+        truncate_mark = { 0, 0 };
+        progress.notify_all();
+        guard.unlock();
+
+        bool ok = !failed && write_all(fd, batch.data(), batch.size());
+        if (ok && sync)
+        {
+            ok = fdatasync(fd) == 0;
+        }
+
+        guard.lock();
+        if (!ok && !failed)
+        {
+            std::cerr << "Cannot write journal " << path << " (errno=" << strerror(errno) << "), "
+                      << "no more records are kept" << std::endl;
+            failed = true;
+        }
+
+        written_offset += batch.size();
+        written_lsn = batch_lsn;
+        commits++;
+        if (ok && sync)
+        {
+            durable_lsn = batch_lsn;
+            last_sync = std::chrono::steady_clock::now();
+            syncs++;
+        }
+
+        // records before mark are all written by now, only this thread uses fd
+        if (ok && drop.offset != 0)
+        {
+            guard.unlock();
+            drop_records(drop);
+            guard.lock();
+        }
+
+        progress.notify_all();
+    }
+
+    if (durability != JOURNAL_DURABILITY_NONE && !failed && written_lsn > durable_lsn && fdatasync(fd) == 0)
+    {
+        durable_lsn = written_lsn;
+    }
+}
+
+void journal_t::start()
+{
+    if (fd == -1 || running)
+    {
+        return;
+    }
+
+    running = true;
+    worker = std::thread(&journal_t::run, this);
+}
+
+void journal_t::stop()
+{
+    {
+        std::lock_guard < std::mutex > guard(lock);
+        if (!running)
+        {
+            return;
+        }
+
+        running = false;
+    }
+
+    wakeup.notify_all();
+    worker.join();
+    progress.notify_all();
+}
+
+void journal_t::wait(uint64_t lsn)
+{
+    if (lsn == 0 || durability != JOURNAL_DURABILITY_SYNC)
+    {
+        return;
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    std::unique_lock < std::mutex > guard(lock);
+
+    // records after lsn are synced along only if they are written by then
+    if (lsn > wanted_lsn)
+    {
+        wanted_lsn = lsn;
+        wakeup.notify_one();
+    }
+
+    progress.wait(guard, [&]() { return durable_lsn >= lsn || failed || !running; });
+
+    waits++;
+    wait_time += (uint64_t)std::chrono::duration_cast < std::chrono::nanoseconds >
+            (std::chrono::steady_clock::now() - begin).count();
+
+    if (durable_lsn < lsn)
+    {
+        errno = EIO;
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+journal_t::mark_t journal_t::mark()
+{
+    std::lock_guard < std::mutex > guard(lock);
+    if (!running)
+    {
+        return { 0, 0 };
+    }
+
+    return { next_lsn - 1, appended_offset };
+}
+
+void journal_t::truncate(mark_t position)
+{
+    std::lock_guard < std::mutex > guard(lock);
+    if (!running || position.offset == 0)
+    {
+        return;
+    }
+
+    truncate_mark = position;
+    wakeup.notify_one();
+}
+
+std::string journal_t::statistics()
+{
+    std::lock_guard < std::mutex > guard(lock);
+    std::stringstream ret;
+    static const char * durability_name[] = { "none", "async", "sync" };
+    uint64_t count = waits;
+
+    ret << "path=" << path
+        << " durability=" << durability_name[durability]
+        << " interval=" << interval.count() << "ms"
+        << " lsn=" << next_lsn - 1
+        << " durable_lsn=" << durable_lsn
+        << " pending_bytes=" << pending.size()
+        << " records=" << records
+        << " record_bytes=" << record_bytes
+        << " commits=" << commits
+        << " syncs=" << syncs
+        << " records_per_commit=" << (commits ? (double)records / (double)commits : 0)
+        << " fsync_waits=" << count
+        << " fsync_wait_avg=" << (count ? wait_time / count / 1000 : 0) << "us"
+        << " replayed=" << replayed
+        << " failed=" << failed;
+
+    return ret.str();
+}
@@ -5,37 +5,13 @@
 
 #include <pathname_t.h>
 
-stmpfs_pathname_t::stmpfs_pathname_t(std::string pathname)
+stmpfs_pathname_t::stmpfs_pathname_t(std::string_view pathname)
 {
-    if (pathname == "/")
-    {
-        return;
-    }
-
-    if (!pathname.empty() && *pathname.begin() == '/')
-    {
-        pathname.erase(pathname.begin());
-    }
+    path_tokenizer_t tokenizer(pathname);
+    std::string_view component;
 
-    if (!pathname.empty() && *pathname.end() == '/')
+    while (tokenizer.next(component))
     {
-        pathname.pop_back();
+        this->pathname.emplace_back(component);
     }
-
-    std::string cur;
-
-    for (auto & it : pathname)
-    {
-        if (it == '/')
-        {
-            this->pathname.emplace_back(cur);
-            cur.clear();
-        }
-        else
-        {
-            cur += it;
-        }
-    }
-
-    this->pathname.emplace_back(cur);
-}
\ No newline at end of file
+}
@@ -0,0 +1,42 @@
+/** @file
+ *
+ * This file implements size and inode limits of the filesystem
+ */
+
+#include <quota.h>
+#include <stmpfs_error.h>
+#include <sstream>
+
+quota_t & quota = * new quota_t;
+
+void quota_t::charge_bytes(uint64_t size, bool force)
+{
+    if (!force && max_bytes != 0 && used_bytes + size > max_bytes)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_NO_SPACE_LEFT);
+    }
+
+    used_bytes += size;
+}
+
+void quota_t::charge_inode()
+{
+    if (max_inodes != 0 && used_inodes >= max_inodes)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_NO_SPACE_LEFT);
+    }
+
+    used_inodes++;
+}
+
+std::string quota_t::statistics() const
+{
+    std::stringstream ret;
+
+    ret << "used_bytes=" << used_bytes
+        << " max_bytes=" << max_bytes
+        << " used_inodes=" << used_inodes
+        << " max_inodes=" << max_inodes;
+
+    return ret.str();
+}
@@ -0,0 +1,339 @@
+/** @file
+ *
+ * This file implements the spill file tier for cold data under memory pressure
+ */
+
+#include <spill.h>
+#include <stmpfs.h>
+#include <stmpfs_error.h>
+#include <algorithm>
+#include <bit>
+#include <climits>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include <sys/sysinfo.h>
+#include <sys/uio.h>
+
+spill_t & spill = * new spill_t;
+
+uint64_t spill_t::allocate_slot(uint64_t size)
+{
+    auto & slots = free_slots[std::countr_zero(size)];
+    if (!slots.empty())
+    {
+        uint64_t offset = slots.back();
+        slots.pop_back();
+        free_slot_bytes -= size;
+        return offset;
+    }
+
+    uint64_t offset = file_size;
+    file_size += size;
+    return offset;
+}
+
+void spill_t::free_slot(uint64_t offset, uint64_t size)
+{
+    if (slots_held)
+    {
+        held_slots.emplace_back(offset, size);
+        return;
+    }
+
+    free_slots[std::countr_zero(size)].emplace_back(offset);
+    free_slot_bytes += size;
+}
+
+uint64_t spill_t::evict(uint64_t target)
+{
+    struct candidate_t
+    {
+        block_t * block;
+        std::chrono::steady_clock::time_point last_access;
+        uint64_t offset;
+        bool written;
+    };
+
+    uint64_t evicted = 0;
+    bool failed = false;
+
+    while (evicted < target && running && !failed)
+    {
+        std::vector < candidate_t > batch;
+        uint64_t batch_bytes = 0;
+
+        // hold a reference, so block content does not change while writing
+        {
+            std::lock_guard < std::mutex > guard(filesystem_lock);
+            for (auto list : { &block_t::incompressible, &block_t::lru })
+            {
+                for (auto block = list->tail; block != nullptr && batch_bytes < SPILL_BATCH_BYTES; block = block->list_prev)
+                {
+                    // skip blocks being compressed
+                    if (!block->busy)
+                    {
+                        block->busy = true;
+                        batch.emplace_back(candidate_t { block->share(), block->last_access,
+                                                         allocate_slot(block->size()), false });
+                        batch_bytes += block->size();
+                    }
+                }
+            }
+        }
+
+        if (batch.empty())
+        {
+            break;
+        }
+
+        // one write per run of contiguous slots
+        std::sort(batch.begin(), batch.end(),
+                  [](const candidate_t & a, const candidate_t & b) { return a.offset < b.offset; });
+
+        for (uint64_t begin = 0; begin < batch.size(); )
+        {
+            std::vector < struct iovec > iov;
+            uint64_t end = begin, length = 0;
+            while (end < batch.size() && iov.size() < IOV_MAX && batch[end].offset == batch[begin].offset + length)
+            {
+                iov.emplace_back(iovec { .iov_base = batch[end].block->block_data, .iov_len = batch[end].block->size() });
+                length += batch[end].block->size();
+                end++;
+            }
+
+            if (pwritev(fd, iov.data(), (int)iov.size(), (off_t)batch[begin].offset) == (ssize_t)length)
+            {
+                for (uint64_t i = begin; i < end; i++)
+                {
+                    batch[i].written = true;
+                }
+            }
+            else
+            {
+                write_errors++;
+                failed = true;
+            }
+
+            begin = end;
+        }
+
+        {
+            std::lock_guard < std::mutex > guard(filesystem_lock);
+            for (auto & i : batch)
+            {
+                // skip blocks used meanwhile or left only to us
+                i.block->busy = false;
+                if (i.written && i.block->shared() && i.block->last_access == i.last_access)
+                {
+                    block_pool.deallocate(i.block->block_data, i.block->size());
+                    i.block->block_data = nullptr;
+                    i.block->spill_offset = i.offset;
+                    i.block->list_remove();
+                    spilled_blocks++;
+                    spilled_bytes += i.block->size();
+                    evicted += i.block->size();
+                }
+                else
+                {
+                    free_slot(i.offset, i.block->size());
+                }
+
+                i.block->release();
+            }
+        }
+    }
+
+    evicted_bytes += evicted;
+    return evicted;
+}
+
+void spill_t::run()
+{
+    uint64_t low_watermark = high_watermark - high_watermark / 8;
+
+    while (running)
+    {
+        struct pollfd fds[2] = {
+            { .fd = wakeup_fd, .events = POLLIN, .revents = 0 },
+            { .fd = psi_fd, .events = POLLPRI, .revents = 0 },
+        };
+
+        // psi_fd of -1 is ignored by poll
+        if (poll(fds, 2, 1000) < 0 && errno != EINTR)
+        {
+            break;
+        }
+
+        if (fds[0].revents & POLLIN)
+        {
+            break;
+        }
+
+        uint64_t target = 0;
+        if (fds[1].revents & POLLPRI)
+        {
+            psi_events++;
+            target = SPILL_PSI_BYTES;
+        }
+
+        uint64_t used = block_pool.used_bytes();
+        if (used > high_watermark)
+        {
+            target = std::max(target, used - low_watermark);
+        }
+
+        if (target != 0)
+        {
+            evict(target);
+        }
+    }
+}
+
+void spill_t::start()
+{
+    if (directory.empty() || running)
+    {
+        return;
+    }
+
+    // unnamed file, gone with the process
+    fd = open(directory.c_str(), O_RDWR | O_TMPFILE | O_CLOEXEC, 0600);
+    if (fd == -1)
+    {
+        std::string path = directory + "/stmpfs-spill-XXXXXX";
+        fd = mkostemp(path.data(), O_CLOEXEC);
+        if (fd == -1)
+        {
+            std::cerr << "Cannot create spill file in " << directory << " (errno=" << strerror(errno) << ")" << std::endl;
+            return;
+        }
+
+        unlink(path.c_str());
+    }
+
+    if (high_watermark == 0)
+    {
+        struct sysinfo _sysinfo{};
+        sysinfo(&_sysinfo);
+        high_watermark = (uint64_t)_sysinfo.totalram * _sysinfo.mem_unit / 4 * 3;
+    }
+
+    if (psi)
+    {
+        psi_fd = open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+        if (psi_fd != -1 && write(psi_fd, SPILL_PSI_TRIGGER, strlen(SPILL_PSI_TRIGGER) + 1) < 0)
+        {
+            close(psi_fd);
+            psi_fd = -1;
+        }
+
+        if (psi_fd == -1)
+        {
+            std::cerr << "PSI memory pressure notifications unavailable, using watermark only" << std::endl;
+        }
+    }
+
+    wakeup_fd = eventfd(0, EFD_CLOEXEC);
+    running = true;
+    worker = std::thread(&spill_t::run, this);
+}
+
+void spill_t::stop()
+{
+    if (!running)
+    {
+        return;
+    }
+
+    running = false;
+    uint64_t one = 1;
+    if (write(wakeup_fd, &one, sizeof(one)) < 0)
+    {
+        // worker still notices running within a second
+    }
+
+    worker.join();
+    close(wakeup_fd);
+    if (psi_fd != -1)
+    {
+        close(psi_fd);
+    }
+
+    // spilled blocks are still read back until exit, so spill file stays open
+}
+
+void spill_t::peek(const block_t * block, char * buffer) const
+{
+    if (pread(fd, buffer, block->size(), (off_t)block->spill_offset) != (ssize_t)block->size())
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_EXTERNAL_LIB_ERROR);
+    }
+}
+
+void spill_t::load(block_t * block)
+{
+    char * data = block_pool.allocate(block->size());
+
+    try
+    {
+        peek(block, data);
+    }
+    catch (...)
+    {
+        block_pool.deallocate(data, block->size());
+        throw;
+    }
+
+    discard(block);
+    block->block_data = data;
+    loads++;
+}
+
+void spill_t::hold_slots()
+{
+    slots_held = true;
+}
+
+void spill_t::release_slots()
+{
+    slots_held = false;
+    for (auto & i : held_slots)
+    {
+        free_slot(i.first, i.second);
+    }
+
+    held_slots.clear();
+}
+
+void spill_t::discard(block_t * block)
+{
+    free_slot(block->spill_offset, block->size());
+    block->spill_offset = UINT64_MAX;
+    spilled_blocks--;
+    spilled_bytes -= block->size();
+}
+
+std::string spill_t::statistics()
+{
+    std::stringstream ret;
+
+    ret << "enabled=" << (fd != -1)
+        << " psi=" << (psi_fd != -1)
+        << " high_watermark=" << high_watermark
+        << " pool_used_bytes=" << block_pool.used_bytes()
+        << " file_bytes=" << file_size
+        << " free_slot_bytes=" << free_slot_bytes
+        << " spilled_blocks=" << spilled_blocks
+        << " spilled_bytes=" << spilled_bytes
+        << " evicted_bytes=" << evicted_bytes
+        << " loads=" << loads
+        << " psi_events=" << psi_events
+        << " write_errors=" << write_errors;
+
+    return ret.str();
+}
@@ -4,20 +4,137 @@
  */
 
 #include <stmpfs.h>
+#include <block_pool.h>
+#include <tail_pack.h>
+#include <compressor.h>
+#include <dedup.h>
+#include <quota.h>
+#include <spill.h>
+#include <image.h>
+#include <journal.h>
+#include <backing.h>
+#include <dentry_cache.h>
+#include <inode_table.h>
+#include <stmpfs_error.h>
+
+std::mutex filesystem_lock;
 
 inode_t & pathname_to_inode(const stmpfs_pathname_t & pathname, inode_t & root)
+{
+    auto * inode = lookup_inode(pathname, root);
+    if (inode == nullptr)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY);
+    }
+
+    return *inode;
+}
+
+inode_t & pathname_to_inode(std::string_view path, inode_t & root)
+{
+    auto * inode = lookup_inode(path, root);
+    if (inode == nullptr)
+    {
+        throw stmpfs_error_t(STMPFS_ERROR_NO_SUCH_FILE_OR_DIRECTORY);
+    }
+
+    return *inode;
+}
+
+/// find one level below a directory
+/** @param dir directory
+ *  @param name entry name
+ *  @param backing_path path of dir in backing directory, name is appended **/
+static inode_t * lookup_component(inode_t & dir, std::string_view name, std::string & backing_path)
+{
+    if (!backing.enabled())
+    {
+        return dir.lookup_dentry(name);
+    }
+
+    // entries missing in memory may still be in backing directory
+    if (!backing_path.empty())
+    {
+        backing_path += '/';
+    }
+
+    backing_path += name;
+    return backing.lookup(dir, std::string(name), backing_path);
+}
+
+inode_t * lookup_inode(const stmpfs_pathname_t & pathname, inode_t & root)
 {
     inode_t * cur_dir = &root;
+    std::string backing_path;
     for (const auto& path : pathname.get_pathname())
     {
-        cur_dir = cur_dir->find_in_dentry(path);
+        cur_dir = lookup_component(*cur_dir, path, backing_path);
+        if (cur_dir == nullptr)
+        {
+            return nullptr;
+        }
+    }
+
+    return cur_dir;
+}
+
+inode_t * lookup_inode(std::string_view path, inode_t & root)
+{
+    inode_t * inode;
+    if (dentry_cache.find(path, inode))
+    {
+        return inode;
+    }
+
+    // entries just listed are looked up one by one, their directory is cached then
+    auto slash = path.rfind('/');
+    std::string_view name = slash == std::string_view::npos ? path : path.substr(slash + 1);
+    if (!backing.enabled() && slash != std::string_view::npos && slash != 0 && !name.empty() && name != "."
+        && dentry_cache.find(path.substr(0, slash), inode))
+    {
+        inode = inode == nullptr ? nullptr : inode->lookup_dentry(name);
+        dentry_cache.insert(path, inode);
+        return inode;
     }
 
-    return *cur_dir;
+    inode = &root;
+    std::string backing_path;
+    path_tokenizer_t tokenizer(path);
+    std::string_view component;
+    while (inode != nullptr && tokenizer.next(component))
+    {
+        inode = lookup_component(*inode, component, backing_path);
+    }
+
+    dentry_cache.insert(path, inode);
+    return inode;
+}
+
+std::map < std::string, std::string > filesystem_statistics()
+{
+    return {
+        { "pool", block_pool.statistics() },
+        { "tail_pack", tail_pack.statistics() },
+        { "compressor", compressor.statistics() },
+        { "dedup", dedup.statistics() },
+        { "quota", quota.statistics() },
+        { "spill", spill.statistics() },
+        { "image", image.statistics() },
+        { "journal", journal.statistics() },
+        { "backing", backing.statistics() },
+        { "dentry_cache", dentry_cache.statistics() },
+        { "inode_table", inode_table.statistics() },
+    };
 }
 
 struct timespec current_time()
 {
+    // replayed mutations keep their original time
+    if (journal.replay_time != nullptr)
+    {
+        return *journal.replay_time;
+    }
+
     struct timespec ts{};
     timespec_get(&ts, TIME_UTC);
     return ts;
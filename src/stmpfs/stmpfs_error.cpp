@@ -17,12 +17,21 @@ const char *stmpfs_error_t::what() const noexcept
         case STMPFS_ERROR_PATHNAME_ALREADY_USED:
             return STMPFS_PREFIX "Pathname is already used in directory";
 
+        case STMPFS_ERROR_NO_SPACE_LEFT:
+            return STMPFS_PREFIX "No space left on filesystem";
+
         case STMPFS_ERROR_CANNOT_PARSE_ARGUMENT:
             return STMPFS_PREFIX "Cannot parse the argument";
 
         case STMPFS_ERROR_EXTERNAL_LIB_ERROR:
             return STMPFS_PREFIX "External library error";
 
+        case STMPFS_ERROR_CORRUPTED_IMAGE:
+            return STMPFS_PREFIX "Image file is corrupted";
+
+        case STMPFS_ERROR_CORRUPTED_JOURNAL:
+            return STMPFS_PREFIX "Journal is corrupted or incomplete";
+
         default:
             return STMPFS_PREFIX "Unknown";
     }
@@ -0,0 +1,83 @@
+/** @file
+ *
+ * This file implements tail packing of partial last extents into shared slabs
+ */
+
+#include <tail_pack.h>
+#include <block_pool.h>
+#include <cstring>
+#include <sstream>
+
+tail_pack_t & tail_pack = * new tail_pack_t;
+
+char * tail_pack_t::pack(const char * tail, uint64_t length, uint64_t extent_size)
+{
+    uint64_t packed_length = (length + PACKED_TAIL_ALIGN - 1) & ~(uint64_t)(PACKED_TAIL_ALIGN - 1);
+    std::lock_guard < std::mutex > guard(lock);
+
+    if (current == nullptr || current_used + packed_length > PACKED_SLAB_SIZE)
+    {
+        // slabs are pool blocks, so aligned to their size
+        current = block_pool.allocate(PACKED_SLAB_SIZE);
+        current_used = 0;
+        slabs.emplace((uintptr_t)current, slab_t { .live_tails = 0, .live_bytes = 0 });
+    }
+
+    char * packed = current + current_used;
+    memcpy(packed, tail, length);
+    current_used += packed_length;
+
+    auto & slab = slabs.at((uintptr_t)current);
+    slab.live_tails++;
+    slab.live_bytes += packed_length;
+
+    packed_tails++;
+    packed_bytes += packed_length;
+    extent_bytes += extent_size;
+
+    return packed;
+}
+
+void tail_pack_t::release(char * tail, uint64_t length, uint64_t extent_size)
+{
+    uint64_t packed_length = (length + PACKED_TAIL_ALIGN - 1) & ~(uint64_t)(PACKED_TAIL_ALIGN - 1);
+    auto base = (uintptr_t)tail & ~(uintptr_t)(PACKED_SLAB_SIZE - 1);
+    std::lock_guard < std::mutex > guard(lock);
+
+    auto it = slabs.find(base);
+    it->second.live_tails--;
+    it->second.live_bytes -= packed_length;
+
+    packed_tails--;
+    packed_bytes -= packed_length;
+    extent_bytes -= extent_size;
+
+    if (it->second.live_tails == 0)
+    {
+        if ((char *)base == current)
+        {
+            // reuse current slab from its start
+            current_used = 0;
+            return;
+        }
+
+        block_pool.deallocate((char *)base, PACKED_SLAB_SIZE);
+        slabs.erase(it);
+    }
+}
+
+std::string tail_pack_t::statistics()
+{
+    std::lock_guard < std::mutex > guard(lock);
+    std::stringstream ret;
+    uint64_t slab_bytes = slabs.size() * PACKED_SLAB_SIZE;
+
+    ret << "enabled=" << enabled
+        << " packed_tails=" << packed_tails
+        << " packed_bytes=" << packed_bytes
+        << " slabs=" << slabs.size()
+        << " slab_bytes=" << slab_bytes
+        << " recovered_bytes=" << (extent_bytes > slab_bytes ? extent_bytes - slab_bytes : 0);
+
+    return ret.str();
+}
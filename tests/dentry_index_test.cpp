@@ -0,0 +1,247 @@
+/** @file
+ *
+ * This file tests the directory entry index
+ */
+
+#include <dentry_index.h>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#define TEST_ENTRIES    (1000)  /* well past DENTRY_INDEX_LINEAR_MAX */
+
+/// entries only keep inode pointers, which are never followed
+static char inodes[TEST_ENTRIES];
+
+/// exit with failure if condition does not hold
+static void check(bool condition, const char * what)
+{
+    if (!condition)
+    {
+        std::cerr << "Failed: " << what << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+static std::string name_of(uint64_t i)
+{
+    return "entry_" + std::to_string(i);
+}
+
+static dentry_t dentry_of(uint64_t i)
+{
+    return dentry_t { .if_constructed_by_inode = 0, .inode = (inode_t *)&inodes[i] };
+}
+
+static uint64_t number_of(const dentry_t & dentry)
+{
+    return (char *)dentry.inode - inodes;
+}
+
+/// check every entry in [0, count) is found if present, and nothing else
+static void check_entries(dentry_index_t & index, uint64_t count, const std::vector < bool > & present)
+{
+    uint64_t live = 0;
+    for (uint64_t i = 0; i < count; i++)
+    {
+        auto * dentry = index.find(name_of(i));
+        check(present[i] ? dentry != nullptr && dentry->inode == (inode_t *)&inodes[i] : dentry == nullptr,
+              "entry found if and only if present");
+        live += present[i];
+    }
+
+    check(index.size() == live, "size counts live entries");
+    check(index.find("missing") == nullptr, "missing name not found");
+}
+
+/// names listed after a cookie, in listing order
+static std::vector < std::string > list_after(const dentry_index_t & index, uint64_t cookie)
+{
+    std::vector < std::string > names;
+    for (auto it = index.after(cookie); it != index.end(); ++it)
+    {
+        names.emplace_back(it->name);
+    }
+
+    return names;
+}
+
+/// linear search while small, hash table once larger, and back
+static void test_switchover()
+{
+    dentry_index_t index;
+    std::vector < bool > present(TEST_ENTRIES, false);
+
+    for (uint64_t i = 0; i < TEST_ENTRIES; i++)
+    {
+        check(index.emplace(name_of(i), dentry_of(i)), "new name is added");
+        check(!index.emplace(name_of(i), dentry_of(i)), "taken name is refused");
+        present[i] = true;
+
+        if (i + 1 == DENTRY_INDEX_LINEAR_MAX || i + 1 == DENTRY_INDEX_LINEAR_MAX + 1 || i + 1 == TEST_ENTRIES)
+        {
+            check_entries(index, TEST_ENTRIES, present);
+        }
+    }
+
+    // shrinking below linear size drops the table
+    for (uint64_t i = DENTRY_INDEX_LINEAR_MAX / 2; i < TEST_ENTRIES; i++)
+    {
+        check(index.erase(name_of(i)), "present name is erased");
+        present[i] = false;
+    }
+
+    check(!index.erase(name_of(TEST_ENTRIES - 1)), "erased name is not erased again");
+    check_entries(index, TEST_ENTRIES, present);
+}
+
+/// removal from the hash table keeps every probe chain intact
+static void test_erase()
+{
+    dentry_index_t index;
+    std::vector < bool > present(TEST_ENTRIES, true);
+
+    for (uint64_t i = 0; i < TEST_ENTRIES; i++)
+    {
+        index.emplace(name_of(i), dentry_of(i));
+    }
+
+    // scattered order, every entry erased once
+    for (uint64_t step = 0; step < TEST_ENTRIES; step++)
+    {
+        uint64_t i = step * 7919 % TEST_ENTRIES;
+        check(index.erase(name_of(i)), "present name is erased");
+        present[i] = false;
+
+        if (step % 97 == 0)
+        {
+            check_entries(index, TEST_ENTRIES, present);
+        }
+
+        // names erased early come back while others are still being erased
+        if (step == TEST_ENTRIES / 2)
+        {
+            for (uint64_t j = 0; j < TEST_ENTRIES; j += 3)
+            {
+                if (!present[j])
+                {
+                    check(index.emplace(name_of(j), dentry_of(j)), "erased name is added again");
+                    present[j] = true;
+                }
+            }
+
+            check_entries(index, TEST_ENTRIES, present);
+        }
+    }
+
+    for (uint64_t i = 0; i < TEST_ENTRIES; i++)
+    {
+        if (present[i])
+        {
+            index.erase(name_of(i));
+            present[i] = false;
+        }
+    }
+
+    check(index.empty(), "every entry is erased");
+    check_entries(index, TEST_ENTRIES, present);
+}
+
+/// holes are compacted in order, cookies stay with their entries
+static void test_compaction()
+{
+    dentry_index_t index;
+    std::vector < uint64_t > cookies(TEST_ENTRIES);
+
+    for (uint64_t i = 0; i < TEST_ENTRIES; i++)
+    {
+        index.emplace(name_of(i), dentry_of(i));
+    }
+
+    uint64_t expected = DENTRY_INDEX_FIRST_COOKIE;
+    for (auto & i : index)
+    {
+        check(i.cookie == expected++, "cookies increase from DENTRY_INDEX_FIRST_COOKIE in order added");
+        cookies[number_of(i.dentry)] = i.cookie;
+    }
+
+    // more holes than entries, every few removals
+    std::vector < std::string > kept;
+    for (uint64_t i = 0; i < TEST_ENTRIES; i++)
+    {
+        if (i % 5 == 0)
+        {
+            kept.emplace_back(name_of(i));
+            continue;
+        }
+
+        index.erase(name_of(i));
+    }
+
+    check(list_after(index, 0) == kept, "order added survives compaction");
+    for (auto & i : index)
+    {
+        check(i.cookie == cookies[number_of(i.dentry)], "cookie survives compaction");
+    }
+
+    // cookies are not reused for names added again
+    index.emplace(name_of(1), dentry_of(1));
+    check(index.find(name_of(1)) != nullptr, "name is found after compaction");
+    check(list_after(index, 0).back() == name_of(1), "name added again is listed last");
+    for (auto & i : index)
+    {
+        check(i.name != name_of(1) || i.cookie == expected, "name added again gets a new cookie");
+    }
+}
+
+/// a listing resumed after a cookie neither repeats nor skips entries that stayed
+static void test_after()
+{
+    dentry_index_t index;
+
+    for (uint64_t i = 0; i < 100; i++)
+    {
+        index.emplace(name_of(i), dentry_of(i));
+    }
+
+    check(list_after(index, 0).size() == 100, "listing from 0 holds every entry");
+
+    // resume after entry 49, which is removed meanwhile, while entries come and go
+    uint64_t cookie = 0;
+    for (auto & i : index)
+    {
+        if (i.name == name_of(49))
+        {
+            cookie = i.cookie;
+        }
+    }
+
+    for (uint64_t i = 0; i < 100; i += 2)
+    {
+        index.erase(name_of(i));
+    }
+
+    index.emplace(name_of(100), dentry_of(100));
+
+    std::vector < std::string > expected;
+    for (uint64_t i = 51; i < 100; i += 2)
+    {
+        expected.emplace_back(name_of(i));
+    }
+
+    expected.emplace_back(name_of(100));
+    check(list_after(index, cookie) == expected, "listing resumes after a removed entry");
+    check(list_after(index, UINT64_MAX).empty(), "nothing is listed after the last cookie");
+}
+
+int main()
+{
+    test_switchover();
+    test_erase();
+    test_compaction();
+    test_after();
+
+    std::cout << "dentry index test passed" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,208 @@
+/** @file
+ *
+ * This file tests the inode number table
+ */
+
+#include <inode_table.h>
+#include <inode.h>
+#include <stmpfs_error.h>
+#include <cstdlib>
+#include <iostream>
+#include <vector>
+
+/// exit with failure if condition does not hold
+static void check(bool condition, const char * what)
+{
+    if (!condition)
+    {
+        std::cerr << "Failed: " << what << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+static inode_t & new_inode()
+{
+    auto * inode = new inode_t;
+    inode->fs_stat.st_nlink = 1;
+    inode_table.attach(*inode);
+    return *inode;
+}
+
+/// numbers of destroyed inodes are reused last freed first, under a new generation
+static void test_reuse()
+{
+    std::vector < inode_t * > inodes;
+    for (int i = 0; i < 4; i++)
+    {
+        inodes.emplace_back(&new_inode());
+        check(inodes.back()->fs_stat.st_ino > INODE_TABLE_ROOT, "numbers start past root");
+        check(inode_table.find(inodes.back()->fs_stat.st_ino) == inodes.back(), "number finds its inode");
+    }
+
+    uint64_t first = inodes[1]->fs_stat.st_ino, second = inodes[2]->fs_stat.st_ino;
+    uint64_t generation = inode_table.generation(first);
+
+    delete inodes[1];
+    delete inodes[2];
+    check(inode_table.find(first) == nullptr, "freed number finds nothing");
+    check(inode_table.generation(first) == generation + 1, "freeing a number increases its generation");
+
+    auto & reused = new_inode();
+    check(reused.fs_stat.st_ino == second, "last freed number is reused first");
+    check(new_inode().fs_stat.st_ino == first, "earlier freed number is reused next");
+    check(inode_table.find(first, generation) == nullptr, "old generation does not find reused number");
+    check(inode_table.find(first, generation + 1) != nullptr, "new generation finds reused number");
+
+    delete inode_table.find(first);
+    delete &reused;
+    delete inodes[0];
+    delete inodes[3];
+}
+
+/// a number held by the kernel is not reused before it is released
+static void test_held()
+{
+    auto & inode = new_inode();
+    uint64_t number = inode.fs_stat.st_ino;
+
+    inode_table.hold(number);
+    inode_table.hold(number);
+    delete &inode;
+
+    auto & other = new_inode();
+    check(other.fs_stat.st_ino != number, "held number is not reused");
+
+    check(inode_table.release(number, 1) == 1, "lookups are counted");
+    check(inode_table.release(number, 1) == 0, "every lookup is released");
+    check(new_inode().fs_stat.st_ino == number, "released number is reused");
+
+    delete inode_table.find(number);
+    delete &other;
+}
+
+/// an inode removed while its number is held is kept until released
+static void test_orphan()
+{
+    auto & inode = new_inode();
+    uint64_t number = inode.fs_stat.st_ino;
+
+    inode_table.hold(number);
+    inode_table.remove(inode);
+    check(inode_table.find(number) == &inode, "orphan is still found");
+    check(inode_table.orphan(number), "removed held inode is an orphan");
+    check(inode.fs_stat.st_nlink == 0, "orphan has no links");
+
+    auto & other = new_inode();
+    check(other.fs_stat.st_ino != number, "orphan number is not reused");
+
+    inode_table.release(number, 1);
+    check(inode_table.find(number) == nullptr, "orphan is destroyed once released");
+    check(!inode_table.orphan(number), "released number is no orphan");
+    check(new_inode().fs_stat.st_ino == number, "orphan number is reused once released");
+
+    // not held, destroyed at once
+    uint64_t unheld = other.fs_stat.st_ino;
+    inode_table.remove(other);
+    check(inode_table.find(unheld) == nullptr, "removed unheld inode is destroyed");
+    check(!inode_table.orphan(unheld), "removed unheld inode is no orphan");
+
+    delete inode_table.find(number);
+}
+
+/// root keeps its number
+static void test_root(inode_t & root)
+{
+    inode_table.hold(INODE_TABLE_ROOT);
+    check(inode_table.release(INODE_TABLE_ROOT, 1) == 0, "root lookups are released");
+    check(inode_table.find(INODE_TABLE_ROOT) == &root, "root is kept once released");
+
+    auto & inode = new_inode();
+    check(inode.fs_stat.st_ino != INODE_TABLE_ROOT, "root number is not given out");
+    delete &inode;
+}
+
+/// numbers recorded by an image are kept, the ones skipped are freed lowest first
+static void test_restore()
+{
+    uint64_t base = inode_table.size();
+
+    auto * low = new inode_t;
+    auto * high = new inode_t;
+    inode_table.attach(*high, base + 4);
+    inode_table.attach(*low, base + 1);
+    check(high->fs_stat.st_ino == base + 4, "recorded number is kept");
+    check(inode_table.find(base + 1) == low, "recorded number finds its inode");
+
+    bool thrown = false;
+    try
+    {
+        inode_t taken;
+        inode_table.attach(taken, base + 4);
+    }
+    catch (stmpfs_error_t & error)
+    {
+        thrown = error.my_errcode() == STMPFS_ERROR_CORRUPTED_IMAGE;
+    }
+
+    check(thrown, "taken number is refused");
+
+    thrown = false;
+    try
+    {
+        inode_t other;
+        inode_table.attach(other, INODE_TABLE_ROOT);
+    }
+    catch (stmpfs_error_t & error)
+    {
+        thrown = error.my_errcode() == STMPFS_ERROR_CORRUPTED_IMAGE;
+    }
+
+    check(thrown, "root number is refused");
+
+    // skipped ones and those freed before, which the restore replaces
+    std::vector < uint64_t > skipped;
+    for (uint64_t number = INODE_TABLE_ROOT + 1; number < inode_table.size(); number++)
+    {
+        if (inode_table.find(number) == nullptr)
+        {
+            skipped.emplace_back(number);
+        }
+    }
+
+    check(skipped.size() >= 3 && skipped[skipped.size() - 3] == base, "numbers below recorded ones are skipped");
+
+    inode_table.restored();
+    std::vector < inode_t * > gaps;
+    for (uint64_t number : skipped)
+    {
+        gaps.emplace_back(&new_inode());
+        check(gaps.back()->fs_stat.st_ino == number, "skipped numbers are reused lowest first");
+    }
+
+    gaps.emplace_back(&new_inode());
+    check(gaps.back()->fs_stat.st_ino == base + 5, "new numbers follow recorded ones");
+
+    for (auto * inode : gaps)
+    {
+        delete inode;
+    }
+
+    delete low;
+    delete high;
+}
+
+int main()
+{
+    inode_t root;
+    inode_table.attach_root(root);
+    check(root.fs_stat.st_ino == INODE_TABLE_ROOT, "root is numbered");
+
+    test_reuse();
+    test_held();
+    test_orphan();
+    test_root(root);
+    test_restore();
+
+    std::cout << "inode table test passed" << std::endl;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,236 @@
+/** @file
+ *
+ * This file tests journal replay
+ */
+
+#include <journal.h>
+#include <stmpfs_error.h>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+#define TEST_RECORDS    (10)
+
+/// one replayed record
+struct record_t
+{
+    journal_op_t op;
+    std::string path;
+    uint64_t offset;
+    std::string data;
+};
+
+static std::string journal_path;
+
+/// exit with failure if condition does not hold
+static void check(bool condition, const char * what)
+{
+    if (!condition)
+    {
+        std::cerr << "Failed: " << what << std::endl;
+        exit(EXIT_FAILURE);
+    }
+}
+
+static std::string data_of(uint64_t lsn)
+{
+    return "data of record " + std::to_string(lsn);
+}
+
+static std::string read_file()
+{
+    std::ifstream file(journal_path, std::ios::binary);
+    return { std::istreambuf_iterator < char > (file), std::istreambuf_iterator < char > () };
+}
+
+static void write_file(const std::string & content)
+{
+    std::ofstream file(journal_path, std::ios::binary | std::ios::trunc);
+    file.write(content.data(), (std::streamsize)content.size());
+}
+
+/// file offset of every record, and of the end
+static std::vector < uint64_t > record_offsets(const std::string & content)
+{
+    std::vector < uint64_t > offsets { 0 };
+    while (offsets.back() < content.size())
+    {
+        journal_record_header_t header { };
+        content.copy((char *)&header, sizeof(header), offsets.back());
+        offsets.emplace_back(offsets.back() + header.length);
+    }
+
+    return offsets;
+}
+
+/// replay journal, keeping what was applied
+/** @param after lsn replay starts after
+ *  @param count records appended once replayed
+ *  @param first_lsn set to lsn of first record appended, if given
+ *  @return records replayed **/
+static std::vector < record_t > replay(uint64_t after, uint64_t count = 0, uint64_t * first_lsn = nullptr)
+{
+    std::vector < record_t > records;
+    journal_t journal;
+    journal.path = journal_path;
+    journal.replay(after, [&](journal_op_t op, journal_reader_t & reader)
+    {
+        check(journal.replay_time != nullptr, "record time is given while replaying");
+        record_t record { .op = op };
+        record.path = reader.c_string();
+        record.offset = reader.number();
+        record.data = reader.c_string();
+        records.emplace_back(record);
+    });
+
+    check(journal.replay_time == nullptr, "record time is cleared after replaying");
+
+    journal.start();
+    for (uint64_t i = 0; i < count; i++)
+    {
+        auto lsn = journal.append(JOURNAL_WRITE, std::string_view("/file"), (uint64_t)i, std::string_view(data_of(i)));
+        if (first_lsn != nullptr && i == 0)
+        {
+            *first_lsn = lsn;
+        }
+
+        journal.wait(lsn);
+    }
+
+    journal.stop();
+    return records;
+}
+
+/// records replayed are the ones appended, written with their lsn as offset
+static void check_records(const std::vector < record_t > & records, uint64_t first, uint64_t last)
+{
+    check(records.size() == last - first + 1, "every record is replayed once");
+    for (uint64_t lsn = first; lsn <= last; lsn++)
+    {
+        auto & record = records[lsn - first];
+        check(record.op == JOURNAL_WRITE && record.path == "/file", "record keeps operation and path");
+        check(record.offset == lsn - 1 && record.data == data_of(lsn - 1), "record keeps arguments in order");
+    }
+}
+
+/// everything appended is replayed, or what follows a position
+static void test_replay()
+{
+    uint64_t lsn = 0;
+    check(replay(0, TEST_RECORDS, &lsn).empty(), "new journal is empty");
+    check(lsn == 1, "lsn starts at 1");
+
+    check_records(replay(0), 1, TEST_RECORDS);
+    check_records(replay(TEST_RECORDS / 2), TEST_RECORDS / 2 + 1, TEST_RECORDS);
+    check(replay(TEST_RECORDS).empty(), "nothing is replayed after last record");
+
+    // an image taken past the journal continues numbering after it
+    replay(TEST_RECORDS + 5, 1, &lsn);
+    check(lsn == TEST_RECORDS + 6, "lsn continues after image");
+}
+
+/// records between image and journal are missing
+static void test_missing()
+{
+    replay(0, TEST_RECORDS);
+    auto content = read_file();
+    auto offsets = record_offsets(content);
+    write_file(content.substr(offsets[1]));
+
+    bool thrown = false;
+    try
+    {
+        replay(0);
+    }
+    catch (stmpfs_error_t & error)
+    {
+        thrown = error.my_errcode() == STMPFS_ERROR_CORRUPTED_JOURNAL;
+    }
+
+    check(thrown, "journal starting past image is refused");
+    check_records(replay(1), 2, TEST_RECORDS);
+}
+
+/// a record failing its checksum ends the journal, which is cut there
+static void test_checksum()
+{
+    replay(0, TEST_RECORDS);
+    auto content = read_file();
+    auto offsets = record_offsets(content);
+    content[offsets[3] + sizeof(journal_record_header_t) + 2] ^= 1;
+    write_file(content);
+
+    check_records(replay(0), 1, 3);
+    check(read_file().size() == offsets[3], "journal is cut at bad record");
+    check_records(replay(0), 1, 3);
+}
+
+/// a torn last record is cut off and appending continues after the one before
+static void test_torn()
+{
+    replay(0, TEST_RECORDS);
+    auto content = read_file();
+    auto offsets = record_offsets(content);
+    write_file(content.substr(0, content.size() - 5));
+
+    uint64_t lsn = 0;
+    check_records(replay(0, 1, &lsn), 1, TEST_RECORDS - 1);
+    check(lsn == TEST_RECORDS, "lsn of torn record is given out again");
+    check(read_file().size() == offsets[TEST_RECORDS], "torn record is replaced");
+
+    // record appended is the first of replay's appends
+    auto records = replay(TEST_RECORDS - 1);
+    check(records.size() == 1 && records[0].offset == 0 && records[0].data == data_of(0), "appended record is replayed");
+}
+
+/// arguments past the end of a record are refused
+static void test_reader()
+{
+    std::string arguments;
+    uint64_t number = 42;
+    uint32_t size = 100;
+    arguments.append((const char *)&number, sizeof(number));
+    arguments.append((const char *)&size, sizeof(size));
+    arguments.append("short");
+
+    journal_reader_t reader(arguments.data(), arguments.size());
+    check(reader.number() == 42, "number is read");
+
+    bool thrown = false;
+    try
+    {
+        reader.string();
+    }
+    catch (stmpfs_error_t & error)
+    {
+        thrown = error.my_errcode() == STMPFS_ERROR_CORRUPTED_JOURNAL;
+    }
+
+    check(thrown, "string past end of record is refused");
+}
+
+int main()
+{
+    char directory[] = "/tmp/stmpfs_journal_test.XXXXXX";
+    check(mkdtemp(directory) != nullptr, "temporary directory is created");
+    journal_path = std::string(directory) + "/journal";
+
+    void (*tests[])() = { test_replay, test_missing, test_checksum, test_torn };
+    for (auto * test : tests)
+    {
+        unlink(journal_path.c_str());
+        test();
+    }
+
+    test_reader();
+
+    unlink(journal_path.c_str());
+    rmdir(directory);
+
+    std::cout << "journal test passed" << std::endl;
+    return EXIT_SUCCESS;
+}